@@ -5,14 +5,15 @@
 /**
   @brief 定义了一个内嵌汇编语言的宏函数， 作用是把给定地址的block大小的内存清空为零。
   @param [in] addr 给定的地址
+  @param [in] size 块的字节数
 
   stosl汇编指令的作用是： store string, 把ax中的值存储到es:di处的内存空间中，并更新di的值。
   */
-#define clear_block(addr)                                           \
+#define clear_block(addr, size)                                     \
     _asm__("cld\n\t"                                                \
             "rep\n\t"                                               \
             "stosl"                                                 \
-            ::"a" (0), "c" (BLOCK_SIZE / 4), "D" ((long)(addr))     \
+            ::"a" (0), "c" ((size) / 4), "D" ((long)(addr))         \
             : "cx", "di")
 
 /**
@@ -51,6 +52,19 @@ __asm__ __volatile__("btrl %2, %3\n\t"                              \
                      :"0"(0), "r" (nr), "m" (*(addr)));             \
 res;})
 
+/**
+  @brief 定义了一个内嵌汇编语言的宏函数，返回给定地址的指定位的值(1或0)，不修改它。
+  @param [in] nr 指定第几位。
+  @param [in] addr 变量的地址。
+  */
+#define test_bit(nr, addr) ({                                       \
+register int res __asm__("ax");                                     \
+__asm__ __volatile__("btl %2, %3\n\t"                               \
+                     "setb %%al"                                    \
+                     :"=a"(res)                                     \
+                     :"0"(0), "r" (nr), "m" (*(addr)));             \
+res;})
+
 /**
   @brief 该宏函数实现了从给定地址处查找第一个为0的位，返回查找到的下标，如果没有查找到，则返回8192.
   该宏函数只查找从addr处偏移到1kb的内存空间。
@@ -82,6 +96,142 @@ __asm__("cld\n\t"                                                  \
         :"ax", "dx", "si");                                        \
 __res;})
 
+/**
+  @brief 从给定地址处的第start位开始查找第一个为0的位，返回查找到的下标，如果没有查找到，则返回8192.
+  与find_first_zero()一样只查找1kb的内存空间。
+  @param [in] addr 给定的地址。
+  @param [in] start 开始查找的位。
+  @return 返回查找到的为0的位的下标。
+  */
+static inline int find_next_zero(char* addr, int start)
+{
+    unsigned long* p;
+    unsigned long word;
+    int nr, bit;
+
+    if (start >= 8192)
+        return 8192;
+    p = (unsigned long*)addr + (start >> 5);
+    nr = start & ~31;
+    word = ~*p & (~0UL << (start & 31));    // 只看start及之后的位
+    while (!word)
+    {
+        if ((nr += 32) >= 8192)
+            return 8192;
+        word = ~*++p;
+    }
+    __asm__("bsfl %1, %0":"=r"(bit):"r"(word));
+    return nr + bit;
+}
+
+/**
+  @brief 统计位图中每一块的空闲位数, 只统计前nbits个有效的位。
+  */
+static void count_free(struct buffer_head** maps, unsigned short* free, unsigned short* last, int nslots, int nbits)
+{
+    unsigned long* p;
+    int i, j, limit;
+
+    for (i = 0; i < nslots; i++)
+    {
+        free[i] = 0;
+        last[i] = 0;
+        limit = nbits - (i << 13);
+        if (!maps[i] || limit <= 0)
+            continue;
+        if (limit > 8192)
+            limit = 8192;
+        p = (unsigned long*)maps[i]->b_data;
+        for (j = 0; j < limit; j++)
+        {
+            if (!(p[j >> 5] & (1UL << (j & 31))))
+                free[i]++;
+        }
+    }
+}
+
+/**
+  @brief 超级块的空闲计数还没有统计时统计一次(每次挂载之后第一次分配时)。
+  */
+static void check_counted(struct super_block* sb)
+{
+    if (sb->s_counted)
+        return;
+    count_free(sb->s_zmap, sb->s_zfree, sb->s_zlast, Z_MAP_SLOTS, sb->s_zones - sb->s_firstdatazone + 1);
+    count_free(sb->s_imap, sb->s_ifree, sb->s_ilast, I_MAP_SLOTS, sb->s_ninodes + 1);
+    sb->s_zcur = 0;
+    sb->s_icur = 0;
+    sb->s_counted = 1;
+}
+
+/**
+  @brief 文件系统中还可以分配的逻辑块数: 空闲块中除去为延迟分配预留的块。 为延迟分配的块分配时
+  (设置了PF_RESERVED, 见flush_delayed())用的就是预留的块, 不除去它们。
+  */
+static int avail_zones(struct super_block* sb)
+{
+    int i, n = 0;
+
+    check_counted(sb);
+    for (i = 0; i < Z_MAP_SLOTS; i++)
+        n += sb->s_zfree[i];
+    if (current->flags & PF_RESERVED)
+        return n;
+    return n - sb->s_zreserved;
+}
+
+/**
+  @brief 在位图中分配一个空闲位。 先在goal所在的位图块中从goal往后找，没有goal时从上一次分配的位图块
+  的轮转指针开始找; 空闲计数为0的位图块直接跳过，不需要扫描。
+  @param [in] maps 位图块数组(s_zmap或者s_imap)
+  @param [in,out] free 每个位图块的空闲计数
+  @param [in,out] last 每个位图块的轮转指针
+  @param [in,out] cur 上一次分配所在的位图块
+  @param [in] nslots 位图块数组的大小
+  @param [in] nbits 位图中有效的位数
+  @param [in] goal 希望分配的位, 不大于0时不指定
+  @return 返回分配到的位号(从位图的开头算起), 没有空闲位时返回-1.
+  */
+static int alloc_bit(struct buffer_head** maps, unsigned short* free, unsigned short* last,
+    unsigned char* cur, int nslots, int nbits, int goal)
+{
+    struct buffer_head* bh;
+    int i, j, n, start, limit;
+
+    if (goal > 0 && goal < nbits)
+    {
+        i = goal >> 13;
+        start = goal & 8191;
+    }
+    else
+    {
+        i = *cur;
+        start = last[i];
+    }
+    for (n = 0; n < nslots; n++, i = (i + 1) % nslots, start = last[i])
+    {
+        if (!(bh = maps[i]) || !free[i])
+            continue;
+        if ((limit = nbits - (i << 13)) > 8192)
+            limit = 8192;
+        if ((j = find_next_zero(bh->b_data, start)) >= limit)
+            j = find_next_zero(bh->b_data, 0);
+        if (j >= limit)
+        {
+            free[i] = 0;        // 计数与位图不一致，以位图为准
+            continue;
+        }
+        if (set_bit(j, bh->b_data))
+            panic("alloc_bit: bit already set");
+        journal_dirty(bh);
+        free[i]--;
+        last[i] = j + 1;
+        *cur = i;
+        return (i << 13) + j;
+    }
+    return -1;
+}
+
 /**
   @brief 释放给定指定设备上指定的逻辑块。要强调一下，它释放的是磁盘上的逻辑块啊。
   @param [in] dev 指定的设备
@@ -95,7 +245,7 @@ __res;})
   
   struct supper_block结构内，使用到的成员有：
   first_datazone, 第一个data块号。
-  s_nzones: 这个到底是总的data块数呢？还是最后一个data块号啊？从代码上看，是最后一个data块号啊！但是书上说是总的块数！！！
+  s_zones: 这个到底是总的data块数呢？还是最后一个data块号啊？从代码上看，是最后一个data块号啊！但是书上说是总的块数！！！(v1文件系统中就是s_nzones)
   s_zmap[]:这是一个数组，里面存放了高速缓冲块头指针，使用高速缓冲块(每一个1024kb)的每一位映射一个逻辑块，用于标记该逻辑块是否被占用！
   */
 void free_block(int dev, int block)
@@ -105,13 +255,16 @@ void free_block(int dev, int block)
   
   if (!(sb = get_super(dev)))
     panic("trying to free block on nonexistent device");
-  if (block < sb->s_firstdatazone || block >= sb->s_nzones)    // s_nzones 表示了什么？
+  if (block < sb->s_firstdatazone || block >= sb->s_zones)    // s_zones 表示了什么？
     panic("tring to free block not in datazone");
   
-  bh = get_hash_table(dev, block);
+  bh = get_hash_table_size(dev, block, sb->s_blocksize);
   if (bh)
   {
-    if (bh->b_count != 1)       // 为什么非得是1，万一大于1时，是什么情况？？还是说b_count要么是1，要么是0???
+    // 还在日志的运行事务中的块先从事务中去掉, 放掉日志的引用。
+    journal_forget(bh);
+    // 为什么非得是1，万一大于1时，是什么情况？？还是说b_count要么是1，要么是0???
+    if (bh->b_count != 1)
     {
       printk("trying to free block (%04x:%d), count = %d\n", dev, block, bh->b_count);
       return;    // 为什么直接return掉？超级块内的逻辑块对应的bit位还没有处理啊！！
@@ -127,60 +280,162 @@ void free_block(int dev, int block)
     printk("block (%04x:%d)", dev, block+sb->s_firstdatazone - 1);
     panic("free_block: bit already cleared");
   }
-  sb->s_zmap[block / 8192]->b_dirt = 1;
+  journal_dirty(sb->s_zmap[block / 8192]);
+  journal_freed(dev);
+  if (sb->s_counted)
+    sb->s_zfree[block / 8192]++;
 }
 
 /**
   @brief 在指定设备上新申请一个block块，并把新的逻辑块执行清零操作。返回新申请的逻辑块号。
   @param [in] dev 给定的设备号。
+  @param [in] goal 希望分配的逻辑块号(例如文件上一个数据块的下一块)，为0时不指定。
   @return返回值为申请到的逻辑块号，如果没有申请到，则返回0.
   
   该函数作了如下事情：
-  1. 从超级块中查找一个空闲的逻辑块，怎么查找呢？就是通过查找zmap中为0的位。
+  1. 从超级块中查找一个空闲的逻辑块，怎么查找呢？就是通过查找zmap中为0的位。 优先查找goal附近的位，
+  这样顺序写入的文件的数据块是连续的; 空闲计数为0的位图块直接跳过(见alloc_bit())。
   2. 找到之后，在高速缓冲区建立一个对应[dev, block]的高速缓冲块，然后把高速缓冲块对应的数据区全部设置为0，
   然后把对应的b_dirt位置为1， b_uptodate位置为1，然后就可以释放该高速缓冲块了。 到底高速缓冲块内全为0的
   内容什么时候同步写入到磁盘中，肯定是别的程序来完成了(因为b_dirt位置为1， b_uptodate位置为1了)
   
   这代码写的的确牛逼！！！
   */
-int new_block(int dev)
+int new_block(int dev, int goal)
 {
   struct buffer_head* bh;
   struct super_block *sb;
-  int i;
   int j;
   
   if (!(sb = get_super(dev)))
     panic("trying to get new block from nonexistant device");
   
-  j = 8192;
-  for (i = 0; i < 8; i++)
-  {
-    if (bh = sb->s_zmap[i])
-    {
-      if ((j = find_first_zero(bh->b_data)) < 8192)
-        break;
-    }
-  }
-  
-  if (i >=8 || !bh || j >= 8192)
+  if (avail_zones(sb) <= 0)          // 剩下的空闲块已经预留给了延迟分配的数据
     return 0;
-  if (set_bit(j, bh->data))
-    panic("new block: bit already set");
-  
-  bh->b_dirt = 1;
-  j += i * 8192 + sb->s_firstdatazone - 1;
-  if (j >= sb->s_nzones)
+  if (goal)
+    goal -= sb->s_firstdatazone - 1;
+  if ((j = alloc_bit(sb->s_zmap, sb->s_zfree, sb->s_zlast, &sb->s_zcur,
+          Z_MAP_SLOTS, sb->s_zones - sb->s_firstdatazone + 1, goal)) < 0)
     return 0;
-  if (!(bh = getblk(dev, j)))
+  j += sb->s_firstdatazone - 1;
+  zero_block(dev, j, sb->s_blocksize);
+  return j;
+}
+
+/**
+  @brief 把新分配的逻辑块在高速缓冲区中清零, 由new_block()和claim_block()调用。
+  @param [in] dev 设备号
+  @param [in] block 逻辑块号
+  @param [in] size 文件系统逻辑块的大小(s_blocksize)
+  @return 返回值为空。
+  */
+void zero_block(int dev, int block, int size)
+{
+  struct buffer_head* bh;
+
+  if (!(bh = getblk_size(dev, block, size)))
     panic("new block: cannot get block");
   if (bh->b_count != 1)
     panic("new block: count is not equal 1");
-  clear_block(bh->b_data);
+  clear_block(bh->b_data, size);
   bh->b_uptodate = 1;
   bh->b_dirt = 1;
   brelse(bh); 
-  return j;
+}
+
+/**
+  @brief 预分配: 找出紧跟在block之后的空闲逻辑块作为inode的预分配窗口, 遇到已经使用的块就停止。
+  @param [in] dev 设备号
+  @param [in] block 刚刚分配的逻辑块号
+  @param [in] max 最多预分配的块数
+  @return 返回预分配到的块数, 它们是block + 1开始的连续块。
+
+  窗口只是内存中的预留, 不修改位图(不进入日志, 断电之后也不会泄漏, 还回去时不需要释放逻辑块)。 真正
+  分配给文件时再由claim_block()在位图中占用。 把轮转指针移到窗口后面, 不指定goal的分配不会落到窗口中;
+  窗口中的块仍然可能被别的分配占用, 这时claim_block()失败, 窗口作废。
+  */
+int prealloc_blocks(int dev, int block, int max)
+{
+  struct buffer_head* bh;
+  struct super_block* sb;
+  int n, first, bit, nbits;
+
+  if (!(sb = get_super(dev)))
+    return 0;
+  if (max > (n = avail_zones(sb)))
+    max = n;
+  first = block - (sb->s_firstdatazone - 1);
+  nbits = sb->s_zones - sb->s_firstdatazone + 1;
+  for (n = 0; n < max; n++)
+  {
+    bit = first + n + 1;
+    if (bit >= nbits || !(bh = sb->s_zmap[bit >> 13]))
+      break;
+    if (test_bit(bit & 8191, bh->b_data))
+      break;
+  }
+  bit = first + n;         // 窗口的最后一块
+  if (n && (bit >> 13) == (first >> 13))
+    sb->s_zlast[bit >> 13] = (bit & 8191) + 1;
+  return n;
+}
+
+/**
+  @brief 在位图中占用预分配窗口中的一块, 并在高速缓冲区中清零。
+  @param [in] dev 设备号
+  @param [in] block 逻辑块号
+  @param [in] size 文件系统逻辑块的大小(s_blocksize)
+  @return 成功返回1; 块已经被别的分配占用或者空闲块已经预留给了延迟分配的数据时返回0.
+  */
+int claim_block(int dev, int block, int size)
+{
+  struct buffer_head* bh;
+  struct super_block* sb;
+  int bit;
+
+  if (!(sb = get_super(dev)) || avail_zones(sb) <= 0)
+    return 0;
+  bit = block - (sb->s_firstdatazone - 1);
+  if (!(bh = sb->s_zmap[bit >> 13]) || set_bit(bit & 8191, bh->b_data))
+    return 0;
+  journal_dirty(bh);
+  if (sb->s_counted)
+    sb->s_zfree[bit >> 13]--;
+  zero_block(dev, block, size);
+  return 1;
+}
+
+/**
+  @brief 为一个延迟分配的数据块预留空间: 只增加超级块的预留计数，不修改位图。 n是数据块加上映射它
+  最多需要新分配的间接块数, 由调用者按文件块号算出。 数据写回之前由new_block()在预留中分配, 之后再
+  调用unreserve_blocks()归还预留。
+  @param [in] dev 设备号
+  @param [in] n 预留的块数
+  @return 成功返回1; 空闲块不够时返回0, 这时写操作应该返回-ENOSPC.
+  */
+int reserve_block(int dev, int n)
+{
+  struct super_block* sb;
+
+  if (!(sb = get_super(dev)))
+    return 0;
+  if (avail_zones(sb) < n)
+    return 0;
+  sb->s_zreserved += n;
+  return 1;
+}
+
+/**
+  @brief 归还n个由reserve_block()预留的块。
+  */
+void unreserve_blocks(int dev, int n)
+{
+  struct super_block* sb;
+
+  if (!(sb = get_super(dev)))
+    return;
+  if ((sb->s_zreserved -= n) < 0)
+    sb->s_zreserved = 0;
 }
 
 /**
@@ -190,7 +445,7 @@ int new_block(int dev)
   
   干了两件事：  
   1. 判断inode指针以及inode指向的内容是否有效，如果无效则给出提示并死机。
-  2. 把inode对应的超级块内的imap中的bit位清零，并且把inode指向的内存空间进行清零操作。
+  2. 把inode对应的超级块内的imap中的bit位清零，并且把inode从哈希表中移除、把inode指向的内存空间进行清零操作。
   
   使用到的struct m_inode成员变量有：  
   - i_dev: 
@@ -208,7 +463,7 @@ void free_inode(struct m_inode* inode)
         return;
     if (!inode->i_dev)
     {
-        memset(inode, 0, sizeof(*inode));
+        clear_inode(inode);
         return;
     }
     if (inode->i_count > 1)
@@ -226,8 +481,10 @@ void free_inode(struct m_inode* inode)
         panic("nonexistent imap in superblock");
     if (clear_bit(inode->i_num & 8191, bh->b_data))
         printk("free inode: bit already cleared\n\r");
-    bh->b_dirt = 1;
-    memset(inode, 0, sizeof(*inode));
+    journal_dirty(bh);
+    if (sb->s_counted)
+        sb->s_ifree[inode->i_num >> 13]++;
+    clear_inode(inode);
 }
 
 /**
@@ -235,35 +492,25 @@ void free_inode(struct m_inode* inode)
   @param [in] 指定的设备号
   @return 返回值为申请到的inode节点的指针,如果没有申请失败，则返回NULL.
 
-  首先获取一个空的节点，然后把该节点对应的imap中的位置为1, 然后把i_num设置为对应的inode节点号。
+  首先获取一个空的节点，然后把该节点对应的imap中的位置为1(从轮转指针开始找, 见alloc_bit()), 然后把i_num设置为对应的inode节点号。
   */
 struct m_inode* new_inode(int dev)
 {
   struct m_inode* inode;
   struct super_block* sb;
-  struct buffer_head*bh;
-  int i, j;
+  int j;
   
   if (!(inode = get_empty_inode()))
     return NULL;
   if (!(sb = get_super(dev)))
     panic("new inode with unknown device");
   
-  j = 8192;
-  for (i = 0; i < 8; ++i)
-  {
-    if (bh = sb->s_impa[i])
-      if ((j = find_first_zero(bh->b_data)) < 8192)
-        break;
-  }
-  if (!bh || j >= 8192 || j + i * 8192 > sb_s_ninodes)
+  check_counted(sb);
+  if ((j = alloc_bit(sb->s_imap, sb->s_ifree, sb->s_ilast, &sb->s_icur, I_MAP_SLOTS, sb->s_ninodes + 1, 0)) < 0)
   {
     iput(inode);
     return NULL;
   }
-  if (set_bit(j, bh->b_data))
-      panic("new inode: bit already set");
-  bh->b_dirt = 1;
 
   inode->i_count = 1;                  // inode节点被进程使用的次数
   inode->i_nlinks = 1;                 // 文件目录项的链接数,当创建文件的硬链接时，i_nlinks就会加1.
@@ -271,7 +518,11 @@ struct m_inode* new_inode(int dev)
   inode->i_uid = current->euid;
   inode->i_gid = current->egid;
   inode->dirt = 1;
-  inode->i_num = j + i * 8192;        // 对应设备中的i节点号
+  inode->i_num = j;                   // 对应设备中的i节点号
+  inode->i_version = sb->s_version;
+  inode->i_namelen = sb->s_namelen;
+  inode->i_blocksize = sb->s_blocksize;
+  insert_inode_hash(inode);           // 之后iget()才能在哈希表中找到它
   inode->i_mtime = CURRENT_TIME;
   inode->i_atime = CURRENT_TIME;
   inode->i_ctime = CURRENT_TIME;
@@ -29,18 +29,18 @@ int block_write(int dev, long* pos, char* buf, int count)
         
         /*如果正好是一个逻辑块时，直接调用getblk函数在高速缓存内申请一个新的block块，往里写内容就可以。 如果不正好是
           一个数据块时，就需要使用bread函数把那一块都部读取到高速缓存中，然后再向里面写内容。 能是上一个
-          使用者留下来的。 为了能够进行预读下两个块，所以这里使用了breada函数，该函数最后一个
-          参数需要是负数，表示参数列表的结束。  */
+          使用者留下来的。 部分写只需要这一块, 不再用breada预读后面两块。 */
         if (chars == BLOCK_SIZE)
             bh = getblk(dev, block);
         else
-            bh = breada(dev, block, block + 1, block + 2, -1);
+            bh = bread(dev, block);
         if (!bh)
             return written ? written : -EIO;
         
         p = offset + bh->b_data;
         while (chars-- > 0)
             *(p++) = get_fs_byte(buf++);
+        bh->b_uptodate = 1;                 // getblk()取到的块内容已经全部写入, 之后bread()不能再从磁盘读
         bh->b_dirt = 1;
         brelse(bh);
         
@@ -1,8 +1,10 @@
 #include <stdafg.h>
+#include <errno.h>
 
 #include <linux/config.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
+#include <linux/trace.h>
 #include <asm/system.h>
 #include <asm/io.h>
 
@@ -13,6 +15,18 @@ static struct buffer_head* free_list;
 static struct task_struct* buffer_wait = NULL;
 int NR_BUFFERS = 0;
 
+// 文件系统的逻辑块可以是1KB、2KB或4KB(见read_super())。 buffer_init()划分出来的都是1KB的缓冲块,
+// 更大的缓冲块在第一次需要时按页申请(见grow_buffers()), 申请之后一直留在高速缓冲中。 它们的缓冲块头
+// 在buffer_init()中预留在start_buffer数组的末尾, 所以sys_sync()等函数仍然只需要遍历这个数组。
+// 2KB和4KB的缓冲块各自最多占用高速缓冲四分之一大小的内存(至少BIG_PAGES_MIN页), 挂载的大块文件系统
+// 的数据块、日志和延迟分配都从这里取缓冲块, 它们按buffer_supply()限制自己占用的数量。
+#define BIG_PAGES_MIN 16
+static int big_pages_max;               // 每种大小最多申请的页数
+static int nr_big_heads;                // 预留的缓冲块头的个数
+static struct buffer_head* big_heads;   // 预留的缓冲块头中下一个还没有使用的
+static int big_heads_left;
+static int big_pages[2];                // 已经为2KB(下标0)和4KB(下标1)的缓冲块申请的页数
+
 /**
   @brief 等待指定的缓冲区解锁。
   @param [in] bh 指定的缓冲区的头结构指针
@@ -36,7 +50,8 @@ static inline void wait_on_buffer(struct buffer_head* bh)
   @return 返回int类型，成功返回0.
 
   1. 首先，把所有的inode写入到调整缓冲区内; (这一步干了什么事，还不清楚!）  
-  2. 接着，遍历所有的缓冲块的头结构， 如果有缓冲区的dirty位为1,即
+  2. 提交所有文件系统的日志事务, 之后它们的元数据块才能写回原位置。  
+  3. 接着，遍历所有的缓冲块的头结构， 如果有缓冲区的dirty位为1,即
   表示写硬盘不同步，就需要写入到硬盘中。(在遍历缓冲区的过程中，如果
   碰上了缓冲块被上锁了，就等待解锁)  
 */
@@ -45,18 +60,42 @@ int sys_sync(void)
     int i;
     struct buffer_head* bh;
 
+    sync_delayed(0);    // 先为延迟分配的数据分配逻辑块
     sync_inodes();      // 将inode写入到调整缓冲中
+    journal_commit_all();
 
     bh = start_buffer;
     for(i = 0; i < NR_BUFFERS; ++i, ++bh)
     {
+        cond_resched();     // 缓冲块很多，给其它进程运行的机会
         wait_on_buffer(bh);
-        if (bh->b_dirt)
+        if (bh->b_dirt && !bh->b_journal)    // 还在日志运行事务中的块不能写回
             ll_rw_block(WRITE, bh);
     }
     return 0;
 }
 
+/**
+  @brief 系统调用，把文件的修改写到磁盘上。
+  @param [in] fd 文件描述符
+  @return 成功返回0, fd无效时返回-EBADF.
+
+  这里没有记录每个文件有哪些缓冲块，所以把文件所在设备的脏块都写回。 有日志的文件系统还要提交
+  运行事务并等待它写到日志中, 多个进程同时fsync()时合并到一次提交中(见fs/journal.c)。
+  */
+int sys_fsync(unsigned int fd)
+{
+    struct file* file;
+    struct m_inode* inode;
+
+    if (fd >= NR_OPEN || !(file = current->files->fd[fd]) || !(inode = file->f_inode))
+        return -EBADF;
+    flush_delayed(inode);
+    sync_dev(inode->i_dev);
+    journal_commit(inode->i_dev);
+    return 0;
+}
+
 /**
   @brief 对指定设备进行调整缓冲数据与设备上的数据同步操作。
   @param [in] dev 指定的设备号。
@@ -73,10 +112,11 @@ int sync_dev(int dev)
     bh = start_buffer;
     for (int i = 0; i < NR_BUFFERS; ++i, ++bh)
     {
+        cond_resched();
         if (bh->b_dev != dev)
             continue;
         wait_on_buffer(bh);
-        if (bh->b_dev == dev && bh->dirt)    // 之所以在判断一下dev，是因为wait_on_buffer()可能睡眠。
+        if (bh->b_dev == dev && bh->dirt && !bh->b_journal)    // 之所以在判断一下dev，是因为wait_on_buffer()可能睡眠。
             ll_rw_block(WRITE, bh);
     }
 
@@ -85,10 +125,11 @@ int sync_dev(int dev)
     bh = start_buffer;
     for (int i = 0; i < NR_BUFFERS; ++i, ++bh)
     {
+        cond_resched();
         if (bh->b_dev != dev)
             continue;
         wait_on_buffer(bh);
-        if (bh->b_dev == dev && bh->dirt)
+        if (bh->b_dev == dev && bh->dirt && !bh->b_journal)
             ll_rw_block(WRITE, bh);
     }
 }
@@ -108,6 +149,7 @@ void inline invalidate_buffers(int dev)
     bh = start_buffer;
     for (i = 0; i < NR_BUFFERS; ++i, ++bh)
     {
+        cond_resched();
         if (bh->b_dev != dev)
             continue;
         wait_on_buffer(bh);
@@ -138,6 +180,9 @@ void check_disk_change(int dev)
     if (!floppy_change(dev & 0x03))    // 判断软盘是否更换.
         return;
 
+    // 日志中还没有提交的修改属于原来的盘, 丢弃它们, 不能写到新盘上。
+    journal_abort(dev);
+
     // 释放对应设备的i节点位图我逻辑块位图所占的高速缓冲区。
     for (i = 0; i < NR_SUPER; ++i)
     {
@@ -148,6 +193,9 @@ void check_disk_change(int dev)
     // 使设备的i节点和数据块信息置为无效。
     invalidate_inode(dev);
     invalidate_buffers(dev);
+    // 原来的盘上的名字和目录索引不能用于新盘
+    dcache_purge(dev, 0);
+    dindex_purge(dev, 0);
 }
 
 #define _hashfn(dev, block) (((unsigned)(dev ^ block) % NR_HASH))      // 哈希值的映射
@@ -208,12 +256,13 @@ static inline void insert_into_queues(struct buffer_head* bh)
 
   大致方法就是首先通过设备号和块号，在hash数组中找到对应的hash值链表，然后遍历链表查找指定的设备号和块号。
   */
-static struct buffer_head* find_buffer(int dev, int block)
+static struct buffer_head* find_buffer(int dev, int block, int size)
 {
     struct buffer_head* tmp;
     for (tmp = hash(dev, block); temp != NULL; tmp = tmp->b_next)
     {
-        if (tmp->b_dev == dev && tmp->b_blocknr == block)
+        // 块号以缓冲块的大小为单位，大小不同的缓冲块即使块号相同也不是同一块数据。
+        if (tmp->b_dev == dev && tmp->b_blocknr == block && tmp->b_size == size)
             return tmp;
     }
     return NULL;
@@ -223,23 +272,70 @@ static struct buffer_head* find_buffer(int dev, int block)
   @brief 这个函数也是获取指向设备和指定块的缓冲区志的头指针，不明白为什么linus把函数名叫做get_hash_bable()呢？
 
   该函数在find_buffer()在基础上，得到一个解锁的缓冲区块。
+  @param [in] size 缓冲块的大小: BLOCK_SIZE, 2048或4096
   */
-struct buffer_head* get_hash_table(int dev, int block)
+struct buffer_head* get_hash_table_size(int dev, int block, int size)
 {
     struct buffer_head* bh;
     while (1)
     {
-        if (!bh = find_buffer(dev, block))
+        if (!bh = find_buffer(dev, block, size))
             return NULL;
 
         bh->b_count++;
         wait_on_buffer(bh);
-        if (bh->b_dev == dev && bh->b_blocknr == block)
+        if (bh->b_dev == dev && bh->b_blocknr == block && bh->b_size == size)
             return bh;
         bh->b_count--;
     }
 }
 
+struct buffer_head* get_hash_table(int dev, int block)
+{
+    return get_hash_table_size(dev, block, BLOCK_SIZE);
+}
+
+/**
+  @brief 为大小为size(2048或4096)的缓冲块申请一页内存, 把它分成PAGE_SIZE / size块, 使用预留的缓冲块头
+  加入到空闲链表中。
+  @return 成功返回1; 该大小的缓冲块已经达到上限或者没有空闲页时返回0, 调用者只能等待已有的缓冲块被释放。
+  */
+static int grow_buffers(int size)
+{
+    struct buffer_head* bh;
+    unsigned long page;
+    int i, n = PAGE_SIZE / size;
+
+    if (big_pages[size >> 12] >= big_pages_max || big_heads_left < n)
+        return 0;
+    if (!(page = get_free_page()))
+        return 0;
+    big_pages[size >> 12]++;
+    for (i = 0; i < n; i++)
+    {
+        bh = big_heads++;
+        big_heads_left--;
+        bh->b_data = (char*)(page + i * size);
+        bh->b_size = size;
+        bh->b_dev = 0;
+        insert_into_queues(bh);
+    }
+    return 1;
+}
+
+/**
+  @brief 高速缓冲中最多能有多少个大小为size的缓冲块。 长时间占用缓冲块的地方(日志的运行事务、延迟
+  分配)用它限制自己占用的数量, 不能把某一种大小的缓冲块全部占满, 否则getblk_size()会一直睡眠。
+  @param [in] size 缓冲块的大小: BLOCK_SIZE, 2048或4096
+  @return 返回缓冲块的个数, 大缓冲块是全部申请之后的个数。
+  */
+int buffer_supply(int size)
+{
+    if (size == BLOCK_SIZE)
+        return NR_BUFFERS - nr_big_heads;
+    return big_pages_max * (PAGE_SIZE / size);
+}
+
 #define BADNESS(bh) (((bh)->b_dirt << 1) + (bh)->b_lock)
 
 /**
@@ -247,17 +343,23 @@ struct buffer_head* get_hash_table(int dev, int block)
   则直接返回它即可，如果不在高速缓冲区内，则需要从高速缓冲区中查找一个空间块，设置它的
   设备号和块号，并加入到hash_table中。
   @param [in] dev 指定的设备号。
-  @param [in] block 指定的块号。
+  @param [in] block 指定的块号, 以size为单位。
+  @param [in] size 缓冲块的大小: BLOCK_SIZE, 2048或4096, 只会选用大小相同的空闲缓冲块。
   @return 返回对应的缓冲区头指针.
   */
-struct buffer_head* getblk(int dev, int block)
+struct buffer_head* getblk_size(int dev, int block, int size)
 {
     struct buffer_head* tmp;
     struct buffer_head* bh;
 
+    if (size != BLOCK_SIZE && size != 2048 && size != 4096)
+        panic("getblk: bad block size");
 repeat:
-    if (bh = get_hash_table(dev, block))
+    if (bh = get_hash_table_size(dev, block, size))
+    {
+        trace_event(TRACE_GETBLK, dev, block, 1);
         return bh;
+    }
 
     // 该do while循环遍历free_list，找到一个最合适的空的缓冲块.
     // 什么是最合适呢？修改位和锁定位都为0,是最合适的。往后继续读代码，你会发现
@@ -265,7 +367,7 @@ repeat:
     tmp = free_list;
     do
     {
-        if (tmp->b_count)
+        if (tmp->b_count || tmp->b_size != size)
             continue;
 
         if (!bh || BADNESS(tmp) < BADNESS(bh))    // 这行代码多注意一下。
@@ -277,10 +379,12 @@ repeat:
     } while ((tmp = tmp->b_next_free) != free_list)
 
 
-    // 如果bh为空，则说明在上面的do-while循环内没有找到空闲的缓冲块，使当前进程睡眠，然后
-    // 重新再重复上面的过程。
+    // 如果bh为空，则说明在上面的do-while循环内没有找到空闲的缓冲块: 大块先尝试再申请一页，
+    // 否则使当前进程睡眠，然后重新再重复上面的过程。
     if (!bh)
     {
+        if (size != BLOCK_SIZE && grow_buffers(size))
+            goto repeat;
         sleep_on(&buffer_wait);
         goto repeat;
     }
@@ -303,7 +407,7 @@ repeat:
     // 一直检测的缓冲块加入到了已经使用的高速缓存中， 所以再进行检测一遍。
     // 这个地方有点不明白：如果其它进程它该缓冲块加入到了高速缓存中，那么为什么会设置缓冲块
     // 对应的dev和block为当前进程需要查找的dev和block呢？？
-    if (find_buffer(dev, block))
+    if (find_buffer(dev, block, size))
         goto repeat;
 
     // 此时，bh一定是没有被占有，没有上锁，没有被修改的, 并且uptodate为0，表示数据无效。
@@ -318,9 +422,15 @@ repeat:
     bh->b_dev = dev;
     bh->b_blocknr = block;
     insert_into_queues(bh);
+    trace_event(TRACE_GETBLK, dev, block, 0);
     return bh;
 }
 
+struct buffer_head* getblk(int dev, int block)
+{
+    return getblk_size(dev, block, BLOCK_SIZE);
+}
+
 /**
   @brief 释放指定的缓冲区。
   @param [in] buf 待删除的指定的缓冲区的头指针
@@ -333,6 +443,7 @@ void brelse(struct buffer_head* buf)
 {
     if(!buf)
         return;
+    trace_event(TRACE_BRELSE, buf->b_dev, buf->b_blocknr, 0);
     wait_on_buffer(buf);
     if (!buf->b_count--)
         panic("trying to free free buffer");
@@ -342,14 +453,15 @@ void brelse(struct buffer_head* buf)
 /**
   @brief  从设备上读取指定设备的数据块，并返回含有数据的buffer_head指针。
   @param [in] dev 指定的设备
-  @param [in] block 指定的块
+  @param [in] block 指定的块, 以size为单位
+  @param [in] size 块的大小, 文件系统的数据块和间接块是所在文件系统的逻辑块大小
   @return 如果成功，返回相应数据的块头指针，如果失败，返回NULL.
   */
-struct buffer_head* bread(int dev, int block)
+struct buffer_head* bread_size(int dev, int block, int size)
 {
     struct buffer_head* bh;
 
-    if (bh = getblk(dev, block))
+    if (bh = getblk_size(dev, block, size))
         panic("bread: getblk return NULL\n");
 
     if (bh->b_uptodate)
@@ -364,36 +476,47 @@ struct buffer_head* bread(int dev, int block)
     return NULL;
 }
 
+struct buffer_head* bread(int dev, int block)
+{
+    return bread_size(dev, block, BLOCK_SIZE);
+}
+
 /**
-  @brief 定义了一个宏，功能是复制内在块:从一个地方复制到另一个地方,一共复制BLOCK_SIZE个字节大小的数据。
+  @brief 定义了一个宏，功能是复制内在块:从一个地方复制到另一个地方,一共复制size个字节大小的数据。
   @param [in] from 源地址
   @param [in] to  目的地址
+  @param [in] size 字节数, 是4的倍数
   */
-#define COPYBLK(from, to)                                           \
+#define COPYBLK(from, to, size)                                     \
 __asm__("cld\n\t"                                                   \
         "rep\n\t"                                                   \
         "movsl\n\t"                                                 \
-        ::"c"(BLOCK_SIZE / 4), "S"(from), "D"(to)                   \
+        ::"c"((size) / 4), "S"(from), "D"(to)                       \
         :"cx", "di", "si")
 
 /**
-  @brief 该函数实现把指定设备上的指定4个块(每一个块为1024kb)的内容复制到指定的address处。
+  @brief 该函数实现把指定设备上的一页内容复制到指定的address处: 从块b[0]内偏移offset处开始，依次复制
+  b[0], b[1], ...中的数据，一共PAGE_SIZE个字节。
   @param [in] address 复制到的目的地址
   @param [in] dev 指定的设备号
-  @param [in] b[4] 存放4个块号的数组
+  @param [in] b[4] 存放块号的数组, 块号为0的部分不复制(保持为0)
+  @param [in] size 块的大小
+  @param [in] offset 第一块内的起始偏移, 是BLOCK_SIZE的倍数。 1KB的块时为0, 用满4项;
+  可执行文件的头占用1KB, 所以更大的块时页面不和块对齐，需要3项(2KB)或2项(4KB)。
   @return 返回值为空。
   */
-void bread_page(unsigned long address, int dev, int b[4])
+void bread_page(unsigned long address, int dev, int b[4], int size, int offset)
 {
     struct buffer_head* bh[4];
-    int i;
+    int i, chars, left = PAGE_SIZE;
+    int n = (offset + PAGE_SIZE + size - 1) / size;
 
     // 该for循环负责得到指定设备和块号对应的高速缓冲块头指针，它们对应的高速缓冲块有需要的数据。
-    for (i = 0; i < 4; ++i)
+    for (i = 0; i < n; ++i)
     {
         if (b[i])
         {
-            if (bh[i] = getblk(dev, b[i]))
+            if (bh[i] = getblk_size(dev, b[i], size))
                 if (!bh[i]->b_uptodate)    // 如果数据不存在于缓冲区中，则需要从磁盘中读取信息。
                     ll_rw_block(READ, bh[i]);
         }
@@ -402,13 +525,15 @@ void bread_page(unsigned long address, int dev, int b[4])
     }
 
     // 该for循环负责把高速缓冲块中的数据写到指定的地址处。
-    for (i = 0; i < 4; ++i, address += BLOCK_SIZE)
+    for (i = 0; i < n; ++i, address += chars, left -= chars, offset = 0)
     {
+        if ((chars = size - offset) > left)
+            chars = left;
         if (bh[i])
         {
             wait_on_buffer(bh[i]);
             if (bh[i]->b_uptodate)
-                COPYBLK((unsigned long)bh[i]->b_data, address);
+                COPYBLK((unsigned long)bh[i]->b_data + offset, address, chars);
             brelse(bh[i]);
         }
     }
@@ -464,18 +589,27 @@ void buffer_init(long buffer_end)
     else
         b = (void*)buffer_end;
 
+    // 大缓冲块的页数上限按高速缓冲的大小计算, 每页要预留一个4KB和两个2KB的缓冲块头。
+    big_pages_max = ((long)b - (long)start_buffer) / 4 / PAGE_SIZE;
+    if (big_pages_max < BIG_PAGES_MIN)
+        big_pages_max = BIG_PAGES_MIN;
+    nr_big_heads = big_pages_max * (PAGE_SIZE / 2048 + PAGE_SIZE / 4096);
+
     // 该while建立起缓冲区头和缓冲区块的对应关系，把缓冲区头串起来形成双向链表。
-    while (b -= BLOCK_SIZE >= ((void*)(h+1)))
+    // 末尾留出nr_big_heads个缓冲块头给grow_buffers()使用。
+    while (b -= BLOCK_SIZE >= ((void*)(h + 1 + nr_big_heads)))
     {
         h->b_dev = 0;
         h->b_dirt = 0;
         h->b_count = 0;
         h->b_lock = 0;
+        h->b_journal = 0;
         h->b_update = 0;
         h->b_wait = NULL;
         h->b_next = NULL;
         h->b_prev = NULL;
         h->b_data = (char*)b;
+        h->b_size = BLOCK_SIZE;
         h->b_prev_free = h - 1;
         h->b_next_free = h + 1;
 
@@ -492,6 +626,26 @@ void buffer_init(long buffer_end)
     free_list->b_prev_free = h;
     h->b_next_free = free_list;
 
+    // 预留的缓冲块头还没有数据区，b_dev为0, 不在空闲链表中。
+    big_heads = h + 1;
+    big_heads_left = nr_big_heads;
+    for (i = 0; i < nr_big_heads; ++i)
+    {
+        h++;
+        h->b_dev = 0;
+        h->b_size = 0;
+        h->b_data = NULL;
+        h->b_dirt = 0;
+        h->b_count = 0;
+        h->b_lock = 0;
+        h->b_journal = 0;
+        h->b_uptodate = 0;
+        h->b_wait = NULL;
+        h->b_next = h->b_prev = NULL;
+        h->b_prev_free = h->b_next_free = NULL;
+        NR_BUFFERS++;
+    }
+
     // 初始化哈希表为NULl.
     for (i = 0; i < NR_HASH; ++i)
         hash_table[i] = NULL;
@@ -7,6 +7,7 @@
 
 extern int tty_read(unsigned minor, char* buf, int count);    // 终端读
 extern int tty_write(unsigned minor, char* buf, int count);   // 终端写
+extern int rw_kstat(int rw, unsigned minor, char* buf, int count, off_t* pos);    // 内核统计信息, 见kstat.c
 
 typedef int (*crw_ptr)(int rw, unsigned minor, char* buf, int count, off_t* pos);
 
@@ -101,7 +102,8 @@ static crw_ptr crw_table[] =    // 主设备列表
     rw_ttyx,          // 串口终端
     rw_tty,           // 终端
     NULL,             // 打印机
-    NULL
+    NULL,             // 命名管道
+    rw_kstat          // 内核统计信息(kstat)
 };
 #define NRDEVS ((sizeof(crw_table)) / (sizeof(crw_ptr)))
 
@@ -0,0 +1,201 @@
+/**
+  @file
+  @brief 目录项缓存: 缓存(设备号, 父目录的i节点号, 名字) -> i节点号的映射，这样重复打开同一个路径时
+  不需要每一级都通过find_entry()读取并扫描目录的数据块。
+
+  找不到的名字也会被缓存(负目录项, i节点号为0), 反复查找不存在的文件(例如在PATH中查找命令)同样不需要
+  扫描目录。 目录的内容发生变化时(创建/删除/链接)，调用者负责调用dcache_invalidate()删除对应的缓存项,
+  删除目录和卸载文件系统时调用dcache_purge()删除整个目录或者整个设备的缓存项。
+
+  查找目录时可能会睡眠, 这期间目录可能被修改，查找的结果已经过时了。 每次删除缓存项时增加dcache_gen,
+  查找之前记下它(dcache_generation()), 加入结果时它变化了就不加入(见dcache_add())。
+  */
+
+#include <string.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+
+#define NR_DCACHE 128               // 缓存项的个数
+#define DCACHE_HASH_SZ 64           // 哈希表的大小, 必须是2的幂
+
+struct dcache_entry
+{
+    unsigned short dev;             // 设备号, 为0时表示该项没有使用
+    unsigned short dir;             // 父目录的i节点号
+    unsigned short ino;             // 名字对应的i节点号, 0表示该名字不存在(负目录项)
+    unsigned short len;             // 名字的长度
+    char name[NAME_LEN_30];
+    struct dcache_entry* hash_next;
+    struct dcache_entry* lru_prev;  // LRU链表, 表头的下一项是最近使用的
+    struct dcache_entry* lru_next;
+};
+
+static struct dcache_entry dcache[NR_DCACHE];
+static struct dcache_entry* dcache_hash[DCACHE_HASH_SZ];
+static struct dcache_entry lru_head = {0, 0, 0, 0, {0, }, NULL, &lru_head, &lru_head};
+static unsigned long dcache_gen = 0;    // 删除缓存项的次数
+
+/**
+  @brief 计算哈希值, 由设备号、父目录和名字共同决定。
+  */
+static int dcache_hashfn(int dev, int dir, const char* name, int len)
+{
+    unsigned long hash = dev ^ (dir << 4);
+
+    while (len-- > 0)
+        hash = (hash << 3) ^ (hash >> 28) ^ (unsigned char)*name++;
+    return hash & (DCACHE_HASH_SZ - 1);
+}
+
+/**
+  @brief 把缓存项移动到LRU链表的头部(最近使用)。 还不在链表中的项(lru_next为NULL)直接插入。
+  */
+static void lru_touch(struct dcache_entry* d)
+{
+    if (d->lru_next)
+    {
+        d->lru_prev->lru_next = d->lru_next;
+        d->lru_next->lru_prev = d->lru_prev;
+    }
+    d->lru_next = lru_head.lru_next;
+    d->lru_prev = &lru_head;
+    lru_head.lru_next->lru_prev = d;
+    lru_head.lru_next = d;
+}
+
+/**
+  @brief 把缓存项从哈希表中删除，并标记为没有使用。 它仍然留在LRU链表中, 会被优先重用。
+  */
+static void dcache_unhash(struct dcache_entry* d)
+{
+    struct dcache_entry** pp;
+
+    if (!d->dev)
+        return;
+    for (pp = dcache_hash + dcache_hashfn(d->dev, d->dir, d->name, d->len); *pp; pp = &(*pp)->hash_next)
+    {
+        if (*pp == d)
+        {
+            *pp = d->hash_next;
+            break;
+        }
+    }
+    d->dev = 0;
+    // 没有使用的项放到LRU链表的尾部
+    if (d->lru_next)
+    {
+        d->lru_prev->lru_next = d->lru_next;
+        d->lru_next->lru_prev = d->lru_prev;
+        d->lru_prev = lru_head.lru_prev;
+        d->lru_next = &lru_head;
+        lru_head.lru_prev->lru_next = d;
+        lru_head.lru_prev = d;
+    }
+}
+
+/**
+  @brief 在哈希表中查找缓存项。
+  */
+static struct dcache_entry* dcache_find(int dev, int dir, const char* name, int len)
+{
+    struct dcache_entry* d = dcache_hash[dcache_hashfn(dev, dir, name, len)];
+
+    for (; d; d = d->hash_next)
+    {
+        if (d->dev == dev && d->dir == dir && d->len == len && !strncmp(d->name, name, len))
+            return d;
+    }
+    return NULL;
+}
+
+/**
+  @brief 查找目录dir中的名字。
+  @param [in] dev/dir 父目录所在的设备和它的i节点号
+  @param [in] name 名字(内核空间中的), 长度不超过NAME_LEN_30
+  @param [in] len 名字的长度
+  @return 缓存中没有时返回-1; 否则返回名字对应的i节点号, 0表示缓存了该名字不存在。
+  */
+int dcache_lookup(int dev, int dir, const char* name, int len)
+{
+    struct dcache_entry* d;
+
+    if (!(d = dcache_find(dev, dir, name, len)))
+        return -1;
+    lru_touch(d);
+    return d->ino;
+}
+
+/**
+  @brief 查找目录之前调用, 返回值传给dcache_add().
+  */
+unsigned long dcache_generation(void)
+{
+    return dcache_gen;
+}
+
+/**
+  @brief 把查找的结果加入缓存, 缓存满了时重用最久没有使用的项。
+  @param [in] ino 名字对应的i节点号, 不存在时为0
+  @param [in] gen 查找目录之前dcache_generation()的返回值, 之后有缓存项被删除过时结果可能已经过时, 不加入
+  */
+void dcache_add(int dev, int dir, const char* name, int len, int ino, unsigned long gen)
+{
+    struct dcache_entry* d;
+    int hash;
+
+    if (len > NAME_LEN_30 || gen != dcache_gen)
+        return;
+    if ((d = dcache_find(dev, dir, name, len)))
+    {
+        d->ino = ino;
+        lru_touch(d);
+        return;
+    }
+    // 先使用还没有进入LRU链表的项, 然后才重用链表尾部的项
+    for (d = dcache; d < dcache + NR_DCACHE; d++)
+    {
+        if (!d->lru_next)
+            break;
+    }
+    if (d >= dcache + NR_DCACHE)
+    {
+        d = lru_head.lru_prev;
+        dcache_unhash(d);
+    }
+    d->dev = dev;
+    d->dir = dir;
+    d->ino = ino;
+    d->len = len;
+    strncpy(d->name, name, len);
+    hash = dcache_hashfn(dev, dir, name, len);
+    d->hash_next = dcache_hash[hash];
+    dcache_hash[hash] = d;
+    lru_touch(d);
+}
+
+/**
+  @brief 目录dir中的名字被创建或者删除了，删除对应的缓存项。
+  */
+void dcache_invalidate(int dev, int dir, const char* name, int len)
+{
+    struct dcache_entry* d;
+
+    dcache_gen++;
+    if ((d = dcache_find(dev, dir, name, len)))
+        dcache_unhash(d);
+}
+
+/**
+  @brief 删除目录dir中的所有缓存项; dir为0时删除设备dev上的所有缓存项(卸载文件系统时)。
+  */
+void dcache_purge(int dev, int dir)
+{
+    struct dcache_entry* d;
+
+    dcache_gen++;
+    for (d = dcache; d < dcache + NR_DCACHE; d++)
+    {
+        if (d->dev == dev && (!dir || d->dir == dir))
+            dcache_unhash(d);
+    }
+}
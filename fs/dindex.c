@@ -0,0 +1,245 @@
+/**
+  @file
+  @brief 大目录的哈希索引: 为目录项很多的目录在内存中建立 名字的哈希值 -> 目录项槽位号 的索引，
+  find_entry()只需要读取哈希值相同的几个目录项所在的块，不需要从头扫描整个目录。
+
+  MINIX文件系统的磁盘格式不变，索引只存在于内存中: 第一次在大目录中查找时扫描一遍整个目录建立索引，
+  之后由add_entry()随着新目录项的加入维护它。删除目录项时不需要修改索引，索引中残留的槽位在比较名字时
+  会因为i节点号为0而被跳过，槽位被重用时再从旧名字的链表中摘除。
+
+  每个索引由一页哈希桶和若干页槽位链接组成, 槽位号就是目录项在目录中的序号(i_size / 16)。 槽位链接中
+  保存了哈希值的低16位, 只有它相同时才需要读取目录块比较名字。 索引放不下或者内存不够时直接丢弃，
+  find_entry()退回到线性扫描。
+  */
+
+#include <string.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+
+#define NR_DINDEX 4                 // 最多同时为几个目录建立索引
+#define DINDEX_HASH_SZ 2048         // 哈希桶的个数, 正好一页, 必须是2的幂
+#define DINDEX_SLOTS_PER_PAGE 1024  // 每页能保存的槽位链接数
+#define DINDEX_MAX_PAGES 32         // 槽位链接最多占用的页数, 即最多索引32768个目录项
+#define DINDEX_NIL 0xffff           // 空链表
+
+struct dindex_slot
+{
+    unsigned short next;            // 同一个桶中的下一个槽位
+    unsigned short tag;             // 名字哈希值的低16位
+};
+
+struct dir_index
+{
+    unsigned short dev;             // 目录所在的设备号, 为0时表示该项没有使用
+    unsigned short ino;             // 目录的i节点号
+    unsigned short count;           // 正在使用该索引的进程数, 不为0时不能释放
+    unsigned short nr_pages;        // 已经申请的槽位链接页数
+    unsigned short ready;           // 建立完成之前不能用于查找, 只接受add_entry()的插入
+    unsigned long stamp;            // 最后一次使用的时间, 回收最久没有使用的索引
+    unsigned short* head;           // 哈希桶
+    struct dindex_slot* slots[DINDEX_MAX_PAGES];
+};
+
+static struct dir_index dindex[NR_DINDEX];
+
+#define SLOT(d, nr) ((d)->slots[(nr) / DINDEX_SLOTS_PER_PAGE] + (nr) % DINDEX_SLOTS_PER_PAGE)
+// 桶号取乘法散列的高位，标签直接取哈希值的低16位，两者互不相关
+#define BUCKET(hash) ((((hash) * 0x9e370001UL) >> 21) & (DINDEX_HASH_SZ - 1))
+#define TAG(hash) ((unsigned short)(hash))
+
+/**
+  @brief 计算名字的哈希值。
+  @param [in] name 名字(内核空间中的)
+  @param [in] len 名字的长度，名字中遇到0时提前结束(磁盘上的名字不足目录的名字长度时以0结尾)
+  */
+unsigned long dindex_hash(const char* name, int len)
+{
+    unsigned long hash = 0;
+
+    while (len-- > 0 && *name)
+        hash = hash * 31 + (unsigned char)*name++;
+    return hash;
+}
+
+/**
+  @brief 释放索引占用的内存页。
+  */
+static void dindex_free(struct dir_index* d)
+{
+    int i;
+
+    if (d->head)
+        free_page((unsigned long)d->head);
+    for (i = 0; i < d->nr_pages; i++)
+        free_page((unsigned long)d->slots[i]);
+    d->head = NULL;
+    d->nr_pages = 0;
+}
+
+/**
+  @brief 查找目录的索引，找到时增加它的使用计数, 用完之后要调用dindex_put()。
+  @param [in] building 为1时也返回还在建立中的索引(add_entry()维护索引时需要), 查找时为0.
+  @return 找到时返回索引的指针，否则返回NULL.
+  */
+struct dir_index* dindex_get(int dev, int ino, int building)
+{
+    struct dir_index* d;
+
+    for (d = dindex; d < dindex + NR_DINDEX; d++)
+    {
+        if (d->dev && d->dev == dev && d->ino == ino && (building || d->ready))
+        {
+            d->count++;
+            d->stamp = jiffies;
+            return d;
+        }
+    }
+    return NULL;
+}
+
+/**
+  @brief 为目录新建一个空的索引，没有空闲项时回收最久没有使用的空闲索引。 返回的索引使用计数为1,
+  调用者扫描目录把所有的目录项插入之后调用dindex_ready()。
+  @return 成功时返回索引的指针，所有的索引都在使用或者没有内存时返回NULL.
+  */
+struct dir_index* dindex_new(int dev, int ino)
+{
+    struct dir_index *d, *victim = NULL;
+    int i;
+
+    for (d = dindex; d < dindex + NR_DINDEX; d++)
+    {
+        if (d->count)
+            continue;
+        if (!d->dev)
+        {
+            victim = d;
+            break;
+        }
+        if (!victim || d->stamp < victim->stamp)
+            victim = d;
+    }
+    if (!(d = victim))
+        return NULL;
+    dindex_free(d);
+    d->dev = 0;
+    if (!(d->head = (unsigned short*)get_free_page()))
+        return NULL;
+    for (i = 0; i < DINDEX_HASH_SZ; i++)
+        d->head[i] = DINDEX_NIL;
+    d->dev = dev;
+    d->ino = ino;
+    d->ready = 0;
+    d->count = 1;
+    d->stamp = jiffies;
+    return d;
+}
+
+/**
+  @brief 索引建立完成，之后可以用于查找。
+  */
+void dindex_ready(struct dir_index* d)
+{
+    d->ready = 1;
+}
+
+/**
+  @brief 释放对索引的使用。 已经被丢弃的索引在最后一个使用者释放时才归还内存。
+  */
+void dindex_put(struct dir_index* d)
+{
+    if (!d)
+        return;
+    if (!d->count)
+        panic("dindex_put: free index");
+    if (!--d->count && !d->dev)
+        dindex_free(d);
+}
+
+/**
+  @brief 丢弃索引，之后在该目录中的查找退回到线性扫描。
+  */
+void dindex_drop(struct dir_index* d)
+{
+    d->dev = 0;
+    if (!d->count)
+        dindex_free(d);
+}
+
+/**
+  @brief 删除目录ino的索引; ino为0时删除设备dev上的所有索引(卸载文件系统时)。
+  */
+void dindex_purge(int dev, int ino)
+{
+    struct dir_index* d;
+
+    for (d = dindex; d < dindex + NR_DINDEX; d++)
+    {
+        if (d->dev && d->dev == dev && (!ino || d->ino == ino))
+            dindex_drop(d);
+    }
+}
+
+/**
+  @brief 把槽位slot加入到哈希值为hash的链表中, 需要时申请新的槽位链接页。 建立索引的过程中可能
+  睡眠, 这期间add_entry()可能已经插入了同一个槽位, 所以已经在链表中的槽位不再重复插入。
+  @return 成功返回1; 槽位超出了索引的容量或者没有内存时返回0, 这时调用者应该丢弃该索引。
+  */
+int dindex_insert(struct dir_index* d, unsigned long hash, int slot)
+{
+    struct dindex_slot* s;
+    unsigned short nr;
+
+    if (slot < 0 || slot >= DINDEX_MAX_PAGES * DINDEX_SLOTS_PER_PAGE)
+        return 0;
+    for (nr = d->head[BUCKET(hash)]; nr != DINDEX_NIL; nr = SLOT(d, nr)->next)
+    {
+        if (nr == slot)
+            return 1;
+    }
+    while (slot / DINDEX_SLOTS_PER_PAGE >= d->nr_pages)
+    {
+        if (!(d->slots[d->nr_pages] = (struct dindex_slot*)get_free_page()))
+            return 0;
+        d->nr_pages++;
+    }
+    s = SLOT(d, slot);
+    s->tag = TAG(hash);
+    s->next = d->head[BUCKET(hash)];
+    d->head[BUCKET(hash)] = slot;
+    return 1;
+}
+
+/**
+  @brief 把槽位slot从哈希值为hash的链表中摘除, 不在链表中时什么也不做。
+  */
+void dindex_remove(struct dir_index* d, unsigned long hash, int slot)
+{
+    unsigned short* p;
+
+    for (p = d->head + BUCKET(hash); *p != DINDEX_NIL; p = &SLOT(d, *p)->next)
+    {
+        if (*p == slot)
+        {
+            *p = SLOT(d, slot)->next;
+            return;
+        }
+    }
+}
+
+/**
+  @brief 遍历哈希值为hash的链表。 slot为-1时从链表头开始, 否则从槽位slot的下一项开始。
+  @return 返回下一个标签也相同的槽位，没有时返回-1.
+  */
+int dindex_next(struct dir_index* d, unsigned long hash, int slot)
+{
+    unsigned short nr;
+
+    nr = (slot < 0) ? d->head[BUCKET(hash)] : SLOT(d, slot)->next;
+    for (; nr != DINDEX_NIL; nr = SLOT(d, nr)->next)
+    {
+        if (SLOT(d, nr)->tag == TAG(hash))
+            return nr;
+    }
+    return -1;
+}
@@ -21,7 +21,7 @@ extern int sys_close(int fd);
 static int dupfd(unsigned int fd, unsigned int arg)
 {
     // 当原文件句柄号超过了最大值或者它对应的文件指针不存在时，返回错误码。
-    if (fd >= NR_OPEN || !current->filp[fd])
+    if (fd >= NR_OPEN || !current->files->fd[fd])
         return -EBADF;
     
     // 当新文件句柄号的最小值非法或找不到满足条件的新句柄号时，也返回错误码。
@@ -29,7 +29,7 @@ static int dupfd(unsigned int fd, unsigned int arg)
         return -EINVAL;
     while (arg < NR_OPEN)
     {
-        if (current->filp[arg])
+        if (current->files->fd[arg])
           ++arg;
         else
             break;
@@ -38,9 +38,9 @@ static int dupfd(unsigned int fd, unsigned int arg)
         return -EMFILE;
     
     // 在【执行时关闭位图】中复位该句柄号，也就是说在运行exec时，不关闭该文件句柄。
-    current->close_on_exec &= ~(1 << arg);
+    current->files->close_on_exec &= ~(1 << arg);
     // 复制文件指针，把增加计数值。
-    (current->filp[arg] = current->filp[fd])->f_count++;
+    (current->files->fd[arg] = current->files->fd[fd])->f_count++;
     return arg;
 }
 
@@ -77,7 +77,7 @@ int sys_dup(unsigned int fd)
 int sys_fntl(unsigned int fd, unsigned int cmd, unsigned long arg)
 {
     struct file* filp;
-    if (fd >= NR_OPEN || !(fiilp = current->filp[fd]))
+    if (fd >= NR_OPEN || !(fiilp = current->files->fd[fd]))
         return -EBADF;
     
     switch(cmd)
@@ -85,12 +85,12 @@ int sys_fntl(unsigned int fd, unsigned int cmd, unsigned long arg)
         case F_DUPFD:        // 复制文件句柄
             return dupfd(fd, arg);
         case F_GETFD:       // 取文件句柄的执行时关闭标志，也就是执行exec时，该文件句柄会不会被关闭
-            return (current->close_on_exec >> fd) & 1;
+            return (current->files->close_on_exec >> fd) & 1;
         case F_SETFD:       // 对【执行时关闭位图】中的该句柄要么置位，要么复位，由arg控制。
             if (arg & 1)
-                current->close_on_exec |= (1 << fd);
+                current->files->close_on_exec |= (1 << fd);
             else
-                current->close_on_exec &= ~(1 << fd);
+                current->files->close_on_exec &= ~(1 << fd);
             return 0;
         case F_GETFL:       // 取文件状态标志和访问模式。
             return filp->f_flags;
@@ -21,22 +21,23 @@
 int file_read(struct m_inode* inode, struct file* filp, char* buf, int count)
 {
     int left, chars, nr;
+    int size = inode->i_blocksize;    // 文件系统逻辑块的大小, 文件按它分块
     struct buffer_head* bh;
     
     if ((left = count) <= 0)
         return 0;
     while (left)        // left表示剩余还没有读取的字节数。
     {
-        if (nr = bmap(inode, (filep->f_pos) / BLOCK_SIZE))
+        if (nr = bmap(inode, (filep->f_pos) / size))
         {
-            if (!(bh = bread(inode->i_dev, nr)))
+            if (!(bh = bread_size(inode->i_dev, nr, size)))
                 break;
         }
-        else
-            bh = NULL;
+        else        // 还没有映射的块可能在延迟分配的缓冲块中
+            bh = delay_find(inode, filp->f_pos / size);
         
-        nr = filp->f_pos % BLOCK_SIZE;
-        chars = MIN(BLOCK_SIZE - nr, left);    // chars表示当前逻辑块内需要读取的字节数。
+        nr = filp->f_pos % size;
+        chars = MIN(size - nr, left);    // chars表示当前逻辑块内需要读取的字节数。
         filp->f_pos += chars;
         left -=chars;
         
@@ -68,7 +69,8 @@ int file_read(struct m_inode* inode, struct file* filp, char* buf, int count)
 int file_write(struct m_inode* inode, struct file* filp, char* buf, int count)
 {
     off_t pos;
-    int block, c;
+    int block, c, full, error = -1;
+    int size = inode->i_blocksize;
     struct buffer_head* bh;
     char* p;
     int i = 0;
@@ -81,14 +83,26 @@ int file_write(struct m_inode* inode, struct file* filp, char* buf, int count)
     
     while (i < count)
     {
-        if (!(block = create_block(inode, pos / BLOCK_SIZE)))    // 创建文件中对应的block块。
-            break;
-        if (!(bh = bread(inode->i_dev, block)))
+        // 已经映射的块直接读到高速缓冲中; 没有映射的块不马上分配，数据先写到延迟分配的缓冲块中,
+        // 写回之前再按顺序一起分配(见fs/inode.c中的delay_getblk())。
+        // 整块覆盖时不需要先从磁盘读出旧的内容, 写完之后设置b_uptodate。
+        full = !(pos % size) && count - i >= size;
+        if ((block = bmap(inode, pos / size)))
+        {
+            if (full)
+                bh = getblk_size(inode->i_dev, block, size);
+            else if (!(bh = bread_size(inode->i_dev, block, size)))
+                break;
+        }
+        else if (!(bh = delay_getblk(inode, pos / size)))
+        {
+            error = -ENOSPC;        // 空间不够预留, 不会写入之后在写回时才发现
             break;
+        }
         
-        c = pos % BLOCK_SIZE;
+        c = pos % size;
         p = c + bh->b_data;      // p 指向缓冲块内开始写入数据的位置
-        c = BLOCK - c;
+        c = size - c;
         if (c > count - i)       // c 表示当前缓冲块可以写入的字节数。
             c = count - i;
         pos += c;
@@ -101,8 +115,15 @@ int file_write(struct m_inode* inode, struct file* filp, char* buf, int count)
         while (c-- > 0)
             *(p++) = get_fs_byte(buf++);
         i += c;
-        bh->b_dirt = 1;
-        brelse(bh);
+        if (block)
+        {
+            if (full)
+                bh->b_uptodate = 1;
+            bh->b_dirt = 1;
+            brelse(bh);
+        }
+        else
+            delay_release(inode, bh);    // 同时解锁inode
     }
 
     inode->i_mtime = CURRENT_TIME;
@@ -112,5 +133,5 @@ int file_write(struct m_inode* inode, struct file* filp, char* buf, int count)
         filp->f_pos = pos;
         inode->i_ctime = CUURENT_TIME;
     }
-    return (i ? i : -1);
+    return (i ? i : error);
 }
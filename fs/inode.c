@@ -5,8 +5,19 @@
 #include <linux/mm.h>
 #include <asm/system.h>
 
+#define PREALLOC_BLOCKS 8       // 常规文件每次从位图中分配时预分配的块数
+
 struct m_inode inode_table[NR_INODE] = {{0,},};    // 32项
 
+// 内存中所有的inode通过i_next链接在inode_list上。开始时只有静态的inode_table, 不够用时
+// 再按页申请内存进行扩充, 最多NR_INODE_MAX项。扩充出来的内存不再释放。
+struct m_inode* inode_list = NULL;
+static int nr_inodes = 0;
+
+// 以(i_dev, i_num)为键的哈希表, 用于iget()快速查找已经在内存中的inode。
+#define ihashfn(dev, nr) ((((unsigned)(dev)) ^ ((unsigned)(nr) * 31)) & (NR_IHASH - 1))
+static struct m_inode* inode_hash[NR_IHASH];
+
 static void read_inode(struct m_inode* inode);
 static void write_inode(struct m_inode* inode);
 
@@ -35,6 +46,7 @@ static inline void lock_inode(struct m_inode* inode)
     while (inode->i_lock)
         sleep_on(&inode->i_wait);
     inode->i_lock = 1;
+    current->preempt_count++;
     sti();
 }
 
@@ -46,9 +58,105 @@ static inline void lock_inode(struct m_inode* inode)
 static inline void unlock_inode(struct m_inode* inode)
 {
     inode->i_lock = 0;
+    current->preempt_count--;
     wake_up(&inode->i_wait);
 }
 
+/**
+  @brief 在哈希表中查找设备号为dev、节点号为nr的inode.
+  @param [in] dev 设备号
+  @param [in] nr inode节点号
+  @return 找到时返回inode的指针，否则返回NULL.
+  */
+static struct m_inode* find_inode(int dev, int nr)
+{
+    struct m_inode* inode;
+
+    for (inode = inode_hash[ihashfn(dev, nr)]; inode; inode = inode->i_hash_next)
+        if (inode->i_dev == dev && inode->i_num == nr)
+            return inode;
+    return NULL;
+}
+
+/**
+  @brief 按照inode的i_dev和i_num把它插入到哈希表中，调用之前i_dev和i_num必须已经设置好。
+  @param [in] inode inode的指针
+  @return 返回值为空。
+  */
+void insert_inode_hash(struct m_inode* inode)
+{
+    struct m_inode** head = inode_hash + ihashfn(inode->i_dev, inode->i_num);
+
+    if (inode->i_hash_pprev)
+        return;
+    if ((inode->i_hash_next = *head))
+        (*head)->i_hash_pprev = &inode->i_hash_next;
+    *head = inode;
+    inode->i_hash_pprev = head;
+}
+
+/**
+  @brief 把inode从哈希表中移除，不在哈希表中的inode(如管道)什么也不做。
+  @param [in] inode inode的指针
+  @return 返回值为空。
+  */
+static void remove_inode_hash(struct m_inode* inode)
+{
+    if (!inode->i_hash_pprev)
+        return;
+    if ((*inode->i_hash_pprev = inode->i_hash_next))
+        inode->i_hash_next->i_hash_pprev = inode->i_hash_pprev;
+    inode->i_hash_next = NULL;
+    inode->i_hash_pprev = NULL;
+}
+
+/**
+  @brief 把inode从哈希表中移除并清零，只保留它在inode_list上的链接。
+  @param [in] inode inode的指针
+  @return 返回值为空。
+  */
+void clear_inode(struct m_inode* inode)
+{
+    struct m_inode* next = inode->i_next;
+
+    remove_inode_hash(inode);
+    memset(inode, 0, sizeof(*inode));
+    inode->i_next = next;
+}
+
+/**
+  @brief 扩充内存中的inode缓存。第一次调用时把静态的inode_table挂到inode_list上，以后每次
+  申请一页内存(get_free_page()返回的页已经清零)，把它当作inode数组挂上去。
+  @param void 参数为空
+  @return 扩充成功返回1，已经达到NR_INODE_MAX或者没有空闲内存时返回0.
+  */
+static int grow_inodes(void)
+{
+    struct m_inode* inode;
+    int n;
+
+    if (!nr_inodes)
+    {
+        inode = inode_table;
+        n = NR_INODE;
+    }
+    else
+    {
+        if (nr_inodes >= NR_INODE_MAX)
+            return 0;
+        if (!(inode = (struct m_inode*)get_free_page()))
+            return 0;
+        n = PAGE_SIZE / sizeof(struct m_inode);
+    }
+    for (; n; --n, ++inode)
+    {
+        inode->i_next = inode_list;
+        inode_list = inode;
+        nr_inodes++;
+    }
+    return 1;
+}
+
 /**
   @brief 该函数实现检测内存中的inode节点是否是已经移除设备上的inode节点，如果是，则把该节点置为无效，即把
   i_dev的值置为0.
@@ -57,19 +165,21 @@ static inline void unlock_inode(struct m_inode* inode)
   */
 void invalidate_inodes(int dev)
 {
-    int i;
     struct m_inode* inode;
     
-    inode = inode_table + 0;
-    for (i = 0; i < NR_INODE; ++i, ++inode)
+    for (inode = inode_list; inode; inode = inode->i_next)
     {
+        cond_resched();
         wait_on_inode(inode);
         if (inode->i_dev == dev)
         {
             if (inode->i_count)
                 printk("inode in use on removed disk\n\r");
+            remove_inode_hash(inode);
             inode->i_dev = 0;
             inode->i_dirt = 0;
+            inode->i_prealloc_count = 0;     // 设备已经不在了，预分配窗口作废
+            inode->i_run_len = 0;
         }
     }
 }
@@ -82,124 +192,205 @@ void invalidate_inodes(int dev)
   */
 void sync_inodes(void)
 {
-  int i;
   struct m_inode* inode;
-  inode = 0 + inode_table;
-  for (i = 0; i < NR_INODE; ++i, ++inode)
+  for (inode = inode_list; inode; inode = inode->i_next)
+  {
+    cond_resched();
+    wait_on_inode(inode);
+    // 有日志的文件系统在不能开始新操作时跳过, 提交时由sync_inodes_dev()写(见journal_defer())
+    if (inode->i_dirt && !inode->i_pipe && !journal_defer(inode->i_dev))
+      write_inode(inode);
+  }
+}
+
+/**
+  @brief 只写设备dev上修改过的inode, 日志提交时调用。
+  */
+void sync_inodes_dev(int dev)
+{
+  struct m_inode* inode;
+  for (inode = inode_list; inode; inode = inode->i_next)
   {
     wait_on_inode(inode);
-    if (inode->i_dirt && !inode->i_pipe)
+    if (inode->i_dirt && !inode->i_pipe && inode->i_dev == dev)
       write_inode(inode);
   }
 }
 
+/**
+  @brief 为inode分配一个新的逻辑块，优先分配紧跟在它上一次分配的逻辑块之后的块。
+  @param [in] inode inode的指针
+  @return 返回新的逻辑块号，失败时返回0.
+
+  常规文件从位图中分配一块时，顺便预分配紧跟在后面的PREALLOC_BLOCKS块, 以后的分配直接从预分配窗口中
+  取，文件顺序增长时数据块是连续的，也不需要每次都查找位图。 窗口中的块被别的文件占用了时窗口作废,
+  从位图中重新分配。
+  */
+static int inode_new_block(struct m_inode* inode)
+{
+    int block;
+
+    if (inode->i_prealloc_count)
+    {
+        block = inode->i_prealloc_block++;
+        inode->i_prealloc_count--;
+        if (claim_block(inode->i_dev, block, inode->i_blocksize))
+            goto got;
+        inode->i_prealloc_count = 0;
+    }
+    if (!(block = new_block(inode->i_dev, inode->i_goal)))
+        return 0;
+    if (S_ISREG(inode->i_mode))
+    {
+        inode->i_prealloc_count = prealloc_blocks(inode->i_dev, block, PREALLOC_BLOCKS);
+        inode->i_prealloc_block = block + 1;
+    }
+got:
+    inode->i_goal = block + 1;
+    return block;
+}
+
+/**
+  @brief 放弃inode的预分配窗口中没有用到的块，文件最后一次关闭和截断时调用。 窗口中的块在位图中
+  还是空闲的(见prealloc_blocks()), 不需要释放。
+  @param [in] inode inode的指针
+  @return 返回值为空。
+  */
+void discard_prealloc(struct m_inode* inode)
+{
+    inode->i_prealloc_count = 0;
+}
+
+/**
+  @brief 读取映射数组中的第n项: bh为NULL时是inode的i_zone[], 否则是间接块, v1的间接块中是16位的
+  逻辑块号, v2的是32位的。
+  */
+static unsigned long map_entry(struct m_inode* inode, struct buffer_head* bh, int n)
+{
+    if (!bh)
+        return inode->i_zone[n];
+    if (inode->i_version == 2)
+        return ((unsigned long*)(bh->b_data))[n];
+    return ((unsigned short*)(bh->b_data))[n];
+}
+
+/**
+  @brief 设置间接块中的第n项。
+  */
+static void set_map_entry(struct m_inode* inode, struct buffer_head* bh, int n, unsigned long zone)
+{
+    if (inode->i_version == 2)
+        ((unsigned long*)(bh->b_data))[n] = zone;
+    else
+        ((unsigned short*)(bh->b_data))[n] = zone;
+    journal_dirty(bh);
+}
+
+/**
+  @brief 记录一段连续的映射: 文件块block对应映射数组的第n项, 如果后面的项依次是下一个磁盘块，
+  它们都在这一段中。 以后bmap()查找这一段中的块时不需要再读间接块。
+  @param [in] inode inode的指针
+  @param [in] block 文件中的块号
+  @param [in] bh 映射数组所在的间接块, 为NULL时是i_zone[]
+  @param [in] n block对应的那一项
+  @param [in] end 映射数组的项数
+  @return 返回值为空。
+  */
+static void set_run(struct m_inode* inode, int block, struct buffer_head* bh, int n, int end)
+{
+    unsigned long first;
+    int len;
+
+    if (!(first = map_entry(inode, bh, n)))
+        return;
+    for (len = 1; n + len < end && map_entry(inode, bh, n + len) == first + len; len++)
+        ;
+    inode->i_run_lblock = block;
+    inode->i_run_pblock = first;
+    inode->i_run_len = len;
+}
+
 /**
   @brief 该函数的功能是把inode中block的相对索引值映射到磁盘真实的逻辑块号。
   @param [in] inode inode的指针
   @param [in] block 实际data的逻辑块在inode的索引值，从0开始，分别为0, 1, 2, 3, ...N, 
-  但是不能大于等于 7 + 512 + 512 * 512.
+  1KB的逻辑块时v1文件系统不能大于等于 7 + 512 + 512 * 512, v2文件系统不能大于等于 7 + 256 + 256^2 + 256^3.
   @parm [in] create 当要查找到block号在inode中不存在时，是否创建一个逻辑块。
   @return 返回磁盘上的逻辑块号。
+
+  i_zone[0]到i_zone[6]是直接块，i_zone[7]、i_zone[8]、i_zone[9](只有v2有)分别是一次、二次和三次间接块。
+  每个间接块中有ZONES_PER_BLOCK个逻辑块号: 1KB的逻辑块时v1是512个16位的, v2是256个32位的, 逻辑块更大时成倍增加。
   */
 static int _bmap(struct m_inode* inode, int block, int create)
 {
     struct buffer_head* bh;
-    int i;
+    int i, lblock, level, per, span, n;
     
     if (block < 0)
         panic("_bmap: block < 0");
-    if (block >= 7 = 512 + 512 * 512)
-        panic("_bmap: block > big");
+    
+    // 先看缓存的连续映射，命中时不需要读间接块。
+    if (block >= inode->i_run_lblock && block < inode->i_run_lblock + inode->i_run_len)
+        return inode->i_run_pblock + (block - inode->i_run_lblock);
+    lblock = block;
     
     // 当block的值小于7时，可以直接从i_zone中拿到数据对应的逻辑块号。
     if (block < 7)
     {
         if (create && !inode->i_zone[block])
         {
-            if (inode->i_zone[block] = new_block(inode->i_dev))
+            if (inode->i_zone[block] = inode_new_block(inode))
             {
                 inode->i_ctime = CURRENT_TIME;
                 inode->i_dirt = 1;
             }
         }
+        set_run(inode, lblock, NULL, block, 7);
         return inode->i_zone[block];
     }
     
-  // 当block >= 7 并且< 7 + 512 时， 需要通过一次间接来得到磁盘中的逻辑块号。
+    // 算出需要几次间接: 一次间接块映射per块, 二次间接块映射per * per块, 三次间接块映射per * per * per块。
     block -= 7;
-    if (block < 512)
+    per = ZONES_PER_BLOCK(inode);
+    for (level = 1, span = per; block >= span; level++, span *= per)
     {
-        if (create && !inode->zone[7])
-        {
-            if (inode->i_zone[7] = new_block(inode->i_dev))
-            {
-                inode->i_dirt = 1;
-                inode->i_ctime = CURRENT_TIME;
-            }
-            
-            if (!inode->zone[7])
-            return 0;
-        }
-  
-        if (!(bh = bread(inode->i_dev, inode->i_zone[7])))
-            return 0;
-        i = ((unsigned short*)(bh->data))[block];     // 这代码，牛逼！
-        if (create && !i)
-        {
-            if (i = new_block(inode->i_dev))
-            {
-                ((unsigned short*)(bh->b_data))[block] = i;
-                bh->b_dirt = 1;
-            }
-        }
-        brelse(bh);
-        return i;
+        if (level >= (inode->i_version == 2 ? 3 : 2))
+            panic("_bmap: block > big");
+        block -= span;
     }
     
-    // 这时，需要两次间接查找，才能找到相应的逻辑块号。
-    block -= 512;
-    if (create && !inode->i_zone[8])
+    if (create && !inode->i_zone[6 + level])
     {
-        if (inode->i_zone[8] = new_block(inode->i_dev))
+        if (inode->i_zone[6 + level] = inode_new_block(inode))
         {
             inode->i_dirt = 1;
             inode->i_ctime = CURRENT_TIME;
         }
-        
-        if (!inode->i_zone[8])
-            return 0;
     }
-    
-    if (!(bh = bread(inode->i_dev, inode->i_zone[8])))
+    if (!(i = inode->i_zone[6 + level]))
         return 0;
     
-    i = ((unsigned short*)(bh->data))[block>>9];
-    if (create && !i)
+    // 每读一层间接块，span缩小为下一层每一项所映射的块数，最后一层每一项映射一块。
+    while (level--)
     {
-        if (i = new_block(inode->i_dev))
+        span /= per;
+        n = block / span;
+        block %= span;
+        if (!(bh = bread_size(inode->i_dev, i, inode->i_blocksize)))
+            return 0;
+        i = map_entry(inode, bh, n);
+        if (create && !i)
         {
-            ((unsigned short*)(bh->b_data))[block >> 9] = i;
-            bh->b_dirt = 1;
+            if (i = inode_new_block(inode))
+                set_map_entry(inode, bh, n, i);
         }
-        
+        if (!level)
+            set_run(inode, lblock, bh, n, per);
         brelse(bh);
         if (!i)
             return 0;
     }
-    
-    if (!(bh = bread(inode->i_dev, i)))
-        return 0;
-    i = ((unsigned short*)(bh->data))[block & 511];      // 这代码，厉害！
-    if (create && !i)
-    {
-        if (i = new_block(inode->i_dev))
-        {
-            ((unsigned short*)(bh->data))[block & 511] = i;
-            bh->b_dirt = 1;
-        }
-        brelse(bh);
-        return i;
-    }
+    return i;
 }
 
 /**
@@ -224,6 +415,224 @@ int create_block(struct m_inode* inode, int block)
     return _bmap(inode, block, 1);
 }
 
+/**
+  @brief 延迟分配: file_write()写入还没有映射的文件块时不马上分配逻辑块，数据先写到一个不属于任何设备
+  的缓冲块(b_dev为0, 不在哈希表中, 各种sync不会写它)中, 挂在inode的i_delay链表上并在超级块中预留空间。
+  到写回时(flush_delayed())再按文件块号的顺序一次分配，同一个文件的块在磁盘上是连续的, 多个进程交替
+  追加写不同的文件时也不会交错。 延迟的缓冲块一直占用着高速缓冲, 太多时提前分配: 同一种大小的延迟
+  缓冲块不超过这种缓冲块总数的四分之一(见buffer_supply()), 并且不超过下面的上限。
+  */
+#define DELAY_MAX_INODE 32          // 一个文件最多延迟分配的块数
+#define DELAY_MAX 128               // 所有文件延迟分配的块数
+#define DELAY_BATCH 2               // flush_delayed()在一个日志操作中分配的块数, 每块最多修改三个间接块
+
+static int nr_delayed[3] = {0,};    // 1KB、2KB和4KB的延迟缓冲块数
+#define DELAY_IDX(size) ((size) >> 11)
+
+/**
+  @brief 大小为size的延迟缓冲块的总数上限。
+  */
+static int delay_limit(int size)
+{
+    int n = buffer_supply(size) / 4;
+
+    if (n > DELAY_MAX)
+        n = DELAY_MAX;
+    return (n < 2) ? 2 : n;
+}
+
+/**
+  @brief 为文件块lblock延迟分配时预留的块数: 数据块加上映射它的各层间接块(最坏情况下都要新分配)。
+  */
+static int delay_cost(struct m_inode* inode, int lblock)
+{
+    int level, per, span;
+
+    if (lblock < 7)
+        return 1;
+    lblock -= 7;
+    per = ZONES_PER_BLOCK(inode);
+    for (level = 1, span = per; lblock >= span && level < 3; level++, span *= per)
+        lblock -= span;
+    return 1 + level;
+}
+
+/**
+  @brief 取文件块lblock的缓冲块用于写入。 文件块已经映射时返回它的缓冲块，否则返回延迟分配的缓冲块,
+  没有时新建一个(内容清零)。
+  @param [in] inode 文件的inode指针
+  @param [in] lblock 文件块号
+  @return 返回时inode已经上锁(写入期间不能被flush_delayed()分配), 写完之后调用delay_release()。
+  出错或者没有空间时返回NULL, 这时inode没有上锁。 空间在这里就预留好(见delay_cost()), 写回时分配
+  不会失败, 没有空间的写操作马上返回-ENOSPC.
+  */
+struct buffer_head* delay_getblk(struct m_inode* inode, int lblock)
+{
+    struct buffer_head *bh, **p;
+    int block, limit, ilimit;
+    int idx = DELAY_IDX(inode->i_blocksize);
+
+    limit = delay_limit(inode->i_blocksize);
+    if ((ilimit = limit / 2) > DELAY_MAX_INODE)
+        ilimit = DELAY_MAX_INODE;
+repeat:
+    // 延迟的块太多时先分配, 要在上锁之前
+    if (inode->i_ndelay >= ilimit)
+        flush_delayed(inode);
+    else if (nr_delayed[idx] >= limit)
+        sync_delayed(0);
+    lock_inode(inode);
+    // 上锁之前可能已经被flush_delayed()分配了
+    if ((block = bmap(inode, lblock)))
+    {
+        if (!(bh = bread_size(inode->i_dev, block, inode->i_blocksize)))
+            unlock_inode(inode);
+        return bh;
+    }
+    for (p = &inode->i_delay; (bh = *p) && bh->b_blocknr < lblock; p = &bh->b_delay_next)
+        ;
+    if (bh && bh->b_blocknr == lblock)
+    {
+        bh->b_count++;
+        return bh;
+    }
+    // 上锁时可能睡眠过, 其它进程可能又新建了延迟的块
+    if (inode->i_ndelay >= ilimit || nr_delayed[idx] >= limit)
+    {
+        unlock_inode(inode);
+        goto repeat;
+    }
+    if (!reserve_block(inode->i_dev, delay_cost(inode, lblock)))
+    {
+        unlock_inode(inode);
+        return NULL;
+    }
+    // 先计数, getblk_size()睡眠时其它进程就不会超过上限; inode已经上锁, 链表不会变化
+    inode->i_ndelay++;
+    nr_delayed[idx]++;
+    bh = getblk_size(0, lblock, inode->i_blocksize);
+    memset(bh->b_data, 0, bh->b_size);
+    bh->b_uptodate = 1;
+    bh->b_delay_next = *p;
+    *p = bh;
+    bh->b_count++;                  // 一个计数属于i_delay链表, 另一个给调用者
+    return bh;
+}
+
+/**
+  @brief 写完delay_getblk()返回的缓冲块: 已经映射的块设置修改标志, 然后释放缓冲块并解锁inode。
+  */
+void delay_release(struct m_inode* inode, struct buffer_head* bh)
+{
+    if (bh->b_dev)
+        bh->b_dirt = 1;
+    brelse(bh);
+    unlock_inode(inode);
+}
+
+/**
+  @brief 读取还没有映射的文件块lblock时调用(file_read()中bmap()返回0): 正在分配时等它完成后重新映射,
+  否则在延迟分配的缓冲块中查找。
+  @return 返回有数据的缓冲块，用完之后brelse(); 文件块确实是空洞时返回NULL.
+  */
+struct buffer_head* delay_find(struct m_inode* inode, int lblock)
+{
+    struct buffer_head* bh;
+    int block;
+
+    wait_on_inode(inode);
+    if ((block = bmap(inode, lblock)))
+        return bread_size(inode->i_dev, block, inode->i_blocksize);
+    for (bh = inode->i_delay; bh && bh->b_blocknr <= lblock; bh = bh->b_delay_next)
+    {
+        if (bh->b_blocknr == lblock)
+        {
+            bh->b_count++;
+            return bh;
+        }
+    }
+    return NULL;
+}
+
+/**
+  @brief 为inode所有延迟分配的块分配逻辑块: 按文件块号从小到大分配(i_goal和预分配窗口使它们连续),
+  把数据复制到新块的缓冲块中并设置修改标志, 之后由正常的回写写到磁盘上。
+  @param [in] inode inode的指针
+  @return 返回值为空。
+  */
+void flush_delayed(struct m_inode* inode)
+{
+    struct buffer_head *dbh, *bh;
+    int block, n;
+
+    // 分配修改的是位图和间接块, 要在日志事务中, 每个块最多修改一个位图块和三个间接块。 每次在一个操作
+    // 中分配DELAY_BATCH块, 使它修改的块数不超过预留的块数(见fs/journal.c); journal_start()在上锁之前。
+repeat:
+    if (!inode->i_ndelay)
+        return;
+    journal_start(inode->i_dev, J_CREDITS);
+    lock_inode(inode);
+    for (n = 0; n < DELAY_BATCH && (dbh = inode->i_delay); n++)
+    {
+        // 在这个块的预留中分配(其它进程在我们睡眠时不能用掉它), 完成之后再归还预留。
+        current->flags |= PF_RESERVED;
+        block = create_block(inode, dbh->b_blocknr);
+        current->flags &= ~PF_RESERVED;
+        unreserve_blocks(inode->i_dev, delay_cost(inode, dbh->b_blocknr));
+        if (block && (bh = getblk_size(inode->i_dev, block, inode->i_blocksize)))
+        {
+            memcpy(bh->b_data, dbh->b_data, bh->b_size);
+            bh->b_uptodate = 1;
+            bh->b_dirt = 1;
+            brelse(bh);
+        }
+        else
+            printk("flush_delayed: cannot map block %d of inode %d\n\r", dbh->b_blocknr, inode->i_num);
+        inode->i_delay = dbh->b_delay_next;
+        dbh->b_delay_next = NULL;
+        inode->i_ndelay--;
+        nr_delayed[DELAY_IDX(inode->i_blocksize)]--;
+        brelse(dbh);
+    }
+    unlock_inode(inode);
+    journal_stop(inode->i_dev, J_CREDITS);
+    goto repeat;
+}
+
+/**
+  @brief 分配设备dev上所有延迟分配的块, dev为0时是所有设备的。 sys_sync()和延迟的块太多时调用。
+  */
+void sync_delayed(int dev)
+{
+    struct m_inode* inode;
+
+    for (inode = inode_list; inode; inode = inode->i_next)
+    {
+        if (inode->i_ndelay && (!dev || inode->i_dev == dev))
+            flush_delayed(inode);
+    }
+}
+
+/**
+  @brief 丢弃inode所有延迟分配的块并归还预留，文件被截断或者删除时调用。
+  */
+void drop_delayed(struct m_inode* inode)
+{
+    struct buffer_head* dbh;
+
+    lock_inode(inode);
+    while ((dbh = inode->i_delay))
+    {
+        inode->i_delay = dbh->b_delay_next;
+        dbh->b_delay_next = NULL;
+        inode->i_ndelay--;
+        nr_delayed[DELAY_IDX(inode->i_blocksize)]--;
+        unreserve_blocks(inode->i_dev, delay_cost(inode, dbh->b_blocknr));
+        brelse(dbh);
+    }
+    unlock_inode(inode);
+}
+
 /**
   @brief
   @param [in] inode 需要释放的i节点的指针。
@@ -279,10 +688,25 @@ repeat:
         return;
     }
     
+    // 最后一个使用者: 先分配延迟分配的块(文件已经删除时丢弃它们)，它可能会睡眠，所以要重新检查。
+    // 然后放弃预分配窗口。
+    if (inode->i_ndelay)
+    {
+        if (inode->i_nlinks)
+            flush_delayed(inode);
+        else
+            drop_delayed(inode);
+        goto repeat;
+    }
+    discard_prealloc(inode);
+    
     if (!inode->i_nlinks)        // 此时对应inode的i_count == 1, i_nlinks = 0时，
     {
+        // 释放数据块和inode是一个操作, 要在同一个日志事务中。
+        journal_start(inode->i_dev, J_TRUNC_CREDITS);
         truncate(inode);        // 这是啥？
         free_inode(inode);
+        journal_stop(inode->i_dev, J_TRUNC_CREDITS);
         reteurn;
     }
     if (inode->i_dirt)
@@ -296,39 +720,55 @@ repeat:
 }
 
 /**
-  @brief 该函数实现从inode_table中查找一个空inode,并把inode的内容清零，只保留i_count= 1,返回inode的指针。
+  @brief 该函数实现从inode缓存中查找一个空inode,并把inode的内容清零，只保留i_count= 1,返回inode的指针。
   @param void 参数为空
   @return 返回inode的指针。
   */
 struct m_inode* get_empty_inode(void)
 {
     struct m_inode* inode;
-    static strcut m_inode* last_inode = inode_table;     // 静态变量只会在第一次初始化时进行赋值操作。
+    struct m_inode* unused;
+    static struct m_inode* last_inode = NULL;
     int i;
     
+    if (!nr_inodes)
+        grow_inodes();
     do
     {
         inode = NULL;
-        // 该for循环优先从inode_table中找到一个i_count = 0, i_dirt = 0, i_lock= 0 的inode, 再差一点的话，就
-        // 找一个i_count = 0 的inode, 如果都没有满足条件的，那么对不起，接下来就死机了！
-        for (i = NR_INODE; i; i--)
+        unused = NULL;
+        // 该for循环优先找一个没有缓存任何磁盘inode(i_dev = 0)的空闲项，其次是i_count = 0, i_dirt = 0,
+        // i_lock = 0 的inode, 再差一点的话，就找一个i_count = 0 的inode.
+        for (i = nr_inodes; i; i--)
         {
-            if (++last_inode >= inode_table + NR_INODE)
-                last_inode = inode_table;
+            if (!last_inode || !(last_inode = last_inode->i_next))
+                last_inode = inode_list;
             
-            if (!last_inode->i_count)
+            if (last_inode->i_count)
+                continue;
+            if (!last_inode->i_dev && !last_inode->i_lock)
             {
-                inode = last_inode;
-                if (!inode->i_dirt && !inode->i_lock)
-                    break;
+                unused = last_inode;
+                break;
             }
+            if (!inode || (!last_inode->i_dirt && !last_inode->i_lock && (inode->i_dirt || inode->i_lock)))
+                inode = last_inode;
+        }
+        
+        // 没有完全空闲的项时，先扩充inode缓存，而不是把还缓存着磁盘inode的项挤出去。
+        if (!unused && grow_inodes())
+        {
+            inode = NULL;
+            continue;
         }
+        if (unused)
+            inode = unused;
         
-        // 如果从inode_table中没有找到满足条件的indoe,则打印相关信息，并死机！
+        // 如果没有找到满足条件的indoe,则打印相关信息，并死机！
         if (!inode)
         {
-            for (i = 0; i < NR_INODE; ++i)
-                printk("%04x: %6d\t", inode_table[i].i_dev, inode_table[i].i_num);
+            for (inode = inode_list; inode; inode = inode->i_next)
+                printk("%04x: %6d\t", inode->i_dev, inode->i_num);
             
             panic("not free inodes in memory");
         }
@@ -340,10 +780,10 @@ struct m_inode* get_empty_inode(void)
             wait_on_inode(inode);
         }
         
-    } while (inode->i_count);
+    } while (!inode || inode->i_count);
     
-    // 把inode内的内容全部清零，只保留了i_count = 1
-    memset(inode, 0, sizdof(*inode));
+    // 把inode从哈希表中摘下并清零，只保留了i_count = 1
+    clear_inode(inode);
     inode->i_count = 1;
     return inode;
 }
@@ -377,30 +817,22 @@ struct m_inode* get_pipe_inode(void)
   @param [in] dev 设备号
   @param [in] nr 逻辑块号
   @return 返回节点的指针。
+
+  先通过哈希表查找，只有在内存中没有时才去申请空的inode, 避免每次调用都挤掉一个缓存的inode.
   */
 struct m_inode* iget(int dev, int nr)
 {
-    struct m_inode* inode, empty;
+    struct m_inode* inode, *empty;
     
     if (!dev)
         panic(" iget with dev == 0");
     
-    empty = get_empty_inode();
-    inode = inode_table;
-    while (inode < inode_table + NR_INODE)
+repeat:
+    if ((inode = find_inode(dev, nr)))
     {
-        if (inode->i_dev != dev || inode->i_num != nr)
-        {
-            ++inode;
-            continue;
-        }
-        
         wait_on_inode(inode);
-        if (inode->i_dev != dev || inode->i_num != nr)   // 在等待inode解锁的过程中(当前进程会睡眠)，如果inode的信息不匹配了，则重新从头查找。
-        {
-            inode = inode_table;
-            continue;
-        }
+        if (inode->i_dev != dev || inode->i_num != nr)   // 在等待inode解锁的过程中(当前进程会睡眠)，如果inode的信息不匹配了，则重新查找。
+            goto repeat;
    
         inode->i_count++;
         if (inode->i_mount)           // 如果该inode被挂载
@@ -417,8 +849,6 @@ struct m_inode* iget(int dev, int nr)
             if (i >= NR_SUPER)
             {
                 printk("Mounted inode has't got super block.\n");
-                if (empty)
-                iput(empty);
                 return inode;
             }
           
@@ -430,26 +860,30 @@ struct m_inode* iget(int dev, int nr)
             iput(inode);
             dev = super_block[i].s_dev;
             nr = ROOT_INO;
-            inode = inode_table;
-            continue;
+            goto repeat;
         }
-        if (empty)
-            iput(empty);
         return inode;
     }
       
-    // 如果在inode_table中没有找到对应的inode,就创建一个！
-    if (!empty)
+    // 如果在内存中没有找到对应的inode,就创建一个！get_empty_inode()可能会睡眠，这期间别的进程
+    // 可能已经把同一个inode读进来了，所以要再查一次哈希表。
+    if (!(empty = get_empty_inode()))
         return NULL;
+    if (find_inode(dev, nr))
+    {
+        iput(empty);
+        goto repeat;
+    }
     inode = empty;
     inode->i_dev = dev;
     inode->i_num = nr;
+    insert_inode_hash(inode);
     read_inode(inode);
     return inode;
 }
 
 /**
-  @brief 该函数实现一个读取一个inode节点内容.
+  @brief 该函数实现一个读取一个inode节点内容. 根据超级块中的版本把d_inode或者d2_inode转换成内存中的inode.
   @param [in] 要读取的inode的指针。
   @return 返回值为空。
   */
@@ -457,23 +891,53 @@ static void read_inode(struct m_inode* inode)
 {
     struct super_block* sb;
     struct buffer_head* bh;
-    int lock;
+    struct d_inode* d;
+    struct d2_inode* d2;
+    int block, i;
     
     lock_inode(inode);
-    if (!sb = get_super(inode->i_dev))
+    if (!(sb = get_super(inode->i_dev)))
         panic("trying to read inode without dev");
-    block = 2 + sb->s_imap_blocks + sb_s_zmap_blocks + (inode->i_num - 1) / INODES_PER_BLOCK;
+    block = 2 + sb->s_imap_blocks + sb->s_zmap_blocks + (inode->i_num - 1) / sb->s_inodes_per_block;
     if (!(bh = bread(inode->i_dev, block)))
         panic("unable to read inode block");
-    *(struct d_inode*)inode = 
-        ((struct d_inode*)bh->b_data)
-            [(inode->i_num - 1) % INODES_PER_BLOCK];
+    inode->i_version = sb->s_version;
+    inode->i_namelen = sb->s_namelen;
+    inode->i_blocksize = sb->s_blocksize;
+    if (sb->s_version == 2)
+    {
+        d2 = (struct d2_inode*)bh->b_data + (inode->i_num - 1) % sb->s_inodes_per_block;
+        inode->i_mode = d2->i_mode;
+        inode->i_nlinks = d2->i_nlinks;
+        inode->i_uid = d2->i_uid;
+        inode->i_gid = d2->i_gid;
+        inode->i_size = d2->i_size;
+        inode->i_atime = d2->i_atime;
+        inode->i_time = d2->i_mtime;
+        inode->i_ctime = d2->i_ctime;
+        for (i = 0; i < 10; i++)
+            inode->i_zone[i] = d2->i_zone[i];
+    }
+    else
+    {
+        // v1只有一个时间
+        d = (struct d_inode*)bh->b_data + (inode->i_num - 1) % sb->s_inodes_per_block;
+        inode->i_mode = d->i_mode;
+        inode->i_uid = d->i_uid;
+        inode->i_size = d->i_size;
+        inode->i_time = inode->i_atime = inode->i_ctime = d->i_time;
+        inode->i_gid = d->i_gid;
+        inode->i_nlinks = d->i_nlinks;
+        for (i = 0; i < 9; i++)
+            inode->i_zone[i] = d->i_zone[i];
+        inode->i_zone[9] = 0;
+    }
     brelse(bh);
     unlock_inode(inode);
 }
 
 /**
-  @brief 将指定的inode信息写入到设备中。
+  @brief 将指定的inode信息写入到设备中, 按照inode所在文件系统的版本转换成d_inode或者d2_inode.
   @param [in] inode 要写的inode的指针
   @return 返回值为空
   */
@@ -481,25 +945,53 @@ static void write_inode(struct m_inode* inode)
 {
     struct super_block* sb;
     struct buffer_head* bh;
-    int block;
+    struct d_inode* d;
+    struct d2_inode* d2;
+    int block, i;
     
+    journal_start(inode->i_dev, 1);     // 只修改inode所在的块; 在上锁之前, 等待提交时不能持有inode锁
     lock_inode(inode);
     if (!inode->i_dirt || !inode->i_dev)
     {
         unlock_inode(inode);
+        journal_stop(inode->i_dev, 1);
         return;
     }
     
     if (!(sb = get_super(inode->i_dev)))
         panic("trying to write inode without device");
-    block = 2 + sb->s_imap_blocks + sb->s_zmap_blocks + (inode->i_num - 1) / INODES_PER_BLOCK;    // 如果i_num中是1开始计数的时，需要减1，但是它是从1开始的吗？
+    block = 2 + sb->s_imap_blocks + sb->s_zmap_blocks + (inode->i_num - 1) / sb->s_inodes_per_block;    // 如果i_num中是1开始计数的时，需要减1，但是它是从1开始的吗？
     if (!(bh = bread(inode->i_dev, block)))
         panic("unable to read inode block");
-    ((struct d_inode*)bh->b_data)                        // d_inode是什么东西？
-        [(inode->i_num - 1) % INODES_PER_BLOCK] = 
-            *(struct d_inode*)inode;
-    bh->b_dirt = 1;
-    inode->i_drit = 0;
+    if (sb->s_version == 2)
+    {
+        d2 = (struct d2_inode*)bh->b_data + (inode->i_num - 1) % sb->s_inodes_per_block;
+        d2->i_mode = inode->i_mode;
+        d2->i_nlinks = inode->i_nlinks;
+        d2->i_uid = inode->i_uid;
+        d2->i_gid = inode->i_gid;
+        d2->i_size = inode->i_size;
+        d2->i_atime = inode->i_atime;
+        d2->i_mtime = inode->i_time;
+        d2->i_ctime = inode->i_ctime;
+        for (i = 0; i < 10; i++)
+            d2->i_zone[i] = inode->i_zone[i];
+    }
+    else
+    {
+        d = (struct d_inode*)bh->b_data + (inode->i_num - 1) % sb->s_inodes_per_block;
+        d->i_mode = inode->i_mode;
+        d->i_uid = inode->i_uid;
+        d->i_size = inode->i_size;
+        d->i_time = inode->i_time;
+        d->i_gid = inode->i_gid;
+        d->i_nlinks = inode->i_nlinks;
+        for (i = 0; i < 9; i++)
+            d->i_zone[i] = inode->i_zone[i];
+    }
+    journal_dirty(bh);
+    inode->i_dirt = 0;
     brelse(bh);
     unlock_inode(inode);
+    journal_stop(inode->i_dev, 1);
 }
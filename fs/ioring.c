@@ -0,0 +1,70 @@
+/**
+  @file
+  @brief io_submit()系统调用: 在一次系统调用中批量执行用户提交环中的文件读写请求。
+  */
+
+#define _LIBRARY_
+#include <unistd.h>
+#include <errno.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/ioring.h>
+#include <asm/segment.h>
+
+extern fn_ptr sys_call_table[];
+
+/**
+  @brief 执行提交环中从head到tail的所有请求。
+  @param [in] ring 用户空间中的提交环
+  @return 返回执行的请求个数, 环的参数不合法时返回-EINVAL.
+
+  请求通过sys_call_table中的函数执行，与直接调用对应的系统调用的效果完全相同。 每执行完一个请求就
+  写回结果并推进head, 所以中途停止时(出错或者有信号需要处理)用户程序可以从head处继续提交。
+  */
+int sys_io_submit(struct io_ring* ring)
+{
+    unsigned long head, tail, mask, flags;
+    struct io_sqe* sqe;
+    long op, res;
+    int done = 0;
+
+    head = get_fs_long(&ring->head);
+    tail = get_fs_long(&ring->tail);
+    mask = get_fs_long(&ring->mask);
+    flags = get_fs_long(&ring->flags);
+    if ((mask & (mask + 1)) || tail - head > mask + 1)
+        return -EINVAL;
+    verify_area(&ring->head, sizeof(long));
+
+    while (head != tail)
+    {
+        sqe = (struct io_sqe*)get_fs_long((unsigned long*)&ring->sqes) + (head & mask);
+        op = get_fs_long((unsigned long*)&sqe->opcode);
+        switch (op)
+        {
+            case __NR_read:
+            case __NR_write:
+            case __NR_lseek:
+            case __NR_open:
+            case __NR_close:
+                res = sys_call_table[op](get_fs_long((unsigned long*)&sqe->arg[0]),
+                                         get_fs_long((unsigned long*)&sqe->arg[1]),
+                                         get_fs_long((unsigned long*)&sqe->arg[2]));
+                break;
+            default:
+                res = -EINVAL;
+        }
+        verify_area(&sqe->res, sizeof(long));
+        put_fs_long(res, (unsigned long*)&sqe->res);
+        put_fs_long(++head, &ring->head);
+        done++;
+
+        if (res < 0 && (flags & IORING_STOP_ON_ERR))
+            break;
+        // 有信号要处理时先返回用户态, 剩下的请求由用户程序再次提交
+        if (current->signal & ~current->blocked)
+            break;
+        cond_resched();
+    }
+    return done;
+}
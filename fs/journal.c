@@ -0,0 +1,696 @@
+/**
+  @file
+  @brief MINIX文件系统的元数据日志(write-ahead log)。
+
+  位图块、inode块、目录块和间接块修改之后不直接标记为脏，而是调用journal_dirty()加入到正在运行的事务中。
+  事务中的缓冲块被日志引用着(b_count加1)并设置了b_journal, 回写时跳过它们。 提交时依次写入描述块、
+  各个块的副本和提交块，提交块写完之后事务才算完成，这时才把缓冲块标记为脏，由正常的回写写到原位置。
+  断电之后挂载时只需要把日志区中完整的事务重新写一遍(见journal_load())，不需要检查整个文件系统。
+
+  修改元数据的操作都在journal_start(dev)和journal_stop(dev)之间进行, 提交时先阻止该文件系统上新的操作
+  开始，等正在进行的操作结束，所以一个操作修改的块总在同一个事务中，提交过程中事务的内容也不会再变化。
+  每个文件系统的日志有自己的操作计数和提交者, 一个文件系统的提交不需要等待其它文件系统上的操作,
+  没有日志的文件系统上的操作不计数。
+  操作开始时要预留它最多修改的块数(credits, 见fs.h中的J_CREDITS), 运行事务放不下时先提交，所以事务
+  不会溢出, 修改过的元数据块总是经过日志写回。
+  提交由回写路径驱动: sys_sync()(update进程定期调用)提交所有的事务, sys_fsync()提交文件所在的文件系统的
+  事务。 多个进程在一个事务中的修改一起写入，等待同一次提交的fsync()都在它完成后返回(group commit)。
+
+  日志区的第0块是日志头，记录恢复时从哪一块开始、期望的事务序号。 事务从第1块开始顺序写入，剩下的空间
+  放不下一个最大的事务时，把所有已经提交的块写回原位置(checkpoint)，然后从第1块重新开始。 事务中有
+  逻辑块被释放时也在提交后立即checkpoint, 避免恢复时日志中的旧副本覆盖已经另作它用的块。
+  */
+
+#include <string.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/system.h>
+
+#define J_MAX_BLOCKS 100            // 一个事务最多包含的块数, 描述块要放得下它们的标签
+#define J_SPARE J_CREDITS           // 留给嵌套的操作的块数, 它们不能等待提交
+#define J_MIN_BLOCKS (J_TRUNC_CREDITS + J_SPARE)    // 缓冲块很少时事务的块数也不能少于它
+#define J_BIG_CREDITS 6             // 一个操作最多修改的大缓冲块(目录块和间接块)的个数
+#define J_LOG_BATCH 8               // 提交时每次同时写入日志区的副本数
+#define J_HEAD_MAGIC 0x4a484452
+#define J_DESC_MAGIC 0x4a445343
+#define J_COMMIT_MAGIC 0x4a434d54
+
+// 日志区第0块: 日志头
+struct d_journal_head
+{
+    unsigned long h_magic;
+    unsigned long h_first;          // 恢复时从日志区的第几块开始
+    unsigned long h_seq;            // 这一块上应该是哪个序号的事务
+};
+
+struct d_journal_tag
+{
+    unsigned long t_block;          // 原位置的块号, 以t_size为单位
+    unsigned long t_size;           // 块的大小
+};
+
+// 描述块, 后面跟着d_nr个块的副本和一个提交块
+struct d_journal_desc
+{
+    unsigned long d_magic;
+    unsigned long d_seq;
+    unsigned long d_nr;
+    struct d_journal_tag d_tag[J_MAX_BLOCKS];
+};
+
+struct d_journal_commit
+{
+    unsigned long c_magic;
+    unsigned long c_seq;
+};
+
+struct journal
+{
+    unsigned short j_dev;           // 为0时该项没有使用
+    unsigned short j_bsize;         // 日志区逻辑块的大小
+    unsigned long j_start;          // 日志区第一块的逻辑块号
+    unsigned long j_len;            // 日志区的块数
+    unsigned long j_next;           // 下一个事务从日志区的第几块开始写
+    unsigned long j_seq;            // 正在运行的事务的序号
+    unsigned char j_freed;          // 正在运行的事务中释放过逻辑块
+    int j_nr;                       // 正在运行的事务中的块数
+    int j_max;                      // 事务最多包含的块数
+    int j_nbig;                     // 事务中大小不是BLOCK_SIZE的块数
+    int j_big_max;                  // 事务最多包含的这种块数, 按buffer_supply(j_bsize)计算
+    int j_reserved;                 // 正在进行的操作预留的块数
+    int j_rbig;                     // 正在进行的操作预留的大缓冲块数
+    int j_ops;                      // 该文件系统上正在进行的操作数
+    struct task_struct* j_committer;    // 正在提交的进程, 它等操作结束时新的操作不能开始
+    unsigned char j_busy;           // 正在写日志
+    struct buffer_head* j_bh[J_MAX_BLOCKS];
+};
+
+static struct journal journal[NR_SUPER];
+static struct task_struct* j_wait = NULL;       // 等待提交结束或者操作结束的进程
+
+static inline void wait_on_buffer(struct buffer_head* bh)
+{
+    cli();
+    while (bh->b_lock)
+        sleep_on(&bh->b_wait);
+    sti();
+}
+
+static struct journal* find_journal(int dev)
+{
+    struct journal* j;
+
+    if (!dev)
+        return NULL;
+    for (j = journal; j < journal + NR_SUPER; j++)
+    {
+        if (j->j_dev == dev)
+            return j;
+    }
+    return NULL;
+}
+
+/**
+  @brief 把缓冲块同步写到磁盘上。
+  @return 成功返回1, 出错返回0.
+  */
+static int write_sync(struct buffer_head* bh)
+{
+    bh->b_uptodate = 1;
+    bh->b_dirt = 1;
+    ll_rw_block(WRITE, bh);
+    wait_on_buffer(bh);
+    return bh->b_uptodate;
+}
+
+/**
+  @brief 写日志头: 恢复时从日志区的第first块开始, 期望的事务序号是seq.
+  */
+static void write_head(struct journal* j, unsigned long first, unsigned long seq)
+{
+    struct buffer_head* bh;
+    struct d_journal_head* h;
+
+    if (!(bh = getblk_size(j->j_dev, j->j_start, j->j_bsize)))
+        panic("journal: cannot get head block");
+    memset(bh->b_data, 0, j->j_bsize);
+    h = (struct d_journal_head*)bh->b_data;
+    h->h_magic = J_HEAD_MAGIC;
+    h->h_first = first;
+    h->h_seq = seq;
+    if (!write_sync(bh))
+        printk("journal: cannot write head of dev %04x\n\r", j->j_dev);
+    brelse(bh);
+}
+
+/**
+  @brief 把设备上所有的脏块写回原位置并等待完成，然后清空日志。 调用时运行事务必须为空，
+  日志区中的事务都已经写回，不再需要恢复。
+  */
+static void checkpoint(struct journal* j)
+{
+    struct buffer_head* bh;
+    int i;
+
+    bh = start_buffer;
+    for (i = 0; i < NR_BUFFERS; i++, bh++)
+    {
+        if (bh->b_dev == j->j_dev && bh->b_dirt && !bh->b_journal)
+            ll_rw_block(WRITE, bh);
+    }
+    bh = start_buffer;
+    for (i = 0; i < NR_BUFFERS; i++, bh++)
+    {
+        if (bh->b_dev == j->j_dev)
+            wait_on_buffer(bh);
+    }
+    write_head(j, 1, j->j_seq);
+    j->j_next = 1;
+}
+
+/**
+  @brief 把运行事务中的块写到日志区, 然后开始一个新的事务。 调用者设置了j_busy.
+  @param [in] force 为1时之后总是checkpoint(卸载时)
+  */
+static void write_log(struct journal* j, int force)
+{
+    struct buffer_head *bh, *dbh;
+    struct buffer_head* log[J_LOG_BATCH];
+    struct d_journal_desc* desc;
+    struct d_journal_commit* c;
+    int i, k, nlog, n, ok = 1;
+
+    if ((n = j->j_nr))
+    {
+        if (!(dbh = getblk_size(j->j_dev, j->j_start + j->j_next, j->j_bsize)))
+            panic("journal: cannot get descriptor block");
+        memset(dbh->b_data, 0, j->j_bsize);
+        desc = (struct d_journal_desc*)dbh->b_data;
+        desc->d_magic = J_DESC_MAGIC;
+        desc->d_seq = j->j_seq;
+        desc->d_nr = n;
+        for (i = 0; i < n; i++)
+        {
+            desc->d_tag[i].t_block = j->j_bh[i]->b_blocknr;
+            desc->d_tag[i].t_size = j->j_bh[i]->b_size;
+        }
+        dbh->b_uptodate = 1;
+        dbh->b_dirt = 1;
+        ll_rw_block(WRITE, dbh);
+
+        // 块的副本每J_LOG_BATCH个一起发出写请求, 写完一批释放一批, 不会同时占用太多缓冲块。
+        // 全部完成之后才能写提交块。
+        for (i = 0; i < n; i += nlog)
+        {
+            nlog = (n - i < J_LOG_BATCH) ? n - i : J_LOG_BATCH;
+            for (k = 0; k < nlog; k++)
+            {
+                if (!(bh = getblk_size(j->j_dev, j->j_start + j->j_next + 1 + i + k, j->j_bsize)))
+                    panic("journal: cannot get log block");
+                memcpy(bh->b_data, j->j_bh[i + k]->b_data, j->j_bh[i + k]->b_size);
+                bh->b_uptodate = 1;
+                bh->b_dirt = 1;
+                ll_rw_block(WRITE, bh);
+                log[k] = bh;
+            }
+            for (k = 0; k < nlog; k++)
+            {
+                wait_on_buffer(log[k]);
+                ok = ok && log[k]->b_uptodate;
+                brelse(log[k]);
+            }
+        }
+        wait_on_buffer(dbh);
+        ok = ok && dbh->b_uptodate;
+        brelse(dbh);
+
+        if (ok)
+        {
+            if (!(bh = getblk_size(j->j_dev, j->j_start + j->j_next + n + 1, j->j_bsize)))
+                panic("journal: cannot get commit block");
+            memset(bh->b_data, 0, j->j_bsize);
+            c = (struct d_journal_commit*)bh->b_data;
+            c->c_magic = J_COMMIT_MAGIC;
+            c->c_seq = j->j_seq;
+            ok = write_sync(bh);
+            brelse(bh);
+        }
+        if (!ok)
+            printk("journal: write error on dev %04x, transaction %d is not logged\n\r", j->j_dev, j->j_seq);
+
+        // 事务已经在日志中了, 块可以写回原位置。
+        for (i = 0; i < n; i++)
+        {
+            bh = j->j_bh[i];
+            bh->b_journal = 0;
+            bh->b_dirt = 1;
+            brelse(bh);
+        }
+        j->j_nr = 0;
+        j->j_nbig = 0;
+        j->j_next += n + 2;
+        j->j_seq++;
+    }
+    // 日志写失败时也要checkpoint, 否则日志中缺少这个事务，恢复时可能用更旧的副本覆盖它的块。
+    if (force || !ok || j->j_freed || j->j_len - j->j_next < J_MAX_BLOCKS + 2)
+    {
+        checkpoint(j);
+        j->j_freed = 0;
+    }
+}
+
+/**
+  @brief 提交正在运行的事务。 调用者已经设置了j_committer, 新的操作不会开始。
+  @param [in] force 为1时提交之后总是checkpoint(卸载时)
+
+  提交过程中设置PF_JCOMMIT: 这时getblk()等路径中的sync_inodes()不写有日志的文件系统的inode(见
+  journal_defer()), 否则可能要等另一个文件系统的提交，而那个提交又在等这个文件系统上的操作。
+  */
+static void do_commit(struct journal* j, int force)
+{
+    // 等正在进行的操作结束, 再把内存中修改过的inode写到缓冲块中, 它们也加入到这个事务里(放不下时
+    // journal_dirty()先把已有的块写到日志中)。
+    while (j->j_ops)
+        sleep_on(&j_wait);
+    j->j_busy = 1;
+    current->flags |= PF_JCOMMIT;
+    sync_inodes_dev(j->j_dev);
+    write_log(j, force);
+    current->flags &= ~PF_JCOMMIT;
+    j->j_busy = 0;
+}
+
+/**
+  @brief 由提交者调用do_commit(), 结束后唤醒等待的进程。
+  */
+static void commit_journal(struct journal* j, int force)
+{
+    j->j_committer = current;
+    do_commit(j, force);
+    j->j_committer = NULL;
+    wake_up(&j_wait);
+}
+
+/**
+  @brief 运行事务中还能不能为一个新的操作预留credits块, 要给嵌套的操作留下J_SPARE块.
+  */
+static int has_room(struct journal* j, int credits)
+{
+    return j->j_nr + j->j_reserved + credits <= j->j_max - J_SPARE &&
+        j->j_nbig + j->j_rbig + 2 * J_BIG_CREDITS <= j->j_big_max;
+}
+
+/**
+  @brief 开始一个修改设备dev上的元数据的操作, 它最多修改credits块(见fs.h中的J_CREDITS). 正在提交时
+  等待它结束; 运行事务放不下时先提交。 可以嵌套, 只有最外层的调用计数。 设备没有日志时什么也不做。
+
+  嵌套的操作不能等待提交(提交在等我们结束), 只预留块数, 用的是外层给它们留下的J_SPARE块。 在另一个
+  文件系统上嵌套时(例如iput()了挂载点另一边的inode), 只等已经开始写的日志写完, 然后加入它的操作计数。
+  */
+void journal_start(int dev, int credits)
+{
+    struct journal* j;
+
+    if (current->journal_depth)
+    {
+        current->journal_depth++;
+        if (!(j = find_journal(dev)))
+            return;
+        if (dev != current->journal_dev)
+        {
+            while (j->j_busy)
+                sleep_on(&j_wait);
+            j->j_ops++;
+        }
+        j->j_reserved += credits;
+        j->j_rbig += J_BIG_CREDITS;
+        return;
+    }
+    // 等待和提交的过程中会睡眠, 日志可能被释放, 每次都重新查找
+    while ((j = find_journal(dev)))
+    {
+        if (j->j_committer == current)      // 提交过程中写inode
+            break;
+        if (j->j_committer)
+        {
+            sleep_on(&j_wait);
+            continue;
+        }
+        if (has_room(j, credits))
+            break;
+        commit_journal(j, 0);
+    }
+    if (j)
+    {
+        j->j_ops++;
+        j->j_reserved += credits;
+        j->j_rbig += J_BIG_CREDITS;
+    }
+    current->journal_depth = 1;
+    current->journal_dev = dev;
+}
+
+/**
+  @brief 结束一个修改设备dev上的元数据的操作, credits是开始时预留的块数。
+  */
+void journal_stop(int dev, int credits)
+{
+    struct journal* j;
+
+    if (!current->journal_depth)
+        return;
+    --current->journal_depth;
+    if (!(j = find_journal(dev)))
+        return;
+    j->j_reserved -= credits;
+    j->j_rbig -= J_BIG_CREDITS;
+    if (j->j_reserved < 0 || j->j_rbig < 0)
+        j->j_reserved = j->j_rbig = 0;      // 日志在操作中间被重新加载过
+    if (current->journal_depth && dev == current->journal_dev)
+        return;
+    if (j->j_ops > 0 && !--j->j_ops)
+        wake_up(&j_wait);
+}
+
+/**
+  @brief 现在能不能写设备dev上的inode: 有日志的文件系统, 当前进程正在进行一个操作、正在提交或者持有
+  inode锁/超级块锁时不能开始新的操作, 由sync_inodes()跳过这些inode, 留到提交时再写。
+  @return 需要跳过时返回1.
+  */
+int journal_defer(int dev)
+{
+    if (!current->journal_depth && !(current->flags & PF_JCOMMIT) && !current->preempt_count)
+        return 0;
+    return find_journal(dev) != NULL;
+}
+
+/**
+  @brief 缓冲块的内容被修改过, 代替直接设置b_dirt. 没有日志的文件系统直接标记为脏。
+  */
+void journal_dirty(struct buffer_head* bh)
+{
+    struct journal* j;
+
+    if (!(j = find_journal(bh->b_dev)))
+    {
+        bh->b_dirt = 1;
+        return;
+    }
+    if (bh->b_journal)
+        return;
+    // 预留保证了操作不会使事务溢出。 提交者写inode时(没有其它操作)和嵌套的操作超出了J_SPARE时才会满,
+    // 这时先把事务中已有的块写到日志中, 不能不经过日志直接写回。
+    while (j->j_nr >= j->j_max || (bh->b_size != BLOCK_SIZE && j->j_nbig >= j->j_big_max))
+    {
+        if (j->j_busy && j->j_committer != current)
+        {
+            sleep_on(&j_wait);
+            continue;
+        }
+        if (j->j_committer != current)
+            printk("journal: transaction full on dev %04x, logging unfinished operations\n\r", bh->b_dev);
+        j->j_busy = 1;
+        write_log(j, 0);
+        if (j->j_committer != current)
+        {
+            j->j_busy = 0;
+            wake_up(&j_wait);
+        }
+    }
+    bh->b_journal = 1;
+    bh->b_count++;
+    j->j_bh[j->j_nr++] = bh;
+    if (bh->b_size != BLOCK_SIZE)
+        j->j_nbig++;
+}
+
+/**
+  @brief 运行事务中的缓冲块所在的逻辑块被释放了, 由free_block()调用: 把它从事务中去掉并放掉日志的
+  引用。 提交时不能再把它的旧内容写到日志和原位置, 逻辑块也可能在提交之前就被重新分配。
+  */
+void journal_forget(struct buffer_head* bh)
+{
+    struct journal* j;
+    int i;
+
+    if (!bh->b_journal || !(j = find_journal(bh->b_dev)))
+        return;
+    for (i = 0; i < j->j_nr; i++)
+    {
+        if (j->j_bh[i] == bh)
+        {
+            j->j_bh[i] = j->j_bh[--j->j_nr];
+            if (bh->b_size != BLOCK_SIZE)
+                j->j_nbig--;
+            bh->b_journal = 0;
+            brelse(bh);
+            return;
+        }
+    }
+}
+
+/**
+  @brief 设备上释放了逻辑块, 由free_block()调用。
+  */
+void journal_freed(int dev)
+{
+    struct journal* j;
+
+    if ((j = find_journal(dev)))
+        j->j_freed = 1;
+}
+
+/**
+  @brief 提交设备dev的运行事务并等待它写到日志中。 已经有进程在提交时等它结束，如果调用时的事务
+  已经被它提交了就直接返回。 不能在一个操作中间调用。
+  @return 设备没有日志时返回0, 否则返回1.
+  */
+int journal_commit(int dev)
+{
+    struct journal* j;
+    unsigned long seq;
+
+    if (!(j = find_journal(dev)))
+        return 0;
+    if (current->journal_depth)
+        return 1;
+    seq = j->j_seq;
+    while (j->j_committer)
+        sleep_on(&j_wait);
+    if (j->j_dev != dev || j->j_seq != seq || !j->j_nr)
+        return 1;
+    commit_journal(j, 0);
+    return 1;
+}
+
+/**
+  @brief 提交所有文件系统的运行事务, 由sys_sync()调用。
+  */
+void journal_commit_all(void)
+{
+    int i;
+
+    for (i = 0; i < NR_SUPER; i++)
+    {
+        if (journal[i].j_dev)
+            journal_commit(journal[i].j_dev);
+    }
+}
+
+/**
+  @brief 检查描述块中的标签: 块的大小只能是BLOCK_SIZE(位图块和inode块)或者文件系统的逻辑块大小,
+  块号必须在文件系统中, 并且不能是引导块和超级块。 有损坏的标签时整个事务都不能重做。
+  @return 都有效时返回1, 否则返回0.
+  */
+static int check_tags(struct super_block* sb, struct d_journal_desc* desc)
+{
+    struct d_journal_tag* t;
+    unsigned long i;
+
+    for (i = 0, t = desc->d_tag; i < desc->d_nr; i++, t++)
+    {
+        if (t->t_size == sb->s_blocksize)
+        {
+            if (t->t_block >= sb->s_firstdatazone && t->t_block < sb->s_zones)
+                continue;
+        }
+        else if (t->t_size == BLOCK_SIZE)
+        {
+            if (t->t_block >= 2 && t->t_block < (sb->s_zones << sb->s_log_zone_size))
+                continue;
+        }
+        printk("journal: bad tag (%d, %d) on dev %04x, replay stopped\n\r", t->t_block, t->t_size, sb->s_dev);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+  @brief 挂载时读取日志: 重做日志区中完整的事务, 然后开始记录。
+  @param [in] sb 正在读入的超级块, s_blocksize等已经设置
+  @param [in] info 超级块所在块中记录的日志区位置
+
+  从日志头记录的位置开始，描述块和提交块的序号都与期望的一致才是完整的事务，第一个不完整的事务
+  (断电时正在写的)和它后面的都丢弃。
+  */
+void journal_load(struct super_block* sb, struct d_journal_info* info)
+{
+    struct journal* j;
+    struct buffer_head *bh, *src, *dst;
+    struct d_journal_head* h;
+    struct d_journal_desc* desc;
+    struct d_journal_commit* c;
+    unsigned long blk, seq, n;
+    int i, replayed = 0;
+
+    if (info->j_magic != JOURNAL_MAGIC)
+        return;
+    if (info->j_start < sb->s_firstdatazone || info->j_start + info->j_len > sb->s_zones
+        || info->j_len < J_MAX_BLOCKS + 3)
+    {
+        printk("journal: bad journal area on dev %04x\n\r", sb->s_dev);
+        return;
+    }
+    for (j = journal; j < journal + NR_SUPER; j++)
+    {
+        if (!j->j_dev)
+            break;
+    }
+    if (j >= journal + NR_SUPER)
+        return;
+    j->j_bsize = sb->s_blocksize;
+    j->j_start = info->j_start;
+    j->j_len = info->j_len;
+    j->j_nr = 0;
+    j->j_nbig = 0;
+    j->j_reserved = 0;
+    j->j_rbig = 0;
+    j->j_freed = 0;
+    j->j_ops = 0;
+    j->j_committer = NULL;
+    j->j_busy = 0;
+    // 事务中的块提交之前一直占用着缓冲块, 提交时还要再用J_LOG_BATCH + 2块日志区的块, 每种大小都
+    // 不能超过高速缓冲中这种大小的缓冲块的四分之一(见buffer_supply())。 位图块和inode块是BLOCK_SIZE的,
+    // 逻辑块更大时目录块和间接块另外计数。
+    j->j_max = buffer_supply(BLOCK_SIZE) / 4;
+    if (j->j_max > J_MAX_BLOCKS)
+        j->j_max = J_MAX_BLOCKS;
+    if (j->j_max < J_MIN_BLOCKS)
+        j->j_max = J_MIN_BLOCKS;
+    j->j_big_max = j->j_max;
+    if (j->j_bsize != BLOCK_SIZE)
+    {
+        j->j_big_max = buffer_supply(j->j_bsize) / 4;
+        if (j->j_big_max > j->j_max)
+            j->j_big_max = j->j_max;
+        if (j->j_big_max < 2 * J_BIG_CREDITS)
+            j->j_big_max = 2 * J_BIG_CREDITS;
+    }
+
+    blk = 1;
+    seq = 1;
+    if ((bh = bread_size(sb->s_dev, j->j_start, j->j_bsize)))
+    {
+        h = (struct d_journal_head*)bh->b_data;
+        if (h->h_magic == J_HEAD_MAGIC && h->h_first >= 1 && h->h_first < j->j_len)
+        {
+            blk = h->h_first;
+            seq = h->h_seq;
+        }
+        brelse(bh);
+    }
+
+    // 重做完整的事务: 副本复制到原位置的缓冲块中并标记为脏, 最后一起写回。
+    while (blk + 2 <= j->j_len)
+    {
+        if (!(bh = bread_size(sb->s_dev, j->j_start + blk, j->j_bsize)))
+            break;
+        desc = (struct d_journal_desc*)bh->b_data;
+        n = desc->d_nr;
+        if (desc->d_magic != J_DESC_MAGIC || desc->d_seq != seq || n > J_MAX_BLOCKS || blk + n + 2 > j->j_len)
+        {
+            brelse(bh);
+            break;
+        }
+        if (!(src = bread_size(sb->s_dev, j->j_start + blk + n + 1, j->j_bsize)))
+        {
+            brelse(bh);
+            break;
+        }
+        c = (struct d_journal_commit*)src->b_data;
+        i = (c->c_magic == J_COMMIT_MAGIC && c->c_seq == seq);
+        brelse(src);
+        if (!i || !check_tags(sb, desc))
+        {
+            brelse(bh);
+            break;
+        }
+        for (i = 0; i < n; i++)
+        {
+            if (!(src = bread_size(sb->s_dev, j->j_start + blk + 1 + i, j->j_bsize)))
+                continue;
+            dst = getblk_size(sb->s_dev, desc->d_tag[i].t_block, desc->d_tag[i].t_size);
+            memcpy(dst->b_data, src->b_data, desc->d_tag[i].t_size);
+            dst->b_uptodate = 1;
+            dst->b_dirt = 1;
+            brelse(dst);
+            brelse(src);
+        }
+        brelse(bh);
+        blk += n + 2;
+        seq++;
+        replayed++;
+    }
+
+    j->j_dev = sb->s_dev;
+    j->j_seq = seq;
+    checkpoint(j);
+    if (replayed)
+        printk("journal: dev %04x, %d transactions replayed\n\r", sb->s_dev, replayed);
+}
+
+/**
+  @brief 卸载时提交运行事务并把所有的块写回原位置, 之后该设备不再使用日志。
+  */
+void journal_release(int dev)
+{
+    struct journal* j;
+
+    if (!(j = find_journal(dev)))
+        return;
+    while (j->j_committer)
+        sleep_on(&j_wait);
+    j->j_committer = current;
+    do_commit(j, 1);
+    j->j_dev = 0;
+    j->j_committer = NULL;
+    wake_up(&j_wait);
+}
+
+/**
+  @brief 软盘已经被更换了(check_disk_change()调用): 丢弃运行事务，什么也不写。 事务中的块放掉日志的
+  引用并清除修改标志, 它们属于原来的盘, 写到新盘上会破坏它。
+  */
+void journal_abort(int dev)
+{
+    struct journal* j;
+    struct buffer_head* bh;
+    int i;
+
+    if (!(j = find_journal(dev)))
+        return;
+    while (j->j_committer)
+        sleep_on(&j_wait);
+    for (i = 0; i < j->j_nr; i++)
+    {
+        bh = j->j_bh[i];
+        bh->b_journal = 0;
+        bh->b_dirt = 0;
+        brelse(bh);
+    }
+    j->j_nr = 0;
+    j->j_nbig = 0;
+    j->j_freed = 0;
+    j->j_dev = 0;
+    printk("journal: dev %04x changed, running transaction discarded\n\r", dev);
+}
@@ -28,6 +28,9 @@
 #define MAY_WRITE 2
 #define MAY_READ 4
 
+// 目录项不少于这个数目的目录才建立哈希索引(见fs/dindex.c), 小目录直接扫描更快
+#define DINDEX_MIN_ENTRIES(dir) (4 * DIR_ENTRIES_PER_BLOCK(dir))
+
 /**
   @brief 用于判断当前进程对一个inode节点是否拥有指定的执行/写/读权限, 如果拥有，则返回1,否则返回0.
   @param [in] inode  指定的inode指针
@@ -67,21 +70,22 @@ static int permission(struct m_inode* inode, int mask)
   @param [in] len  待判断的字符串长度
   @param [in] name 待判断的字符串指针
   @param [in] de   待判断的目录项的结构的指针
+  @param [in] maxlen 目录项中名字的长度(14或30), 见DIR_SIZE()
   @return 当相同时返回1, 不同时返回0.
 
   具体实现：首先判断了待比较的字符串的长度与目录顶结构内的长度是否相同，如果不同则返回0.
   然后再通过汇编指令cmpsb来按字节比较字符串是否相同。
   */
-static int match(int len, const char* name, struct dir_entry* de)
+static int match(int len, const char* name, struct dir_entry* de, int maxlen)
 {
     register int same __asm__("ax");
 
     // 此时说明了给定名字的长度大于了系统规定的文件最大长度, 返回0.
-    if (!de || !de->inode || len > NAME_LEN)
+    if (!de || !de->inode || len > maxlen)
         return 0;
 
     // 此时说明了name中的长度小于了目录项内的名字的长度.
-    if (len < NAME_LEN && de->name[len])
+    if (len < maxlen && de->name[len])
         return 0;
 
     __asm__("cld\n\t"
@@ -93,6 +97,106 @@ static int match(int len, const char* name, struct dir_entry* de)
     return same;
 }
 
+/**
+  @brief 把用户空间中的名字复制到内核缓冲区中, 名字超过maxlen(目录的i_namelen)时与find_entry()一样截断。
+  @return 返回名字的长度, 名字不合法时返回0.
+  */
+static int get_kname(const char* name, int namelen, char* kname, int maxlen)
+{
+    int i;
+
+#ifdef NO_TRUNCATE
+    if (namelen > maxlen)
+        return 0;
+#else
+    if (namelen > maxlen)
+        namelen = maxlen;
+#endif
+    for (i = 0; i < namelen; i++)
+        kname[i] = get_fs_byte(name + i);
+    return namelen;
+}
+
+/**
+  @brief 取得目录dir的哈希索引，还没有时扫描整个目录建立一个。 用完之后要调用dindex_put()。
+  @param [in] dir 目录的inode
+  @return 返回索引的指针，没有可用的索引时返回NULL, 这时调用者线性扫描目录。
+  */
+static struct dir_index* get_dir_index(struct m_inode* dir)
+{
+    struct dir_index* d;
+    struct buffer_head* bh = NULL;
+    struct dir_entry* de = NULL;
+    int entries, block, i;
+
+    if ((d = dindex_get(dir->i_dev, dir->i_num, 0)))
+        return d;
+    // 别的进程正在建立该目录的索引
+    if ((d = dindex_get(dir->i_dev, dir->i_num, 1)))
+    {
+        dindex_put(d);
+        return NULL;
+    }
+    if (!(d = dindex_new(dir->i_dev, dir->i_num)))
+        return NULL;
+    entries = dir->i_size / DIR_SIZE(dir);
+    for (i = 0; i < entries; i++, de = NEXT_DIR_ENTRY(dir, de))
+    {
+        if (!(i % DIR_ENTRIES_PER_BLOCK(dir)))
+        {
+            brelse(bh);
+            if (!(block = bmap(dir, i / DIR_ENTRIES_PER_BLOCK(dir))) || !(bh = bread_size(dir->i_dev, block, dir->i_blocksize)))
+            {
+                bh = NULL;
+                i += DIR_ENTRIES_PER_BLOCK(dir) - 1;
+                continue;
+            }
+            de = (struct dir_entry*)bh->b_data;
+        }
+        if (de->inode && !dindex_insert(d, dindex_hash(de->name, dir->i_namelen), i))
+        {
+            brelse(bh);
+            dindex_drop(d);
+            dindex_put(d);
+            return NULL;
+        }
+    }
+    brelse(bh);
+    dindex_ready(d);
+    return d;
+}
+
+/**
+  @brief 通过哈希索引在目录dir中查找名字，参数与返回值同find_slot(), namelen已经截断过。
+  */
+static struct buffer_head* index_find(struct m_inode* dir, struct dir_index* d, const char* name, int namelen,
+    struct dir_entry** res_dir, int* res_slot)
+{
+    char kname[NAME_LEN_30];
+    unsigned long hash;
+    int slot, block;
+    struct buffer_head* bh;
+    struct dir_entry* de;
+
+    get_kname(name, namelen, kname, dir->i_namelen);
+    hash = dindex_hash(kname, namelen);
+    for (slot = dindex_next(d, hash, -1); slot >= 0; slot = dindex_next(d, hash, slot))
+    {
+        if (!(block = bmap(dir, slot / DIR_ENTRIES_PER_BLOCK(dir))) || !(bh = bread_size(dir->i_dev, block, dir->i_blocksize)))
+            continue;
+        de = DIR_ENTRY(dir, bh, slot % DIR_ENTRIES_PER_BLOCK(dir));
+        if (match(namelen, name, de, dir->i_namelen))
+        {
+            *res_dir = de;
+            if (res_slot)
+                *res_slot = slot;
+            return bh;
+        }
+        brelse(bh);
+    }
+    return NULL;
+}
+
 /**
   @brief 功能描述： 在指定的目录inode中，查找给定的目录名， 如果找到了，通过res_dir返回目录项结构的指针，
   通过返回值返回目录项结构所在的数据块对应的高速缓冲头指针。 如果找不到，返回NULL.
@@ -100,33 +204,35 @@ static int match(int len, const char* name, struct dir_entry* de)
   @param [in]  name    要查找的目录名字。
   @param [in]  namelen 要查找的目录名字的长度。
   @param [out] res_dir 查找到的目录项结构的指针。
+  @param [out] res_slot 不为NULL时返回目录项在目录中的序号。
   @return 返回目录项结构所在的数据块对应的高速缓冲头指针。
+
+  目录项不少于DINDEX_MIN_ENTRIES()时通过哈希索引查找(见index_find()), 否则从头扫描目录。
   */
-static struct buffer_head* find_entry(struct m_inode** dir, const char* name, int namelen, struct dir_entry** res_dir)
+static struct buffer_head* find_slot(struct m_inode** dir, const char* name, int namelen,
+    struct dir_entry** res_dir, int* res_slot)
 {
     int entries;
     int block, i;
     struct buffer_head* bh;
     struct dir_entry* de;
     struct super_block* sb;
+    struct dir_index* d;
 
     *res_dir = NULL;
     if (!namelen)
         return NULL;
 
     // 当定义了不截断路径名时，如果路径名超过了最大长度，就返回NULL，否则的话就截断路径名为最大长度。
+    // 最大长度由目录所在的文件系统决定(14或30)。
 #ifdef NO_TRUNCATE
-    if (namelen > NAME_LEN)
+    if (namelen > (*dir)->i_namelen)
         return NULL;
 #else
-    if (namelen > NAME_LEN)
-        namelen = NAME_LEN;
+    if (namelen > (*dir)->i_namelen)
+        namelen = (*dir)->i_namelen;
 #endif
 
-    /* i_size为给定的目录项的inode中数据的大小(以字节为单位), 目录的inode是用于存在目录项的, 因此通过
-        [文件大小/ 每一个目录项的大小] 可以知道当前目录中存放了多少个目录项结构.  */
-    entries = (*dir)->i_size / (sizeof(struct dir_entry));
-
     /*
        下面的if语句要特别处理一下要查找 ".."目录时的情况，具体是这样的：
        1. 如果给定的dir就是当前进程的根目录的inode了， 再向上层去不了了，已经到达最顶层了，因此查找..等于
@@ -135,7 +241,7 @@ static struct buffer_head* find_entry(struct m_inode** dir, const char* name, in
          这样才能继续向上层查找 ..    */
     if (namelen == 2 && get_fs_byte(name) == '.' && get_fs_byte(name + 1) == '.')
     {
-        if ((*dir) == current->root)
+        if ((*dir) == current->fs->root)
             namelen = 1;
         else if ((*dir)->i_num == ROOT_INO)
         {
@@ -149,42 +255,57 @@ static struct buffer_head* find_entry(struct m_inode** dir, const char* name, in
         }
     }
 
+    /* i_size为给定的目录项的inode中数据的大小(以字节为单位), 目录的inode是用于存在目录项的, 因此通过
+        [文件大小/ 每一个目录项的大小] 可以知道当前目录中存放了多少个目录项结构. 查找..时*dir可能已经
+        换成了挂载点, 所以在这里才计算。 */
+    entries = (*dir)->i_size / DIR_SIZE(*dir);
+
+    // 大目录使用哈希索引, 索引中找不到就是不存在。
+    if (entries >= DINDEX_MIN_ENTRIES(*dir) && (d = get_dir_index(*dir)))
+    {
+        bh = index_find(*dir, d, name, namelen, res_dir, res_slot);
+        dindex_put(d);
+        return bh;
+    }
+
     /* 接下来，从inode对应的数据区内查找匹配的目录项, 目录的inode的第一个zone块肯定存在的，因为每一个
        目录内肯定包含了两个目录项 . 和 ..  */
     if (!(block = (*dir)->i_zone[0]))
         return NULL;
 
-    if (!(bh = bread((*dir)->idev, block)))
+    if (!(bh = bread_size((*dir)->idev, block, (*dir)->i_blocksize)))
         return NULL;
     i = 0;
     de = (struct dir_entry*) bh->b_data;
     while (i < entries)
     {
         // 当读取完当前逻辑块时，切换到下一个逻辑块继续查找。
-        if ((char*)de >= BLOCK_SIZE + bh->b_data)
+        if ((char*)de >= bh->b_size + bh->b_data)
         {
             brelse(bh);
             bh = NULL;
 
             /* 下一块为空时，继续查找下下一块, 这里是有bug的，如果该if 语句成立的话， bh== NULL， 这时候会再一次
                执行while 语句，当执行到while中的每一个if 语句时，由于bh为空，直接崩溃了吧。 */
-            if (!(block = bmap(*dir, i / DIR_ENTRIES_PER_BLOCK))
-                || !(bh = bread((*dir)->i_dev, block)))
+            if (!(block = bmap(*dir, i / DIR_ENTRIES_PER_BLOCK(*dir)))
+                || !(bh = bread_size((*dir)->i_dev, block, (*dir)->i_blocksize)))
             {
-                i += DIR_ENTRIES_PER_BLOCK;
+                i += DIR_ENTRIES_PER_BLOCK(*dir);
                 continue;
             }
             de = (struct dir_entry*) bh->b_data;
         }
 
         // 如果查找到了，返回相应的值。
-        if (match(namelen, name, de))
+        if (match(namelen, name, de, (*dir)->i_namelen))
         {
             *res_dir = de;
+            if (res_slot)
+                *res_slot = i;
             return bh;
         }
         ++i;
-        ++de;
+        de = NEXT_DIR_ENTRY(*dir, de);
     }
 
     // 没有查找到时，返回NULL.
@@ -192,6 +313,77 @@ static struct buffer_head* find_entry(struct m_inode** dir, const char* name, in
     return NULL;
 }
 
+/**
+  @brief 与find_slot()相同，不需要目录项序号时使用。
+  */
+static struct buffer_head* find_entry(struct m_inode** dir, const char* name, int namelen, struct dir_entry** res_dir)
+{
+    return find_slot(dir, name, namelen, res_dir, NULL);
+}
+
+/**
+  @brief 目录dir中序号为slot的目录项被删除之后调用, 让add_entry()下一次从这里开始查找空闲项。
+  */
+static void free_slot(struct m_inode* dir, int slot)
+{
+    if (slot < dir->i_free_hint)
+        dir->i_free_hint = slot;
+}
+
+/**
+  @brief 在目录*dir中查找名字，只需要得到i节点号时使用它代替find_entry(), 先查找目录项缓存。
+  @param [in,out] dir 目录的inode, 查找..时可能被替换为挂载点的inode(见find_entry())
+  @param [in] name 要查找的名字(用户空间中的)
+  @param [in] namelen 名字的长度
+  @return 返回名字对应的i节点号，找不到时返回0.
+
+  . 和 .. 可能要跨越挂载点或者受进程根目录的限制, 不进行缓存。
+  */
+static int lookup_entry(struct m_inode** dir, const char* name, int namelen)
+{
+    char kname[NAME_LEN_30];
+    struct buffer_head* bh;
+    struct dir_entry* de;
+    unsigned long gen;
+    int len, ino;
+
+    if (!(len = get_kname(name, namelen, kname, (*dir)->i_namelen)))
+        return 0;
+    if (kname[0] == '.' && (len == 1 || (len == 2 && kname[1] == '.')))
+    {
+        if (!(bh = find_entry(dir, name, namelen, &de)))
+            return 0;
+        ino = de->inode;
+        brelse(bh);
+        return ino;
+    }
+
+    if ((ino = dcache_lookup((*dir)->i_dev, (*dir)->i_num, kname, len)) >= 0)
+        return ino;
+    // find_entry()读目录块时会睡眠, 其它进程可能在这期间创建或删除了这个名字
+    gen = dcache_generation();
+    ino = 0;
+    if ((bh = find_entry(dir, name, namelen, &de)))
+    {
+        ino = de->inode;
+        brelse(bh);
+    }
+    dcache_add((*dir)->i_dev, (*dir)->i_num, kname, len, ino, gen);
+    return ino;
+}
+
+/**
+  @brief 目录dir中的名字name被创建或者删除之后调用, 删除对应的目录项缓存。
+  */
+static void invalidate_entry(struct m_inode* dir, const char* name, int namelen)
+{
+    char kname[NAME_LEN_30];
+    int len;
+
+    if ((len = get_kname(name, namelen, kname, dir->i_namelen)))
+        dcache_invalidate(dir->i_dev, dir->i_num, kname, len);
+}
+
 /**
   @brief 该函数实现向给定的一个目录中添加一个新的目录项名。 当添加失败时返回NULL, 当添加成功时，通过res_dir返回新添加的
          目录项的指针， 通过返回值返回新目录项所在高速缓存块的指针。
@@ -203,74 +395,78 @@ static struct buffer_head* find_entry(struct m_inode** dir, const char* name, in
   */
 static struct buffer_head* add_entry(struct m_inode* dir, const char* name, int namelen, struct dir_entry** res_dir)
 {
-    int block, i;
-    struct buffer_head* bh;
+    int block, i, j;
+    struct buffer_head* bh = NULL;
     struct dir_entry* de;
+    struct dir_index* d;
+    char kname[NAME_LEN_30];
     
-    *read_dir = NULL;
+    *res_dir = NULL;
     if (namelen == 0)
         return NULL;
     
     // 是否进行截断处理
-#ifdef NO_TRUNCATE
-    if (namelen > NAME_LEN)
+    if (!(namelen = get_kname(name, namelen, kname, dir->i_namelen)))
         return NULL;
-#else
-    if (namelen > NAME_LEN)
-        namelen = NAME_LEN;
-#endif
     
-    if (!(block = dir->i_zones[0]))
-        return NULL;
-    if (!(bh = bread(dir->i_dev, block)))
+    if (!dir->i_zone[0])
         return NULL;
     
-    i = 0;
-    de = (struct dir_entry*)bh->b_data;
+    // 从i_free_hint开始查找，它之前的目录项都在使用，不需要每次都从第0个目录项开始扫描。
+    i = dir->i_free_hint;
     while (1)
     {
         // 如果当前逻辑块已经查找完时，再继续查找下一个逻辑块(可能是新创建的逻辑块，也可能之前的吧。
-        if ((char*)de >= bh->b_data + BLOCK_SIZE)
+        if (!bh || (char*)de >= bh->b_data + bh->b_size)
         {
-            if (!(block = create_block(dir, i / DIR_ENTRIES_PER_BLOCK)))
+            brelse(bh);
+            if (!(block = create_block(dir, i / DIR_ENTRIES_PER_BLOCK(dir))))
                 return NULL;
             
-            /* 当前逻辑块的指针为空时，就继续查找下一个逻辑块.这里同样有bug, 该if语句成立时，bh为NULL，此时
-               再一次执行while时，在第一个if 语句中就溃了吧。 */
-            if (!(bh = bread(dir->i_dev, block))) 
+            // 读不出来的逻辑块跳过，继续查找下一个逻辑块。
+            if (!(bh = bread_size(dir->i_dev, block, dir->i_blocksize))) 
             {
-                i += DIR_ENTRIES_PER_BLOCK;
+                i += DIR_ENTRIES_PER_BLOCK(dir) - i % DIR_ENTRIES_PER_BLOCK(dir);
                 continue;
             }
-            de = (struct dir_entry*)bh->b_data;
+            de = DIR_ENTRY(dir, bh, i % DIR_ENTRIES_PER_BLOCK(dir));
         }
         
         // 当查找到了新的数据区时（已经大于的原来的size大小）时，肯定可以在这里加入entry的：因此改变一下
         // inode的对应的数据文件大小，接下来一定要改变一下文件的改变时间了(i_ctime).
         // i_ctime 表示文件的改变时间， 只要文件改变了就更新(不局限于内容改变）,例如访问权限啦，文件大小啊，等。
         // 而i_mtime 表示修改时间，仅局限于文件内容改变时才更新该值。
-        if (i * sizeof(struct dir_entry) >= dir->i_size)
+        if (i * DIR_SIZE(dir) >= dir->i_size)
         {
-            dir->size = (i+1) * sizeof(struct dir_entry);
+            dir->i_size = (i+1) * DIR_SIZE(dir);
             dir->i_ctime = CURRENT_TIME;
             dir->i_dirt = 1;
             de->inode = 0;        // 修改为0原因是： 接下来的代码会告诉你答案！
         }
         
         /* 当struct entry中的inode值为0时，表示该entry可以使用！ 注意这里没有把de的inode号置为非0， 它交
-           给了调用该函数的地方来完成。 */
+           给了调用该函数的地方来完成。 如果目录有哈希索引，把该槽位从旧名字的链表移到新名字的链表中。 */
         if (!de->inode)
         {
-            for (i = 0; i < NAME_LEN; i++)
-                de->name[i] = (i < namelen) ? get_fs_byte(name+i) : 0;
+            if ((d = dindex_get(dir->i_dev, dir->i_num, 1)))
+                dindex_remove(d, dindex_hash(de->name, dir->i_namelen), i);
+            for (j = 0; j < dir->i_namelen; j++)
+                de->name[j] = (j < namelen) ? kname[j] : 0;
+            if (d)
+            {
+                if (!dindex_insert(d, dindex_hash(kname, namelen), i))
+                    dindex_drop(d);
+                dindex_put(d);
+            }
 
+            dir->i_free_hint = i + 1;
             dir->i_mtime = CURRENT_TIME;    // 这里为什么不把dir->i_dir置为1呢？
-            bh->b_dirt = 1;
+            journal_dirty(bh);
             *res_dir = de;
             return bh;
         } 
         ++i;
-        ++de;
+        de = NEXT_DIR_ENTRY(dir, de);
     }
 }
 
@@ -291,27 +487,25 @@ static struct m_inode* get_dir(const char* pathname)
     char c;
     const char* thisname;
     struct m_inode* inode;
-    strcut buffer_head* bh;
     int namelen, inr, idev;
-    struct dir_entry* de;
     
     // 在进行处理之前先判断一些必须满足的条件：
     if (!pathname)
         return NULL;
     
-    if (!current->root || !current->root->i_count)
+    if (!current->fs->root || !current->fs->root->i_count)
         panic("No root inode");
-    if (!current->pwd || !current->pwd->i_count)
+    if (!current->fs->pwd || !current->fs->pwd->i_count)
         panic("No cwd inode");
     
     // 通过路径名中的第一个字符判断是绝对路径/相对路径/空路径
     if ((c = get_fs_byte(pathname)) == '/')
     {
-        inode = current->root;
+        inode = current->fs->root;
         ++pathname;
     }
     else if (c)
-        inode = current->pwd;
+        inode = current->fs->pwd;
     else
         return NULL;
     
@@ -334,14 +528,13 @@ static struct m_inode* get_dir(const char* pathname)
             return inode;
         
         // 从下面的代码中可以看出来，不支持形如'//'的目录，因为对应的namelen为0， 会返回NULL.
-        if (!(bh= find_entry(&inode, thisname, namelen, &de)))
+        // inr为该目录项的指向的inode在磁盘中的索引号, 通过目录项缓存查找。
+        if (!(inr = lookup_entry(&inode, thisname, namelen)))
         {
             iput(inode);
             return NULL;
         }
-        inr = de->inode;        // 里面存放了该目录项的指向的inode在磁盘中的索引号。
         idev = inode->i_dev;
-        brelse(bh);
         iput(inode);
         if (!(inode = iget(idev, inr)))
             return NULL;
@@ -392,8 +585,6 @@ struct m_inode* namei(const char* pathname)
     const char* basename;
     int inr, dev, namelen;
     struct m_inode* dir;
-    struct buffer_head* bh;
-    struct dir_entry* de;
     
     // 空的路径
     if (!(dir = dir_namei(pathname, &namelen, &basename)))
@@ -403,17 +594,14 @@ struct m_inode* namei(const char* pathname)
     if (!namelen) 
         return dir;
     
-    if (!(bh = find_entry(&dir, basename, namelen, &de)))
+    // 想找最后一个目录内的文件名的inode. 形如这样的路径： /etc/lib/a.so, 即查找
+    // lib目录下的a.so文件的inode.
+    if (!(inr = lookup_entry(&dir, basename, namelen)))
     {
         iput(dir);
         return NULL;
     }
-    
-    // 想找最后一个目录内的文件名的inode. 形如这样的路径： /etc/lib/a.so, 即查找
-    // lib目录下的a.so文件的inode.
-    inr = de->inode;
     dev = dir->i_dev;
-    brelse(bh);
     iput(dir);
     dir = iget(dev, inr);
     if (dir)
@@ -436,7 +624,7 @@ struct m_inode* namei(const char* pathname)
   目录不能是只写/读写/截断/新建，当是文件时，如果文件不存在要不要创建呢？当以读方式打开文件时，如果文件
   没有读权限呢？当以写方式打开文件时，如果文件没有写权限呢？等。
   */
-int open_namei(const char* pathname, int flag, int mode, struct m_inode** res_inode)
+static int do_open_namei(const char* pathname, int flag, int mode, struct m_inode** res_inode)
 {
     const char* basename;
     int inr, dev, namelen;
@@ -453,7 +641,7 @@ int open_namei(const char* pathname, int flag, int mode, struct m_inode** res_in
        相应位置1了。
        背景说明: 进程都有一个默认的umask的值，例如当umask = 0002, 也就是该进程在创建文件或目录时，会把其它
        用户对文件的可写标志位屏蔽掉。 通过修改umask的值，可以修改创建文件与目录的默认mode.  */
-    mode &= 0777 & ~current->umask; 
+    mode &= 0777 & ~current->fs->umask; 
     mode |= I_REGULAR;     // 这里应该是为后面的新建作准备，如果是新建，就只能新建普通文件。
 
     /* 打开路径最顶层目录的inode. 例如: /etc/ad/etc/ad 会打开etc的目录inode，而/etc/ad/acd/
@@ -477,8 +665,8 @@ int open_namei(const char* pathname, int flag, int mode, struct m_inode** res_in
 
     /* 找到目录内对应名字的目录项(de)，和目录项所在的高速缓冲块的头指针。 假如没有找到的话，
        就需要新建了，具体能不能新建，还有一些约束条件。 */
-    bh = find_entry(&dir, basename, namelen, &de);
-    if (!bh)
+    inr = lookup_entry(&dir, basename, namelen);
+    if (!inr)
     {
         if (!(flag & O_CREAT))
         {
@@ -501,6 +689,7 @@ int open_namei(const char* pathname, int flag, int mode, struct m_inode** res_in
         inode->i_uid = current->euid;
         inode->i_mode = mode;
         inode->i_dirt = 1;
+        inode->i_goal = dir->i_zone[0];     // 新文件的数据块放在父目录附近
 
         // 新建entry.
         bh = add_etry(dir, basename, namelen, &de);
@@ -512,17 +701,16 @@ int open_namei(const char* pathname, int flag, int mode, struct m_inode** res_in
             return -ENOSPC;
         }
         de->inode = inode->i_num;
-        bh->b_dirt = 1;
+        journal_dirty(bh);
         brelse(bh);
+        invalidate_entry(dir, basename, namelen);
         iput(dir);
         *res_inode = inode;
         return 0;
     }
 
     // 如果对应的目录项存在时，打开目录项中对应的inode.
-    inr = de->inode;
     dev = dir->i_dev;
-    brelse(bh);
     iput(dir);
     if (flag & O_EXCL)
         return -EEXIST;
@@ -550,7 +738,7 @@ int open_namei(const char* pathname, int flag, int mode, struct m_inode** res_in
   @param [in] dev      如果创建的是块设备文件或字符设备文件，则dev为相应的设备号。
   @return 成功时返回0,失败时返回相应的错误码。
   */
-int sys_mknod(const char* filename, int mode, int dev)
+static int do_mknod(const char* filename, int mode, int dev)
 {
     const char* basename;
     int namelen;
@@ -610,7 +798,8 @@ int sys_mknod(const char* filename, int mode, int dev)
         return -ENOSPC;
     }
     de->inode = inode->i_num;
-    bh->b_dirt = 1;
+    journal_dirty(bh);
+    invalidate_entry(dir, basename, namelen);
     iput(dir);
     iput(inode);
     brelse(bh);
@@ -623,7 +812,7 @@ int sys_mknod(const char* filename, int mode, int dev)
   @param [in] 新创建的目录的mode
   @return 成功时返回0, 失败时返回错误码。
   */
-int sys_mkdir(const char* pathname, int mode)
+static int do_mkdir(const char* pathname, int mode)
 {
     const char* basename;
     int namelen;
@@ -665,13 +854,13 @@ int sys_mkdir(const char* pathname, int mode)
         iput(dir);
         return -ENOSPC;
     }
-    inode->i_size = 32;        // 这个32是两个目录项的值，分别为.和.. ,这是不应该用32,而是写成2 * sizeof(struct dir_entry)更好。
+    inode->i_size = 2 * DIR_SIZE(inode);        // 两个目录项的大小，分别为.和.. , v1是32, 30字符名字的文件系统是64。
     inode->i_dirt = 1;
     inode->i_mtime = CURRENT_TIME;
     inode->i_atime = CURRENT_TIME;
 
     // 为新的目录项inode节点创建一个数据块, 并在数据块中写入两个默认的目录项： . 和 .. 
-    if (!(inode->i_zone[0] = new_block(inode->i_dev)))    // 得到的是逻辑块的索引号
+    if (!(inode->i_zone[0] = new_block(inode->i_dev, dir->i_zone[0])))    // 得到的是逻辑块的索引号, 尽量靠近父目录
     {
         iput(dir);
         inode->i_nlinks--;
@@ -679,7 +868,7 @@ int sys_mkdir(const char* pathname, int mode)
         return -ENOSPC;
     }
     inode->i_dirt = 1;
-    if (!(dir_block = bread(inode->i_dev, inode->i_zone[0])))
+    if (!(dir_block = bread_size(inode->i_dev, inode->i_zone[0], inode->i_blocksize)))
     {
         iput(dir);
         free_block(inode->i_dev, inode->i_zone[0]);
@@ -691,13 +880,13 @@ int sys_mkdir(const char* pathname, int mode)
     de->inode = inode->i_num;
     strcpy(de->name, ".");
 
-    ++de;
+    de = NEXT_DIR_ENTRY(inode, de);
     de->inode = dir->i_num;
     strcpy(de->name, "..");
     inode->i_nlinks = 2;        // . 与目录本身会引用它, 所以为2.
-    dir_block->b_dirt = 1;
+    journal_dirty(dir_block);
     brelse(dir_block);
-    inode->i_mode = I_DIRECTORY | (mode & 0777 & ~current->umask);  // 添加了为目录项的标志(对于uamsk,可以看一个umaks命令)
+    inode->i_mode = I_DIRECTORY | (mode & 0777 & ~current->fs->umask);  // 添加了为目录项的标志(对于uamsk,可以看一个umaks命令)
     inode->i_dirt = 1;
 
     // 在上一级目录中创建新目录的目录项，把绑定到当前创建的inode节点上。
@@ -711,7 +900,8 @@ int sys_mkdir(const char* pathname, int mode)
         return -ENOSPC;
     }
     de->inode = inode->num;
-    bh->b_dirt = 1;
+    journal_dirty(bh);
+    invalidate_entry(dir, basename, namelen);
     dir->i_nlinks++;
     dir->i_dirt = 1;
     iput(dir);
@@ -736,8 +926,8 @@ static int empty_dir(struct m_inode* inode)
     struct buffer_head* bh;
     struct dir_entry* de;
 
-    len = inode->i_size / sizeof(struct dir_entry);
-    if (len < 2 || !inode->i_zone[0] || (!bh = bread(inode->i_dev, inode->i_zone[0])))
+    len = inode->i_size / DIR_SIZE(inode);
+    if (len < 2 || !inode->i_zone[0] || (!bh = bread_size(inode->i_dev, inode->i_zone[0], inode->i_blocksize)))
     {
         printk("warning: bad directory on dev %04x\n", inode->i_dev);
         return 0;
@@ -745,8 +935,8 @@ static int empty_dir(struct m_inode* inode)
 
     de = (struct dir_entry*)bh->data;
     // 检测一下.目录和..目录, 如果对应，打印错误信息，并返回。
-    if (de[0].inode != inode->i_num || !de[1].inode
-            || strcmp(".", de[0].name) || strcmp("..", de[1].name))
+    if (de->inode != inode->i_num || !NEXT_DIR_ENTRY(inode, de)->inode
+            || strcmp(".", de->name) || strcmp("..", NEXT_DIR_ENTRY(inode, de)->name))
     {
         printk("warning: bad directory on dev %04x\n", inode->i_dev);
         return 0;
@@ -757,19 +947,19 @@ static int empty_dir(struct m_inode* inode)
        一定在使用，如果目录项没有使用，则目录项的inode为0. 
        有一个问题想知道：什么时候目录的size会减小呢？ */
     nr = 2;
-    de += 2;
+    de = DIR_ENTRY(inode, bh, 2);
     while (nr < len)
     {
         // 当前的逻辑块读取完时，切换到下一下逻辑块中。
-        if ((void*)de >= (void*)(bh->b_data + BLOCK_SIZE))
+        if ((void*)de >= (void*)(bh->b_data + bh->b_size))
         {
             brelse(bh);
-            if (!(block = bmap(inode, nr / DIR_ENTRIES_PER_BLOCK)))
+            if (!(block = bmap(inode, nr / DIR_ENTRIES_PER_BLOCK(inode))))
             {
-                nr += DIR_ENTRIES_PER_BLOCK;
+                nr += DIR_ENTRIES_PER_BLOCK(inode);
                 continue;
             }
-            if (!(bh = bread(inode->i_dev, block)))
+            if (!(bh = bread_size(inode->i_dev, block, inode->i_blocksize)))
                 return 0;
             de = (struct dir_entry*)bh->b_data;
         }
@@ -780,7 +970,7 @@ static int empty_dir(struct m_inode* inode)
             brelse(bh);
             return 0;
         }
-        de++;
+        de = NEXT_DIR_ENTRY(inode, de);
         nr++;
     }
     brelse(bh);
@@ -792,10 +982,10 @@ static int empty_dir(struct m_inode* inode)
   @param [in] name 待删除的目录路径名
   @return 删除成功返回0, 错误返回相应的错误码。
   */
-int sys_rmdir(const char* name)
+static int do_rmdir(const char* name)
 {
     const char* basename;
-    int namelen;
+    int namelen, slot;
     struct m_inode *dir, *inode;
     struct buffer_head* bh;
     struct dir_entry* de;
@@ -819,7 +1009,7 @@ int sys_rmdir(const char* name)
         return -EPERM;
     }
     // 如果找不到要删除目录的目录项，也返回错误码。
-    if (!(bh = find_entry(&dir, basename, namelen, &de)))
+    if (!(bh = find_slot(&dir, basename, namelen, &de, &slot)))
     {
         iput(dir);
         return -ENOENT;
@@ -877,10 +1067,14 @@ int sys_rmdir(const char* name)
     if (inode->i_nlinks != 2)
         printk("empty directory has nlinks != 2 (%d)", inode->i_nlinks);
 
-    // 执行真正的删除相关操作。
+    // 执行真正的删除相关操作。 被删除的目录的i节点号以后可能被重用，它下面的缓存项(负目录项)也要删除。
     de->inode = 0;
-    bh->b_dirt = 1;
+    journal_dirty(bh);
     brelse(bh);
+    invalidate_entry(dir, basename, namelen);
+    free_slot(dir, slot);
+    dcache_purge(inode->i_dev, inode->i_num);
+    dindex_purge(inode->i_dev, inode->i_num);
     inode->i_nlinks = 0;
     inode->i_dirt = 1;
     dir->i_nlinks--;
@@ -897,10 +1091,10 @@ int sys_rmdir(const char* name)
   @param [in] name 要删除的文件路径名。
   @return 删除成功返回0, 如果失败返回相应的错误码。
   */
-int sys_unlink(const char* name)
+static int do_unlink(const char* name)
 {
     const char* basename;
-    int namelen;
+    int namelen, slot;
     struct m_inode *dir, *inode;
     struct buffer_head* bh;
     struct dir_entry* de;
@@ -920,7 +1114,7 @@ int sys_unlink(const char* name)
     }
 
     // 获取要删除文件的目录项和目录项所在超级块的头指针
-    if (!(bh = find_entry(&dir, basename, namelen, &de)))
+    if (!(bh = find_slot(&dir, basename, namelen, &de, &slot)))
     {
         iput(dir);
         return -ENOENT;
@@ -959,8 +1153,10 @@ int sys_unlink(const char* name)
 
     // 执行具体的删除操作
     de->inode = 0;
-    bh->b_dirt = 1;
+    journal_dirty(bh);
     brelse(bh);
+    invalidate_entry(dir, basename, namelen);
+    free_slot(dir, slot);
     inode->i_nlinks--;
     inode->i_dirt = 1;
     inode->i_ctime = CURRENT_TIME;
@@ -975,7 +1171,7 @@ int sys_unlink(const char* name)
   @param [in] newname 新文件的路径文件名
   @return 如果成功则返回0, 如果失败则返回相应的错误码。
   */
-int sys_link(const char* oldname, const char* newname)
+static int do_link(const char* oldname, const char* newname)
 {
     struct dir_entry *de;
     struct m_inode *oldinode, *dir;
@@ -1037,8 +1233,9 @@ int sys_link(const char* oldname, const char* newname)
 
     // 真正的文件创建动作
     de->inode = oldinode->i_num;
-    bh->b_dirt = 1;
+    journal_dirty(bh);
     brelse(bh);
+    invalidate_entry(dir, basename, namelen);
     iput(dir);
     ++oldinode->i_nlinks;
     oldinode->i_ctime = CURRENT_TIME;
@@ -1046,3 +1243,88 @@ int sys_link(const char* oldname, const char* newname)
     iput(oldinode);
     return 0;
 }
+
+/*
+  以下是修改目录的系统调用的入口: 整个操作在journal_start()和journal_stop()之间进行, 它修改的位图、
+  inode和目录块在同一个日志事务中, 断电之后要么全部生效，要么全部没有发生(见fs/journal.c)。 日志是
+  每个文件系统一个的, 先找到路径名所在的设备(目录项缓存使这次查找很快)。
+  */
+
+/**
+  @brief 路径名中最后一个目录所在的设备号, 找不到目录时返回0.
+  */
+static int path_dev(const char* pathname)
+{
+    struct m_inode* dir;
+    const char* basename;
+    int namelen, dev;
+
+    if (!(dir = dir_namei(pathname, &namelen, &basename)))
+        return 0;
+    dev = dir->i_dev;
+    iput(dir);
+    return dev;
+}
+
+int open_namei(const char* pathname, int flag, int mode, struct m_inode** res_inode)
+{
+    int error, dev;
+
+    // 只有创建和截断文件时才修改元数据; 截断可能释放文件所有的逻辑块, 删除时(iput())也是
+    if (!(flag & (O_CREAT | O_TRUNC)))
+        return do_open_namei(pathname, flag, mode, res_inode);
+    journal_start(dev = path_dev(pathname), J_TRUNC_CREDITS);
+    error = do_open_namei(pathname, flag, mode, res_inode);
+    journal_stop(dev, J_TRUNC_CREDITS);
+    return error;
+}
+
+int sys_mknod(const char* filename, int mode, int dev)
+{
+    int error, jdev;
+
+    journal_start(jdev = path_dev(filename), J_CREDITS);
+    error = do_mknod(filename, mode, dev);
+    journal_stop(jdev, J_CREDITS);
+    return error;
+}
+
+int sys_mkdir(const char* pathname, int mode)
+{
+    int error, dev;
+
+    journal_start(dev = path_dev(pathname), J_CREDITS);
+    error = do_mkdir(pathname, mode);
+    journal_stop(dev, J_CREDITS);
+    return error;
+}
+
+int sys_rmdir(const char* name)
+{
+    int error, dev;
+
+    journal_start(dev = path_dev(name), J_TRUNC_CREDITS);
+    error = do_rmdir(name);
+    journal_stop(dev, J_TRUNC_CREDITS);
+    return error;
+}
+
+int sys_unlink(const char* name)
+{
+    int error, dev;
+
+    journal_start(dev = path_dev(name), J_TRUNC_CREDITS);
+    error = do_unlink(name);
+    journal_stop(dev, J_TRUNC_CREDITS);
+    return error;
+}
+
+int sys_link(const char* oldname, const char* newname)
+{
+    int error, dev;
+
+    journal_start(dev = path_dev(newname), J_CREDITS);
+    error = do_link(oldname, newname);
+    journal_stop(dev, J_CREDITS);
+    return error;
+}
@@ -138,14 +138,14 @@ int sys_pipe(unsigned long* fildes)
     // 从当前进行的文件数组中查找空闲位置，并把上面找到的文件指针放进去，还把对应的文件描述符放到fd[]数组中。
     for (i = 0; j = 0; j < NR_OPEN && j < 2; ++i)
     {
-        if (!current->filp[i])
+        if (!current->files->fd[i])
         {
             fd[j] = i;
-            current->filp[i++] = f[j++];
+            current->files->fd[i++] = f[j++];
         }
     }
     if (j == 1)
-        current->filp[fd[0]] = NULL;
+        current->files->fd[fd[0]] = NULL;
     if (j < 2)
     {
         f[0]->f_count = f[1]->f_count = 0;
@@ -155,7 +155,7 @@ int sys_pipe(unsigned long* fildes)
     // 新建一个inode, 给管道使用。
     if (!(inode = get_pipe_inode()))
     {
-        current->filp[fd[0]] = current->filp[fd[1]] = NULL;
+        current->files->fd[fd[0]] = current->files->fd[fd[1]] = NULL;
         f[0]->f_count = f[1]->f_count = 0;
         return -1;
     }
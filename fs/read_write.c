@@ -28,7 +28,7 @@ int sys_lseek(unsigned int fd, off_t offset, int origin)
 
     // 如果文件描述符大于最大值，或者 文件描述符对应的当前进程的文件指针为空 或者 文件没有对应的inode 或者 inode对应的设备不可以seek
     // 可以seek的设备为： 内存/软驱/硬盘, 对应的主设备号为1,2和3.
-    if (fd >= NR_OPEN || !(file = current->filp[fd]) || !(file->f_inode) || !IS_SEEKABLE(MAJOR(file->f_inode->dev)))
+    if (fd >= NR_OPEN || !(file = current->files->fd[fd]) || !(file->f_inode) || !IS_SEEKABLE(MAJOR(file->f_inode->dev)))
         return -EBADF;
 
     // 管道也不支持
@@ -71,7 +71,7 @@ int sys_read(unsigned in fd, char* buf, int count)
     struct file* file;
     struct m_inode* inode;
 
-    if (fd >= NR_OPEN || count < 0 || !(file = current->filp[fd]))
+    if (fd >= NR_OPEN || count < 0 || !(file = current->files->fd[fd]))
         return -EINVAL;
 
     if (count == 0)
@@ -114,7 +114,7 @@ int sys_write(unsigned int fd, char* buf, int count)
     struct file* file;
     struct m_inode* inode;
 
-    if (fd >= NR_OPEN || count < 0 || !(file = current->filp[fd]))
+    if (fd >= NR_OPEN || count < 0 || !(file = current->files->fd[fd]))
         return -EINVAL;
 
     if (count == 0)
@@ -39,6 +39,7 @@ static void lock_super(struct super_block* sb)
     while (sb->s_lock)
         sleep_on(&(sb->s_wait));
     sb->s_lock = 1;
+    current->preempt_count++;
     sti();
 }
 
@@ -51,7 +52,8 @@ static void unlock_super(struct super_block* sb)
 {
     cli();
     sb->s_lock = 0;
-    wait_up(&(sb->s_wait));
+    current->preempt_count--;
+    wake_up(&(sb->s_wait));
     sti();
 }
 
@@ -145,6 +147,7 @@ static struct super_block* read_supper(int dev)
 {
     struct super_block* sb;
     struct buffer_head* bh;
+    struct d_journal_info info;
     int i, block;
     
     if (!dev)
@@ -167,6 +170,8 @@ static struct super_block* read_supper(int dev)
     s->s_time = 0;
     s->s_rd_only = 0;
     s->s_dirt = 0;
+    s->s_counted = 0;          // 空闲计数在第一次分配时统计(见fs/bitmap.c)
+    s->s_zreserved = 0;
     
     // 读取磁盘上的超级块到内存中
     lock_super(s);
@@ -177,13 +182,40 @@ static struct super_block* read_supper(int dev)
         return NULL;
     }
     *((struct d_super_block*)s) = *((struct d_super_block*)bh->data);
+    info = *((struct d_journal_info*)(bh->b_data + JOURNAL_INFO_OFFSET));
     brelse(bh);
-    if (s->s_magic != SUPER_MAGIC)        // 验证是否是支持的类型，
+    // 验证是否是支持的类型: MINIX v1或v2, 名字长度14或30。 v2的逻辑块总数放在32位的s_zones中。
+    switch (s->s_magic)
     {
+    case SUPER_MAGIC:
+    case SUPER_MAGIC_30:
+        s->s_version = 1;
+        s->s_zones = s->s_nzones;
+        s->s_inodes_per_block = INODES_PER_BLOCK;
+        break;
+    case SUPER_MAGIC_V2:
+    case SUPER_MAGIC_V2_30:
+        s->s_version = 2;
+        s->s_inodes_per_block = V2_INODES_PER_BLOCK;
+        break;
+    default:
         s->s_dev = 0;
         unlock_super(s);
         return NULL;
     }
+    s->s_namelen = (s->s_magic == SUPER_MAGIC_30 || s->s_magic == SUPER_MAGIC_V2_30) ? NAME_LEN_30 : NAME_LEN;
+    // 位图块数超过了s_imap[]/s_zmap[]能容纳的数目, 或者逻辑块大于高速缓冲支持的4KB
+    if (s->s_imap_blocks > I_MAP_SLOTS || s->s_zmap_blocks > Z_MAP_SLOTS
+        || (BLOCK_SIZE << s->s_log_zone_size) > BLOCK_SIZE_MAX)
+    {
+        s->s_dev = 0;
+        unlock_super(s);
+        return NULL;
+    }
+    // 逻辑块号以s_blocksize为单位, 超级块、位图和inode所在的块号仍然以BLOCK_SIZE为单位
+    s->s_blocksize = BLOCK_SIZE << s->s_log_zone_size;
+    // 有日志时先重做日志中的事务, 之后读入的位图是恢复之后的。
+    journal_load(s, &info);
     
     // 初始化s_imap[]和s_zmap[]数组为NULL.
     for (i = 0; i < I_MAP_SLOTS; ++i) 
@@ -214,6 +246,7 @@ static struct super_block* read_supper(int dev)
             brelse(s->s_imap[i]);
         for (i = 0; i < Z_MAP_SLOTS; ++i)
             brelse(s->s_zmap[i]);
+        journal_release(dev);
         s->s_dev = 0;
         return NULL;
     }
@@ -256,7 +289,7 @@ int sys_umount(char* dev_name)
     if (!sb->s_imount->i_mount)
         printk("Mounted inode has i_mount = 0\n");
     // 检测要卸载的设备是否有进程正在使用,如果是，则返回忙
-    for (inode = inode_table; inode < inode_table + NR_INODE; ++inode)
+    for (inode = inode_list; inode; inode = inode->i_next)
     {
         if (inode->i_dev = =dev && inode->i_count)
             return -EBUSY;
@@ -268,8 +301,12 @@ int sys_umount(char* dev_name)
     sb->s_imount = NULL;
     iput(sb->s_isup);
     sb->s_isup = NULL;
+    journal_release(dev);    // 提交日志并写回所有的块, 不能持有超级块锁(write_inode()要用get_super())
     put_super(dev);
     sync_dev(dev);
+    // 该设备以后可能装入另外一个文件系统, 它的目录项缓存和目录索引不能再使用了
+    dcache_purge(dev, 0);
+    dindex_purge(dev, 0);
     return 0;
 }
 
@@ -345,7 +382,7 @@ void mount_root(void)
     struct super_block* sb;
     struct m_inode* mi;
     
-    if (32 != sizeof(struct d_inode))
+    if (32 != sizeof(struct d_inode) || 64 != sizeof(struct d2_inode))
         panic("bad inode size!\n");
 
     for (i = 0; i < NR_FILE; ++i)
@@ -373,18 +410,18 @@ void mount_root(void)
     mi->i_count += 3;
     p->s_isup = mi;
     p->s_imount = mi;
-    current->pwd = mi;
-    current->root = mi;
+    current->fs->pwd = mi;
+    current->fs->root = mi;
     
     // 初始化zmap, 为什么都设置为1呢？统计空闲的zones..
     free = 0;
-    i = p->s_nzones;
+    i = p->s_zones;
     while (--i >= 0)
     {
         if (!set_bit(i &8191, p->s_zmap[i>>13]->b_data))
             free++;
     }
-    printk("%d/%d free blocks\n\r", free, p->s_nzones);
+    printk("%d/%d free blocks\n\r", free, p->s_zones);
     
     // 初始化imap, 为什么都设置为1呢？统计空闲的inode.
     free = 0;
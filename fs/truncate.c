@@ -2,59 +2,40 @@
 #include <sys/stat.h>
 
 /**
-  @brief 释放给定设备的指定块上的一次间接块缓冲区,  并且存放一次间接块的block块也会被释放掉的。
-  @param [in] dev 给定的设备号
-  @param [in] block 设备上的指定块, 上面保存了一次间接块的块号。
+  @brief 释放给定的间接块以及它映射的所有逻辑块, depth为1时是一次间接块, 2是二次间接块, 3是三次间接块(只有v2有)。
+  @param [in] inode 给定的inode结点指针, 由它决定间接块中的块号是16位(v1)还是32位(v2)
+  @param [in] block 设备上的指定块, 上面保存了间接块的块号。
+  @param [in] depth 间接的层数
   @return 返回空。
   */
-static void free_ind(int dev, int block)
+static void free_ind(struct m_inode* inode, int block, int depth)
 {
     struct buffer_head* bh;
-    unsigned short* p;
-    int i;
+    unsigned long nr;
+    int i, per;
 
     if (!block)
         return;
 
-    if (bh = bread(dev, block))
+    per = ZONES_PER_BLOCK(inode);
+    if (bh = bread_size(inode->i_dev, block, inode->i_blocksize))
     {
-        p = (unsigned short*)bh->data;
-        for (i = 0; i < 512; ++i, ++p)    // 每一个逻辑块上有512个块号
+        for (i = 0; i < per; ++i)    // 1KB的逻辑块上v1有512个块号, v2有256个
         {
-            if (*p)
-                free_block(dev, *p);
+            if (inode->i_version == 2)
+                nr = ((unsigned long*)bh->b_data)[i];
+            else
+                nr = ((unsigned short*)bh->b_data)[i];
+            if (!nr)
+                continue;
+            if (depth > 1)
+                free_ind(inode, nr, depth - 1);
+            else
+                free_block(inode->i_dev, nr);
         }
         brelse(bh);
     }
-    free_block(dev, block);
-}
-
-/**
-  @brief 释放给定设备的指定块上的二次间接块缓冲区,  并且存放二次间接块的block块也会被释放掉的。
-  @param [in] dev 给定的设备号
-  @param [in] block 设备上的指定块, 上面保存了二次间接块的块号。
-  @return 返回空。
-  */
-static void free_dind(int dev, int block)
-{
-    struct buffer_head* bh;
-    unsigned short* p;
-    int i;
-
-    if (!block)
-        return;
-
-    if (bh = bread(dev, block))
-    {
-        p = (unsigned short*)bh->b_data;
-        for (i = 0; i < 512; ++i, ++p)
-        {
-            if (*p)
-                free_ind(dev, *p);
-        }
-        brelse(bh);
-    }
-    free_block(dev, block);
+    free_block(inode->i_dev, block);
 }
 
 /**
@@ -70,6 +51,12 @@ void truncate(struct m_inode* inode)
     if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode)))
         return;
 
+    // 延迟分配的块、预分配的块和缓存的连续映射都不再有效
+    drop_delayed(inode);
+    discard_prealloc(inode);
+    inode->i_run_len = 0;
+    inode->i_goal = 0;
+
     // 释放7个直接块
     for (i = 0; i < 7; ++i)
     {
@@ -80,10 +67,12 @@ void truncate(struct m_inode* inode)
         }
     }
 
-    // 释放间接块
-    free_ind(inode->i_dev, inode->i_zone[7]);
-    free_dind(inode->i_dev, inode->i_zone[8]);
-    inode->i_zone[7] = inode->i_zone[8] = 0;
+    // 释放一次、二次和三次间接块
+    for (i = 7; i < 10; ++i)
+    {
+        free_ind(inode, inode->i_zone[i], i - 6);
+        inode->i_zone[i] = 0;
+    }
 
     inode->i_size = 0;
     inode->i_dirt = 1;
@@ -18,7 +18,7 @@ extern inline unsigned char get_fs_byte(const char* addr)
 * @param [in] addr 段内的偏移地址
 * @return 返回一个字
 */
-extern inline unsigned char get_fs_word(const unsigned short* addr)
+extern inline unsigned short get_fs_word(const unsigned short* addr)
 {
 	unsigned short _v;
 	__asm__("movw %%fs:%1, %0"
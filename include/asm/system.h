@@ -22,6 +22,7 @@ __asm__("movl %%esp, %%eax\n\t"                                 \
 #define cli() __asm__("cli"::)            // 关中断
 #define nop() __asm__("nop"::)        
 #define iret() __asm__("iret"::)
+#define rdtscll(val) __asm__ __volatile__("rdtsc" : "=A" (val))   // 读取64位的时间戳计数器(CPU周期数), 只能在has_tsc时使用
 
 /** \brief 设置门描述符的宏, 需要了解一下门描述符才行
 * @param [in] gate_addr 描述符的地址
@@ -30,28 +30,44 @@ void buffer_init(long buffer_end);
 #define MAJOR(a) (((unsigned)(a)) >> 8)        // 主设备号存放在高字节
 #define MINOR(a) ((a) & 0xff)                  // 次设备号存放在低字节
 
-#define NAME_LEN 14
+#define NAME_LEN 14                // MINIX v1文件系统的名字长度
+#define NAME_LEN_30 30             // 30字符名字的文件系统的名字长度, 也是内核中名字缓冲区的大小
 #define ROOT_INO 1
 
 #define I_MAP_SLOTS 8
-#define Z_MAP_SLOTS 8
-#define SUPER_MAGIC 0x137F
+#define Z_MAP_SLOTS 64             // v2文件系统的逻辑块可以多达64 * 8192个
+#define SUPER_MAGIC 0x137F         // MINIX v1, 14字符名字
+#define SUPER_MAGIC_30 0x138F      // MINIX v1, 30字符名字
+#define SUPER_MAGIC_V2 0x2468      // MINIX v2(32位逻辑块号), 14字符名字
+#define SUPER_MAGIC_V2_30 0x2478   // MINIX v2, 30字符名字
 
 #define NR_OPEN 20
-#define NR_INODE 32
+#define NR_INODE 32                // 静态inode表的项数, 也是inode缓存的初始大小
+#define NR_INODE_MAX 512           // inode缓存最多可以增长到的项数, 超出部分按页从内存中申请
+#define NR_IHASH 64                // inode哈希表的桶数, 必须是2的幂
 #define NR_FILE 64
 #define NR_SUPER 8
 #define NR_HASH 307
 #define NR_BUFFERS nr_buffers
 #define BLOCK_SIZE 1024
 #define BLOCK_SIZE_BITS 10
+#define BLOCK_SIZE_MAX 4096        // 文件系统逻辑块(zone)最大4KB, 即s_log_zone_size最大为2
 
 #ifndef NULL
 #define NULL ((void*)0)
 #endif
 
 #define INODES_PER_BLOCK ((BLOCK_SIZE) / (sizeof (struct d_inode)))
-#define DIR_PER_BLOCK ((BLOCK_SIZE) / (sizeof (struct dir_entry)))
+#define V2_INODES_PER_BLOCK ((BLOCK_SIZE) / (sizeof (struct d2_inode)))
+
+// 目录项的大小由文件系统的名字长度决定(16或32字节), 不能使用sizeof(struct dir_entry)。
+#define DIR_SIZE(dir) ((dir)->i_namelen + 2)
+#define DIR_ENTRIES_PER_BLOCK(dir) ((dir)->i_blocksize / DIR_SIZE(dir))
+#define DIR_ENTRY(dir, bh, n) ((struct dir_entry*)((bh)->b_data + (n) * DIR_SIZE(dir)))
+#define NEXT_DIR_ENTRY(dir, de) ((struct dir_entry*)((char*)(de) + DIR_SIZE(dir)))
+
+// 间接块中每一项的大小: v1是16位的逻辑块号, v2是32位的
+#define ZONES_PER_BLOCK(inode) ((inode)->i_version == 2 ? (inode)->i_blocksize / 4 : (inode)->i_blocksize / 2)
 
 #define PIPE_HEAD(inode) ((inode).i_zone[0])
 #define PIPE_TAIL(inode) ((inode).i_zone[1])
@@ -67,10 +83,13 @@ struct buffer_head
     char* b_data;
     unsigned long b_blocknr;
     unsigned short b_dev;
+    unsigned short b_size;               // 数据区的字节数: 1024, 2048或4096, 块号以它为单位
     unsigned char b_uptodate;
     unsigned char b_dirt;
     unsigned char b_count;
     unsigned char b_lock;
+    unsigned char b_journal;             // 在日志的运行事务中, 提交之前不能写回原位置, 见fs/journal.c
+    struct buffer_head* b_delay_next;    // 延迟分配的缓冲块: inode的i_delay链表中的下一项, 见fs/inode.c
     struct task_struct* b_wait;
     struct buffer_head* b_prev;
     struct buffer_head* b_next;
@@ -89,15 +108,33 @@ struct d_inode
     unsigned short i_zone[9];
 };
 
+// MINIX v2的磁盘inode: 32位的逻辑块号, 7个直接块, 一次、二次和三次间接块各一个
+struct d2_inode
+{
+    unsigned short i_mode;
+    unsigned short i_nlinks;
+    unsigned short i_uid;
+    unsigned short i_gid;
+    unsigned long i_size;
+    unsigned long i_atime;
+    unsigned long i_mtime;
+    unsigned long i_ctime;
+    unsigned long i_zone[10];
+};
+
+// 内存中的inode与磁盘格式无关, read_inode()/write_inode()负责与d_inode或d2_inode相互转换。
 struct m_inode
 {
     unsigned short i_mode;
     unsigned short i_uid;
     unsigned long i_size;                // 文件的字节数
-    unsigned long i_time;
-    unsigned char i_gid;
-    unsigned char i_nlinks;
-    unsigned short i_zone[9];
+    unsigned long i_time;                // 修改时间
+    unsigned short i_gid;
+    unsigned short i_nlinks;
+    unsigned long i_zone[10];            // v1只使用前9项
+    unsigned char i_version;             // 所在文件系统的版本: 1或2
+    unsigned char i_namelen;             // 目录项中名字的长度: 14或30
+    unsigned short i_blocksize;          // 所在文件系统逻辑块的字节数, 数据块和间接块都按它读写
 
     struct task_struct* i_wait;
     unsigned long i_atime;
@@ -111,6 +148,18 @@ struct m_inode
     unsigned char i_mount;
     unsigned char i_seek;
     unsigned char i_update;
+    struct m_inode* i_next;              // 内存中所有inode组成的链表
+    struct m_inode* i_hash_next;         // (i_dev, i_num)哈希链表中的下一项
+    struct m_inode** i_hash_pprev;       // 指向哈希链表中前一项的i_hash_next, 为NULL表示不在哈希表中
+    unsigned long i_free_hint;           // 目录: 该序号之前的目录项都在使用, add_entry()从这里开始找空闲项
+    unsigned long i_goal;                // 下一次为该inode分配逻辑块时优先尝试的块号, 使文件的数据块尽量连续
+    unsigned long i_prealloc_block;      // 预分配窗口: 为该文件预留的、还没有映射到文件中的第一个逻辑块(位图中是空闲的)
+    unsigned short i_prealloc_count;     // 预分配窗口中剩下的块数
+    unsigned short i_run_len;            // 缓存的连续映射: 文件块i_run_lblock开始的i_run_len块
+    unsigned long i_run_lblock;          // 依次对应磁盘上从i_run_pblock开始的逻辑块, 见bmap()
+    unsigned long i_run_pblock;
+    struct buffer_head* i_delay;         // 延迟分配: 还没有分配逻辑块的数据所在的缓冲块, 按文件块号排序
+    unsigned short i_ndelay;             // i_delay链表的长度, 这些块在超级块中预留, 写回前才真正分配
 };
 
 struct file
@@ -132,6 +181,8 @@ struct d_super_block
     unsigned short s_log_zone_size;
     unsigned long s_max_size;
     unsigned short s_magic;
+    unsigned short s_state;
+    unsigned long s_zones;               // v2: 逻辑块总数, 代替16位的s_nzones
 };
 
 struct super_block
@@ -144,9 +195,15 @@ struct super_block
     unsigned short s_log_zone_size;
     unsigned long s_max_size;
     unsigned short s_magic;
+    unsigned short s_state;
+    unsigned long s_zones;               // 逻辑块总数, v1文件系统由read_super()从s_nzones得到
 
-    struct buffer_head* s_imap[8];
-    struct buffer_head* s_zmap[8];
+    unsigned char s_version;             // 1或2, 由s_magic决定
+    unsigned char s_namelen;             // 14或30
+    unsigned short s_inodes_per_block;
+    unsigned short s_blocksize;          // 逻辑块(zone)的字节数: BLOCK_SIZE << s_log_zone_size
+    struct buffer_head* s_imap[I_MAP_SLOTS];
+    struct buffer_head* s_zmap[Z_MAP_SLOTS];
     unsigned short s_dev;
     struct m_inode* s_isup;
     struct m_inode* s_imount;
@@ -155,18 +212,95 @@ struct super_block
     unsigned char s_locck;
     unsigned char s_rd_only;
     unsigned char s_dirt;
+    // 以下用于加快位图的分配, 见fs/bitmap.c。 s_counted为0时空闲计数还没有统计。
+    unsigned char s_counted;
+    unsigned char s_zcur;                    // 上一次分配逻辑块所在的位图块
+    unsigned char s_icur;                    // 上一次分配inode所在的位图块
+    unsigned short s_zfree[Z_MAP_SLOTS];     // 每个逻辑块位图块中空闲位的个数
+    unsigned short s_ifree[I_MAP_SLOTS];     // 每个inode位图块中空闲位的个数
+    unsigned short s_zlast[Z_MAP_SLOTS];     // 每个逻辑块位图块的轮转指针: 上一次分配的位置之后
+    unsigned short s_ilast[I_MAP_SLOTS];     // 每个inode位图块的轮转指针
+    long s_zreserved;                        // 为延迟分配的数据块预留的块数, 位图中还是空闲的
+};
+
+// 日志区的位置, 保存在超级块所在块的JOURNAL_INFO_OFFSET处(MINIX超级块后面没有使用的部分)。
+// 日志区是一段在位图中标记为已使用的连续逻辑块, 单位是文件系统的逻辑块。
+#define JOURNAL_MAGIC 0x4a4e4c31
+#define JOURNAL_INFO_OFFSET 512
+// 一个修改元数据的操作开始时为它预留的日志块数(见journal_start()): 一般的操作, 以及可能释放一个文件
+// 所有逻辑块的操作(位图块最多Z_MAP_SLOTS个)。
+#define J_CREDITS 16
+#define J_TRUNC_CREDITS (Z_MAP_SLOTS + J_CREDITS)
+
+struct d_journal_info
+{
+    unsigned long j_magic;               // JOURNAL_MAGIC, 不是时该文件系统没有日志
+    unsigned long j_start;               // 日志区第一块的逻辑块号
+    unsigned long j_len;                 // 日志区的块数
 };
 
 struct dir_entry
 {
     unsigned short inode;
-    char name[NAME_LEN];
+    char name[NAME_LEN_30];              // 实际长度是目录所在文件系统的名字长度, 见DIR_SIZE()
 };
 
 extern struct m_inode inode_table[NR_INODE];
+extern struct m_inode* inode_list;
+extern void clear_inode(struct m_inode* inode);
+extern void insert_inode_hash(struct m_inode* inode);
+extern void sync_inodes_dev(int dev);
+extern void discard_prealloc(struct m_inode* inode);
+// 延迟分配, 见fs/inode.c; 块的预留见fs/bitmap.c
+extern struct buffer_head* delay_getblk(struct m_inode* inode, int lblock);
+extern void delay_release(struct m_inode* inode, struct buffer_head* bh);
+extern struct buffer_head* delay_find(struct m_inode* inode, int lblock);
+extern void flush_delayed(struct m_inode* inode);
+extern void sync_delayed(int dev);
+extern void drop_delayed(struct m_inode* inode);
+extern int reserve_block(int dev, int n);
+extern void unreserve_blocks(int dev, int n);
 extern struct file file_table[NR_FILE];
 extern struct super_block super_blocks[NR_SUPER];
 extern struct buffer_head* start_buffer;
 extern int nr_buffers;
+// 按指定大小读写高速缓冲块, getblk()/bread()/get_hash_table()是size为BLOCK_SIZE的特例, 见fs/buffer.c
+extern struct buffer_head* get_hash_table_size(int dev, int block, int size);
+extern struct buffer_head* getblk_size(int dev, int block, int size);
+extern struct buffer_head* bread_size(int dev, int block, int size);
+extern int buffer_supply(int size);
+
+// 目录项缓存, 见fs/dcache.c
+extern int dcache_lookup(int dev, int dir, const char* name, int len);
+extern unsigned long dcache_generation(void);
+extern void dcache_add(int dev, int dir, const char* name, int len, int ino, unsigned long gen);
+extern void dcache_invalidate(int dev, int dir, const char* name, int len);
+extern void dcache_purge(int dev, int dir);
+
+// 元数据日志, 见fs/journal.c
+extern void journal_load(struct super_block* sb, struct d_journal_info* info);
+extern void journal_release(int dev);
+extern void journal_abort(int dev);
+extern void journal_start(int dev, int credits);
+extern void journal_stop(int dev, int credits);
+extern int journal_defer(int dev);
+extern void journal_dirty(struct buffer_head* bh);
+extern void journal_forget(struct buffer_head* bh);
+extern void journal_freed(int dev);
+extern int journal_commit(int dev);
+extern void journal_commit_all(void);
+
+// 大目录的哈希索引, 见fs/dindex.c
+struct dir_index;
+extern unsigned long dindex_hash(const char* name, int len);
+extern struct dir_index* dindex_get(int dev, int ino, int building);
+extern struct dir_index* dindex_new(int dev, int ino);
+extern void dindex_ready(struct dir_index* d);
+extern void dindex_put(struct dir_index* d);
+extern void dindex_drop(struct dir_index* d);
+extern void dindex_purge(int dev, int ino);
+extern int dindex_insert(struct dir_index* d, unsigned long hash, int slot);
+extern void dindex_remove(struct dir_index* d, unsigned long hash, int slot);
+extern int dindex_next(struct dir_index* d, unsigned long hash, int slot);
 
 #endif // _FS_H
@@ -0,0 +1,18 @@
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+/* futex(uaddr, op, val)系统调用的操作。
+
+   futex只负责睡眠和唤醒，锁本身是用户空间中的一个整数, 由用户程序用原子指令(例如lock; cmpxchg)
+   修改。 没有竞争的时候加锁和解锁只是一条原子指令, 根本不进入内核; 只有加锁失败需要等待或者解锁时
+   发现有等待者时才调用futex(). 例如一个简单的互斥锁(0: 未加锁, 1: 已加锁, 2: 已加锁并且可能有等待者):
+       加锁: if (cmpxchg(&lock, 0, 1) != 0)
+                 while (xchg(&lock, 2) != 0)
+                     futex(&lock, FUTEX_WAIT, 2);
+       解锁: if (xchg(&lock, 0) == 2)
+                 futex(&lock, FUTEX_WAKE, 1);
+*/
+#define FUTEX_WAIT 0        // 如果*uaddr == val, 睡眠等待FUTEX_WAKE; 否则返回-EAGAIN
+#define FUTEX_WAKE 1        // 最多唤醒val个在uaddr上等待的进程，返回唤醒的个数
+
+#endif // _FUTEX_H
@@ -0,0 +1,32 @@
+#ifndef _IORING_H
+#define _IORING_H
+
+/* io_submit()系统调用使用的提交环。
+
+   环在用户空间中: 用户程序把请求依次填入sqes[tail & mask], 然后增加tail; 内核从head开始执行
+   到tail为止，把每一个请求的返回值写入它的res中(完成)，并推进head. 一次io_submit()可以执行
+   一批请求，只需要一次int 0x80. 环的大小(mask + 1)必须是2的幂。
+
+   opcode就是系统调用号，只支持__NR_read/__NR_write/__NR_lseek/__NR_open/__NR_close,
+   arg[0]~arg[2]与对应的系统调用的参数相同。
+*/
+
+#define IORING_STOP_ON_ERR 1        // flags: 某个请求出错(res < 0)时停止执行后面的请求
+
+struct io_sqe
+{
+	long opcode;
+	long arg[3];
+	long res;                       // 由内核写入的返回值
+};
+
+struct io_ring
+{
+	unsigned long head;             // 内核已经执行到的位置, 由内核修改
+	unsigned long tail;             // 用户已经提交到的位置, 由用户修改
+	unsigned long mask;             // 环的大小减1
+	unsigned long flags;            // IORING_xxx
+	struct io_sqe* sqes;
+};
+
+#endif // _IORING_H
@@ -0,0 +1,74 @@
+#ifndef _KSTAT_H
+#define _KSTAT_H
+
+/* kstat字符设备(主设备号8)导出的内核统计信息。 每一个次设备号对应一种记录，读取时返回的是一个
+   由定长记录组成的数组，文件位置pos就是数组内的字节偏移, 所以可以用lseek()定位到第n条记录。 */
+#define KSTAT_MAJOR 8
+
+#define KSTAT_TASKS 0               // 每一个任务槽一条kstat_task记录, 共NR_TASKS条
+#define KSTAT_SYSCALLS 1            // 每一个系统调用号一条kstat_syscall记录, 共NR_SYSCALLS条
+#define KSTAT_TRACE 2               // 事件跟踪缓冲区, 从旧到新TRACE_SIZE条trace_entry记录(见linux/trace.h)
+#define KSTAT_PROFILE 3             // 内核代码的采样直方图, PROF_LEN条kstat_prof记录(见linux/profile.h)
+#define KSTAT_FPU 4                 // 协处理器的统计, 只有一条kstat_fpu记录
+
+// 系统调用的个数上限, 必须不小于system_call.s中的nr_system_calls
+#define NR_SYSCALLS 96
+
+// 系统调用延时直方图: 第i个桶记录耗时在[2^(i+SHIFT), 2^(i+SHIFT+1))个周期内的调用次数,
+// 第0个桶还包括更短的调用，最后一个桶还包括更长的调用。
+#define KSTAT_HIST_BUCKETS 16
+#define KSTAT_HIST_SHIFT 7
+
+// 次设备号0中的记录, 对应task数组中的一个任务槽。 槽为空时pid为-1.
+struct kstat_task
+{
+	long pid;
+	long father;
+	long state;
+	long policy;
+	long counter;
+	long utime;                     // 用户态运行的滴答数
+	long stime;                     // 内核态运行的滴答数
+	unsigned long long cycles;      // 累计运行的CPU周期数
+	long nvcsw;                     // 主动切换次数
+	long nivcsw;                    // 被动切换次数
+	long min_flt;
+	long maj_flt;
+	long blk_reads;
+	long blk_writes;
+	long sleep_time;                // 睡眠的总滴答数
+	long fpu_loads;                 // 获得协处理器的次数
+};
+
+// 次设备号1中的记录, 对应一个系统调用号。 耗时是从进入_system_call到系统调用函数返回之间的周期数,
+// 包括了在系统调用中睡眠的时间。
+struct kstat_syscall
+{
+	long nr;                        // 系统调用号
+	long count;                     // 调用次数
+	unsigned long long cycles;      // 累计耗时
+	long hist[KSTAT_HIST_BUCKETS];  // 耗时的直方图
+};
+
+extern struct kstat_syscall syscall_stats[NR_SYSCALLS];
+
+// 次设备号3中的记录, 对应内核代码中从addr开始的(1 << PROF_SHIFT)个字节
+struct kstat_prof
+{
+	unsigned long addr;
+	unsigned long hits;             // 时钟中断落在这一段代码中的次数
+};
+
+// 次设备号4中的记录。 loads是协处理器的所有权转移的次数, 即lazy FPU真正需要切换的次数。
+struct kstat_fpu
+{
+	long fxsr;                      // 是否使用fxsave/fxrstor
+	long sse;                       // 是否为用户态打开了SSE
+	long loads;                     // math_state_restore()中把协处理器交给当前进程的次数
+	long saves;                     // 保存协处理器状态的次数
+	long inits;                     // 进程第一次使用协处理器时初始化的次数
+};
+
+extern struct kstat_fpu fpu_stats;
+
+#endif // _KSTAT_H
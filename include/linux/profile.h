@@ -0,0 +1,31 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+/* 基于时钟中断的采样分析。
+
+   内核态: 每一次时钟中断落在内核代码中时，总是把被中断的eip记入prof_buffer, 每一个计数器对应
+   (1 << PROF_SHIFT)个字节的代码, 通过kstat设备的次设备号3(KSTAT_PROFILE)读取, 与System.map
+   对照就可以找出内核的热点。
+   用户态: 进程调用profil()设置了prof_param之后，时钟中断落在用户态时, 把
+   ((eip - offset) * scale) >> 16 作为buf中的字节偏移，对应的unsigned short计数加1. scale为
+   0x10000时每两个字节的代码对应一个计数器。 scale为0时停止采样。 系统调用最多只能传递3个参数,
+   所以这4个参数放在一个结构中传递。 */
+
+#define PROF_SHIFT 4                        // 每一个计数器对应16字节的内核代码
+#define PROF_TEXT_SIZE 0x30000              // 内核代码的最大长度(与boot中的SYSSIZE相当)
+#define PROF_LEN (PROF_TEXT_SIZE >> PROF_SHIFT)
+
+struct prof_param
+{
+	unsigned short* buf;                    // 用户空间中的计数器数组
+	unsigned long size;                     // buf的字节数
+	unsigned long offset;                   // 采样的代码起始地址
+	unsigned long scale;                    // 缩放比例, 为0时停止采样
+};
+
+extern unsigned long prof_buffer[PROF_LEN];
+
+extern void profile_tick(long cpl, unsigned long eip);
+extern void profile_flush(void);
+
+#endif // _PROFILE_H
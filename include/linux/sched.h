@@ -22,6 +22,30 @@
 #define TASK_ZOMBIE 3                 // 进程处于僵死状态
 #define TASK_STOPPED 4                // 进程已经停止。
 
+// 调度策略: SCHED_OTHER为原来基于counter的普通分时策略，SCHED_FIFO和SCHED_RR为实时策略。
+#define SCHED_OTHER 0                 // 普通进程
+#define SCHED_FIFO 1                  // 实时进程, 先进先出, 没有时间片, 只有更高优先级的实时进程才能抢占它
+#define SCHED_RR 2                    // 实时进程, 时间片轮转, 时间片用完之后让给同优先级的其它实时进程
+#define MAX_RT_PRIO 99                // 实时进程的最大静态优先级, 实时优先级的范围为1~99
+
+// 进程的标志(task_struct中的flags)
+#define PF_VFORK 0x00000001           // vfork()创建的子进程, 还在使用父进程的地址空间
+#define PF_JCOMMIT 0x00000002         // 正在提交一个文件系统的日志, 见fs/journal.c
+#define PF_RESERVED 0x00000004        // 正在为延迟分配的块分配逻辑块, 可以使用已经预留的块, 见fs/bitmap.c
+
+// 创建进程时的选项, copy_process()的第一个参数
+#define CLONE_VM 0x00000100           // 共享地址空间(线性地址空间和页表)
+#define CLONE_FS 0x00000200           // 共享当前目录、根目录和umask
+#define CLONE_FILES 0x00000400        // 共享打开的文件表
+#define CLONE_SIGHAND 0x00000800      // 共享信号处理函数, 要求同时指定CLONE_VM
+#define CLONE_VFORK 0x00004000        // 父进程睡眠直到子进程exec或者退出, vfork()为CLONE_VM | CLONE_VFORK
+
+// sched_setscheduler()系统调用使用的参数结构
+struct sched_param
+{
+	int sched_priority;
+};
+
 #ifdef NULL
 #define NULL ((void*)0)
 #endif
@@ -29,6 +53,10 @@
 // 声明一些在其它地方定义的函数名
 extern int copy_page_tables(unsigned long from, unsigned long to, unsigned long size);
 extern int free_page_tables(unsigned long from, unsigned long size);
+extern void mm_release(void);
+extern int exec_mmap(void);
+extern void signal_wake_up(struct task_struct* p, int sig);
+extern void flush_sigqueue(struct task_struct* p);
 extern void sched_init(void);
 extern void schedule(void);
 extern void trap_init(void);
@@ -51,7 +79,33 @@ struct i387_struct
 	long st_space[20]; 
 };
 
-// TSS数据结构, 用于任务切换时保存现场的寄存器的值。
+// fxsave/fxrstor使用的512字节的保存区, 包括SSE的XMM寄存器和MXCSR. 必须16字节对齐。
+struct i387_fxsave_struct
+{
+	unsigned short cwd;
+	unsigned short swd;
+	unsigned short twd;
+	unsigned short fop;
+	long fip;
+	long fcs;
+	long foo;
+	long fos;
+	long mxcsr;
+	long mxcsr_mask;
+	long st_space[32];          // 8个浮点寄存器, 每个16字节
+	long xmm_space[32];         // 8个XMM寄存器, 每个16字节
+	long padding[56];
+} __attribute__((aligned(16)));
+
+// CPU支持fxsave时(fpu_fxsr)使用fxsave, 否则使用fsave.
+union i387_union
+{
+	struct i387_struct fsave;
+	struct i387_fxsave_struct fxsave;
+};
+
+// TSS数据结构。 现在不再使用硬件任务切换，整个系统只有一个TSS(init_tss), 它只用于在特权级变化时
+// 为CPU提供内核栈的位置(ss0:esp0), 每次进程切换时更新其中的esp0.
 struct tss_struct
 {
 	long back_link;
@@ -77,9 +131,56 @@ struct tss_struct
 	long gs;
 	long ldt;
 	long trace_bitmap;
-	struct i387_struct i387;    // 上面定义的数学协处理器的数据结构
 };
 
+// 进程切换时需要保存的上下文。 其它的寄存器都在switch_to()中压入了该进程自己的内核栈中，
+// 这里只需要保存内核栈指针和恢复运行的位置即可。 注意：switch_to()中的汇编代码依赖于esp0/esp/eip
+// 三个成员的偏移量(0/4/8).
+struct thread_struct
+{
+	long esp0;                  // 内核栈的栈顶, 切换到该进程时写入init_tss.esp0
+	long esp;                   // 切换出去时的内核栈指针
+	long eip;                   // 切换回来时开始执行的位置
+	union i387_union i387;      // 协处理器的状态, 只有在被其它进程抢走协处理器时才保存
+};
+
+// 进程打开的文件表, clone()时指定CLONE_FILES则由多个进程共享
+struct files_struct
+{
+	int count;                      // 共享该结构的进程数
+	unsigned long close_on_exec;    // 执行exec时需要关闭的文件描述符的位图
+	struct file* fd[NR_OPEN];       // 进程的文件表结构
+};
+
+// 进程的文件系统信息, clone()时指定CLONE_FS则由多个进程共享
+struct fs_struct
+{
+	int count;
+	unsigned short umask;           // 文件创建属性的屏蔽位
+	struct m_inode* pwd;            // 当前工作目录
+	struct m_inode* root;           // 根目录
+};
+
+// 进程的信号处理函数表, clone()时指定CLONE_SIGHAND则由多个进程共享
+struct signal_struct
+{
+	int count;
+	struct sigaction action[32];    // 与32个信号对应的结构， signal action.
+};
+
+// 排队的实时信号(SIGRTMIN~SIGRTMAX), 同一个信号发送多次时每一次都会被递送，并且带有一个值
+struct sigqueue
+{
+	struct sigqueue* next;
+	int signo;                      // 为0时表示该项空闲
+	long value;                     // sigqueue()发送的值, 作为SA_SIGINFO信号处理函数的第二个参数
+	long pid;                       // 发送者的pid
+};
+
+#define INIT_FILES {1, 0, {NULL,}}
+#define INIT_FS {1, 0022, NULL, NULL}
+#define INIT_SIGNALS {1, {{},}}
+
 // 进程描述符的数据结构
 struct task_struct
 {
@@ -88,8 +189,20 @@ struct task_struct
 	long priority;                  // 运行的优先数， 用于进程调度时
 
 	long signal;                    // 信号，每一个比特表示一种信号。
-	struct sigaction sigaction[32]; // 与32个信号对应的结构， signal action.
-	long blocked;                   // 进程信号的屏蔽码
+	struct signal_struct* sig;      // 信号处理函数表
+	long blocked;                   // 进程信号的屏蔽码. 注意：system_call.s中使用了它的偏移量
+	struct sigqueue* sigq;          // 按照发送顺序排队的实时信号
+	long sc_nr;                     // 正在执行的系统调用号, 以下两个成员在_system_call中设置, 注意它们的偏移量
+	unsigned long long sc_stamp;    // 进入系统调用时的时间戳
+	unsigned long prof_pending;     // 时钟中断中没有能写入的用户态采样数, 返回用户态之前写入, 注意它的偏移量
+
+	long policy;                    // 调度策略, SCHED_OTHER/SCHED_FIFO/SCHED_RR
+	long rt_priority;               // 实时进程的静态优先级(1~99), 普通进程为0
+	long preempt_count;             // 当前进程持有的锁(inode锁/超级块锁)的个数, 不为0时在抢占点上不会被抢占
+	long journal_depth;             // 嵌套的journal_start()层数, 不为0时正在进行一个文件系统的元数据操作
+	long journal_dev;               // 最外层的journal_start()的设备号
+	unsigned long flags;            // 进程的标志, PF_xxx
+	struct task_struct* vfork_wait; // vfork()的父进程在这里等待子进程exec或者退出
 
 	int exit_code;
 	unsigned long start_code;       // 表示代码段的起始地址。
@@ -97,12 +210,25 @@ struct task_struct
 	unsigned long end_data;         // 注意：它表示的是代码长度 + 数据长度(字节数)
 	unsigned long brk;              // 总长度.  brk 是什么英文字母呢？？？
 	unsigned long start_stack;      // 栈的开始地址
+	long mm_slot;                   // 使用的是哪一个任务槽对应的64M线性地址空间, clone(CLONE_VM)时与父进程相同
 
 	long pid;                       // 
 	long father;                    // 父进程的pid
 	long pgrp;                      // 进程组号
 	long session;                   // 会话号
 	long leader;                    // 会话首领
+	struct task_struct* pidhash_next;   // pid哈希表中同一个链表上的下一个进程
+	struct task_struct** pidhash_pprev; // 指向前一个节点中pidhash_next成员(或者链表头)的指针, 用于O(1)的删除
+	// 进程之间的亲属关系, father中仍然保存着父进程的pid.
+	struct task_struct* p_pptr;     // 父进程
+	struct task_struct* p_cptr;     // 最年轻的子进程
+	struct task_struct* p_ysptr;    // 比自己年轻的兄弟进程(younger sibling)
+	struct task_struct* p_osptr;    // 比自己年老的兄弟进程(older sibling)
+	// 同一个进程组/会话的进程链表(按照pgrp/session号哈希)
+	struct task_struct* pg_next;
+	struct task_struct** pg_pprev;
+	struct task_struct* sess_next;
+	struct task_struct** sess_pprev;
 
 	unsigned short uid;             // 用户标志号
 	unsigned short euid;            // effective uid
@@ -117,46 +243,83 @@ struct task_struct
 	long cutime;                    // child user time, 子进程用户态的运行时间
 	long cstime;                    // child system time, 子进程系统态的运行时间
 	long start_time;                // 进程开始运行时间
+	// profil()设置的用户态采样参数(见kernel/profile.c), prof_scale为0时不采样
+	unsigned short* prof_buf;
+	unsigned long prof_size;
+	unsigned long prof_off;
+	unsigned long prof_scale;
+	unsigned short* prof_pend_buf;  // prof_pending个采样对应的计数器
+
+	// 以下为更精确的统计信息, 通过kstat字符设备(见kernel/chr_drv/kstat.c)读取。
+	unsigned long long cycles;      // 累计运行的CPU周期数, 在进程切换时用rdtsc计算
+	unsigned long long switch_stamp;// 最近一次切换到该进程时的时间戳
+	long nvcsw;                     // 主动让出CPU的次数(睡眠、等待)
+	long nivcsw;                    // 被动让出CPU的次数(时间片用完、被抢占)
+	long min_flt;                   // 不需要读磁盘的缺页/写保护异常次数
+	long maj_flt;                   // 需要从可执行文件读入页面的缺页次数
+	long blk_reads;                 // 通过ll_rw_block发出的读块请求数
+	long blk_writes;                // 通过ll_rw_block发出的写块请求数
+	long sleep_time;                // 在sleep_on/interruptible_sleep_on中睡眠的总滴答数
+	long fpu_loads;                 // 在math_state_restore()中获得协处理器的次数
 
 	unsigned short used_math;       // 标志，是否使用了数学协处理器。
 	int tty;                        // 进程使用的tty的子设备号， -1表示没有使用。
 
-	unsigned short umask;           // 文件创建属性的屏蔽位
-	struct m_inode* pwd;
-	struct m_inode* root;
+	struct fs_struct* fs;           // 当前目录/根目录/umask
 	struct m_inode* executable;
-	unsigned long close_on_exec;   // 什么东西？
-	struct file* filp[NR_OPEN];    // 进程的文件表结构
+	struct files_struct* files;     // 打开的文件表
 
 	struct desc_struct ldt[3];     // 本进程的局部描述符， 0为空，1为代码段，2为数据段和堆栈段
-	struct tss_struct tss;
+	struct thread_struct thread;   // 进程切换时保存的上下文
 };
 
 // 初始化任务0的数据结构
 #define INIT_TASK {                                                            \
 	0, 15, 15,                                                                 \
-	0, {{},}, 0,                                                               \
-	0, 0, 0, 0, 0, 0,                                                          \
-	0, -1, 0, 0, 0,                                                            \
-	0, 0, 0, 0, 0, 0,                                                          \
+	0, &init_signals, 0, NULL, 0, 0, 0,                                        \
+	SCHED_OTHER, 0, 0, 0, 0, 0, NULL,                                          \
+	0, 0, 0, 0, 0, 0, 0,                                                       \
+	0, -1, 0, 0, 0, NULL, NULL,                                                \
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,                            \
 	0, 0, 0, 0, 0, 0,                                                          \
+	0, 0, 0, 0, 0, 0, NULL, 0, 0, 0, NULL,                                     \
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0,                                              \
 	0, -1,                                                                     \
-	0022, NULL, NULL, NULL, 0, {NULL,},                                        \
+	&init_fs, NULL, &init_files,                                               \
 	{{0, 0}, {0x9f, 0xc0fa00}, {0x9f, 0xc0f200},},                             \
-	{0, PAGE_SIZE + (long)&init_task, 0x10, 0, 0, 0, 0, (long)&pg_dir,         \
-	 0, 0, 0, 0, 0, 0, 0, 0,                                                   \
-     0, 0, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17,                                 \
-	 _LDT(0), 0x80000000,                                                      \
-	 {},                                                                       \
-	},                                                                         \
+	{PAGE_SIZE + (long)&init_task, 0, 0, {},},                                 \
+}
+
+// 初始化全局唯一的TSS, 开始时使用任务0的内核栈
+#define INIT_TSS {                                                             \
+	0, PAGE_SIZE + (long)&init_task, 0x10, 0, 0, 0, 0, (long)&pg_dir,          \
+	0, 0, 0, 0, 0, 0, 0, 0,                                                    \
+	0, 0, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17,                                  \
+	_LDT, 0x80000000,                                                          \
 }
 
 // 声明一些用于任务调度的全部变量
 extern struct task_struct* task[NR_TASKS];        // 保存所有任务中指针数组
 extern struct task_struct* last_task_used_math;
 extern struct task_struct* current;
+extern struct tss_struct init_tss;               // 全局唯一的TSS
+extern int mm_count[NR_TASKS];                   // 每一个任务槽对应的线性地址空间被多少个进程使用着
 extern long volatile jiffies;                    // 滴答数(10ms/ 滴答)
+extern int has_tsc;                              // CPU有时间戳计数器, 386和486没有
+
+// 取统计用的时间戳: 有TSC时是CPU周期数, 否则是jiffies(386/486上执行rdtsc会产生无效指令异常)
+#define read_stamp(val) do {                                                    \
+	if (has_tsc)                                                                \
+		rdtscll(val);                                                           \
+	else                                                                        \
+		(val) = jiffies;                                                        \
+} while (0)
 extern long startup_time;                        // 开机时间，从1970.01.01开始计算的(单位为second)
+extern int need_resched;                         // 置1时表示需要在下一次从内核返回用户态时重新调度
+extern int fpu_fxsr;                             // CPU支持fxsave/fxrstor
+extern int fpu_sse;                              // CPU支持SSE, 并且已经为用户态打开
+extern void save_fpu(struct task_struct* tsk);
+extern void restore_fpu(struct task_struct* tsk);
 
 #define CURRENT_TIME (startup_time + jiffies / HZ)  // HZ就是每秒的滴答数, 文件开始定义的，值为100.
 
@@ -165,45 +328,105 @@ extern void add_timer(long jiffies, void (*fn)(void));
 extern void sleep_on(struct task_struct **p);
 extern void interruptible_sleep_on(struct task_struct **p);
 extern void wake_up(struct task_struct **p);
+extern void cond_resched(void);
+
+// pid哈希表, 用于根据pid快速地查找进程, 不需要再遍历整个task数组。
+#define PIDHASH_SZ (NR_TASKS >> 2)
+#define pid_hashfn(x) ((((x) >> 8) ^ (x)) & (PIDHASH_SZ - 1))
+extern struct task_struct* pidhash[PIDHASH_SZ];
+extern void hash_pid(struct task_struct* p);
+extern void unhash_pid(struct task_struct* p);
+extern struct task_struct* find_task_by_pid(int pid);
+
+// 进程组和会话的哈希表, 同一个链表中可能有不同的进程组/会话，遍历时要比较pgrp/session号。
+extern struct task_struct* pgrphash[PIDHASH_SZ];
+extern struct task_struct* sesshash[PIDHASH_SZ];
+extern void link_pgrp(struct task_struct* p);
+extern void unlink_pgrp(struct task_struct* p);
+extern void link_session(struct task_struct* p);
+extern void unlink_session(struct task_struct* p);
+
+// 把进程p从它父进程的子进程链表中删除
+#define REMOVE_LINKS(p) {                                                 \
+	if ((p)->p_osptr)                                                     \
+		(p)->p_osptr->p_ysptr = (p)->p_ysptr;                             \
+	if ((p)->p_ysptr)                                                     \
+		(p)->p_ysptr->p_osptr = (p)->p_osptr;                             \
+	else                                                                  \
+		(p)->p_pptr->p_cptr = (p)->p_osptr;                               \
+}
+
+// 把进程p作为最年轻的子进程加入到p->p_pptr的子进程链表中
+#define SET_LINKS(p) {                                                    \
+	(p)->p_ysptr = NULL;                                                  \
+	if (((p)->p_osptr = (p)->p_pptr->p_cptr))                             \
+		(p)->p_osptr->p_ysptr = (p);                                      \
+	(p)->p_pptr->p_cptr = (p);                                            \
+}
+
+// 空闲任务槽(task数组中的空项)的栈, 分配和释放任务槽都是O(1)的。
+extern int get_free_taskslot(void);
+extern void put_free_taskslot(int nr);
 
 /* 要知道的是：在GDT中，第0项为空，第1项为内核代码段描述符，第2项为内核数据段描述符，第3段为系统段描述符，
-   第4项为TSS0, 第5项为LDT0, 第6项为TSS1, 第7项为TDT1,....... （每一个任务在GDT中都有两项，一个是TSS描述符，
-   一个是LDT描述符。 */
+   第4项为全局唯一的TSS描述符, 第5项为LDT描述符。 所有进程共用这一个LDT描述符, 进程切换时把它的基地址
+   修改为下一个进程的ldt数组, 然后重新加载ldtr. 这样进程的个数就不再受GDT大小的限制了。 */
 #define FIRST_TSS_ENTRY 4
 #define FIRST_LDT_ENTRY (FIRST_TSS_ENTRY + 1)
-#define _TSS(n) ((((unsigned long)n) << 4) + (FIRST_TSS_ENTRY << 3))        // 第n个任务的tss在GDT中的偏移地址(从第0个任务开始算起)
-#define _LDT(n) ((((unsigned long)n) << 4) + (FIRST_LDT_ENTRY << 3))        // 第n个任务的ldt在GDT中的偏移地址
-
-// 加载第n个任务中任务寄存器
-#define ltr(n) __asm__("ltr %%eax" ::"a" (_TSS(n)))
-// 加载第n个任务中局部描述符表寄存器
-#define lldt(n) __asm__("lldt %%eax" ::"a" (_LDT(n)))
-
-/* 求取当前任务的索引值，即是第几个任务（0,1,2,3，......, 63), 方法是根据当前任务的tss段描述符在gdt中的位置来推断出来。
-   还需要注意的是：该宏命令是给n进行赋值操作的。当你在其它地方使用时，如果不知道它是一个宏而误以为是一个函数时，你可能
-   会很纳闷，为什么传值还可能修改参数的值呢！ */
-#define str(n)                                        \
-__asm__("str %%eax\n\t"                               \
-		"subl %2, %%eax\n\t"                          \
-		"shrl $4, %%eax"                              \
-		:"=a" (n)                                     \
-		:"a" (0), "i" (FIRST_TSS_ENTRY << 3))
-
-/* switch_to(n)实现在进程调度时的任务之间的切换。 有一些地方目前还是不太明白
-   */
-#define switch_to(n) {                                \
-	struct {long a, b} __tmp;                         \
-	__asm__("cmpl %%ecx, _current\n\t"                \
-			"je 1f\n\t"                               \
-			"movw %%dx, %1\n\t"                       \
-			"xchgl %%ecx, _current\n\t"               \
-			"ljmp %0\n\t"                             \ //  跳走了，什么时候回来呢？, 进程的上下文又是在哪里保存的呢？
-			"cmpl %%ecx, _last_task_used_math\n\t"    \
-			"jne 1f\n\t"                              \
-			"clts\n"                                  \
-			"1:"                                      \
-			::"m" (*&__tmp.a), "m" (*&__tmp.b),       \
-			"d" (_TSS(n)), "c" ((long)task[n]));      \
+#define _TSS (FIRST_TSS_ENTRY << 3)        // TSS描述符的选择子
+#define _LDT (FIRST_LDT_ENTRY << 3)        // LDT描述符的选择子
+
+// 加载任务寄存器
+#define ltr() __asm__("ltr %%ax" ::"a" (_TSS))
+// 加载局部描述符表寄存器, 修改了LDT描述符之后也要重新加载才能生效
+#define lldt() __asm__("lldt %%ax" ::"a" (_LDT))
+
+// 清除/设置CR0中的TS标志。 TS置位之后，第一次执行协处理器指令时会产生device_not_available异常,
+// 在math_state_restore()中完成协处理器上下文的切换(lazy FPU).
+#define clts() __asm__("clts")
+#define stts() __asm__("movl %%cr0, %%eax\n\t"      \
+		"orl $8, %%eax\n\t"                          \
+		"movl %%eax, %%cr0"                          \
+		:::"ax")
+
+/* switch_to(n)实现进程之间的切换。 以前使用ljmp到TSS选择子进行硬件任务切换，CPU会保存并恢复整个TSS;
+   现在改为软件切换, 只切换必须的部分：
+   1. 把init_tss.esp0设置为下一个进程的内核栈顶，这样下一个进程从用户态陷入内核时使用自己的内核栈;
+   2. 把GDT中的LDT描述符指向下一个进程的ldt数组并重新加载ldtr;
+   3. 如果下一个进程不是最后使用协处理器的进程，置位TS标志, 保持原来的lazy FPU行为;
+   4. 把ebp和fs/gs压入当前进程的内核栈(eax/ebx/ecx/edx/esi/edi已声明为被破坏，由编译器保存), 保存esp和
+      返回位置(标号1)到prev->thread中，然后切换到下一个进程的内核栈，并跳转到它的thread.eip处。
+   fs/gs在切换回来时重新弹出，这时它们会按照新加载的LDT重新装载段描述符。 新创建的进程第一次运行时,
+   thread.eip指向ret_from_fork(见system_call.s). */
+#define switch_to(n) {                                                \
+	struct task_struct* __prev = current;                             \
+	struct task_struct* __next = task[n];                             \
+	long __d0, __d1;                                                  \
+	if (__prev != __next)                                             \
+	{                                                                 \
+		init_tss.esp0 = __next->thread.esp0;                          \
+		set_ldt_desc(gdt + FIRST_LDT_ENTRY, &(__next->ldt));          \
+		lldt();                                                       \
+		if (__next == last_task_used_math)                            \
+			clts();                                                   \
+		else                                                          \
+			stts();                                                   \
+		current = __next;                                             \
+		__asm__ __volatile__("pushl %%ebp\n\t"                        \
+				"push %%fs\n\t"                                       \
+				"push %%gs\n\t"                                       \
+				"movl %%esp, 4(%%eax)\n\t"                            \
+				"movl $1f, 8(%%eax)\n\t"                              \
+				"movl 4(%%edx), %%esp\n\t"                            \
+				"pushl 8(%%edx)\n\t"                                  \
+				"ret\n"                                               \
+				"1:\tpop %%gs\n\t"                                    \
+				"pop %%fs\n\t"                                        \
+				"popl %%ebp"                                          \
+				:"=a" (__d0), "=d" (__d1)                             \
+				:"0" (&__prev->thread), "1" (&__next->thread)         \
+				:"bx", "cx", "si", "di", "memory");                   \
+	}                                                                 \
 }
 
 // 页面地址对准(4kb对齐)
@@ -0,0 +1,39 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/* 内核事件跟踪。 各个跟踪点调用trace_event()把事件写入一个全局的环形缓冲区, 缓冲区满了之后覆盖
+   最旧的记录。 通过kstat设备的次设备号2(KSTAT_TRACE)读取，按照从旧到新的顺序返回TRACE_SIZE条记录。
+   两次read()之间可能写入了新的记录，所以最好一次读取整个缓冲区, 并用seq检查记录是否连续。 */
+
+#define TRACE_SIZE 1024             // 环形缓冲区的记录数, 必须是2的幂
+
+// 事件类型, 以及每一种事件的参数a/b/c
+#define TRACE_NONE      0           // 空记录(开机之后还没有写到该位置)
+#define TRACE_SWITCH    1           // 进程切换: a = 切换到的进程的pid, b = 切换出去的进程的state
+#define TRACE_SLEEP     2           // sleep_on: a = 等待队列的地址, b = 是否可中断
+#define TRACE_WAKEUP    3           // wake_up: a = 被唤醒的进程的pid
+#define TRACE_BLK_REQ   4           // make_request: a = 设备号, b = 块号, c = READ/WRITE
+#define TRACE_BLK_END   5           // end_request: a = 设备号, b = 块号, c = 是否成功
+#define TRACE_GETBLK    6           // getblk: a = 设备号, b = 块号, c = 是否在高速缓存中命中
+#define TRACE_BRELSE    7           // brelse: a = 设备号, b = 块号
+#define TRACE_NO_PAGE   8           // do_no_page: a = 线性地址, b = 错误码
+#define TRACE_WP_PAGE   9           // do_wp_page: a = 线性地址, b = 错误码
+#define TRACE_SYSCALL   10          // 系统调用返回: a = 系统调用号, b = 返回值, c = 耗时(周期数)
+
+struct trace_entry
+{
+	unsigned long seq;              // 开机以来的序号, 可以用来检查读取期间被覆盖的记录
+	unsigned long long stamp;       // 时间戳(rdtsc)
+	short event;                    // TRACE_xxx
+	short pid;                      // 发生事件时的当前进程
+	long a;
+	long b;
+	long c;
+};
+
+extern struct trace_entry trace_buf[TRACE_SIZE];
+extern unsigned long trace_head;
+
+extern void trace_event(int event, long a, long b, long c);
+
+#endif // _TRACE_H
@@ -33,7 +33,12 @@ typedef unsigned int sigset_t;
 #define SIGTTIN   21
 #define SIGTTOU   22
 
+// 实时信号: 用sigqueue()发送时会排队，每一次发送都会被递送一次，并且带有一个值
+#define SIGRTMIN  23
+#define SIGRTMAX  32
+
 #define SA_NOCLDSTOP    1
+#define SA_SIGINFO      4             // 处理函数为handler(int sig, long value), 用户栈上signr之后多了value, sa_restorer需要把它弹出
 #define SA_NOMASK       0x40000000
 #define SA_ONESHOT      0x80000000
 
@@ -66,5 +71,6 @@ int sigpending(sigset_t* set);
 int sigprocmask(int how, sigset_t* set, sigset_t* oldset);
 int sigsuspend(sigset_t* sigmask);
 int sigaction(int sig, struct sigaction* act, struct sigaction* oldact);
+int sigqueue(pid_t pid, int sig, long value);
 
 #endif // _SIGNAL_H
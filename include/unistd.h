@@ -127,6 +127,14 @@
 #define __NR_ssetmask 69
 #define __NR_setreuid 70
 #define __NR_setregid 71
+#define __NR_sched_setscheduler 72
+#define __NR_sched_getscheduler 73
+#define __NR_vfork 74
+#define __NR_clone 75
+#define __NR_futex 76
+#define __NR_sigqueue 77
+#define __NR_io_submit 78
+#define __NR_fsync 79
 
 // 定义0个参数的系统调用函数
 #define _syscall0(type,name) \
@@ -251,5 +259,16 @@ int dup2(int oldfd, int newfd);
 int getppid(void);
 pid_t getpgrp(void);
 pid_t setsid(void);
+struct sched_param;
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param* param);
+int sched_getscheduler(pid_t pid);
+pid_t vfork(void);
+int clone(unsigned long flags, void* child_stack);
+int futex(int* uaddr, int op, int val);
+struct io_ring;
+int io_submit(struct io_ring* ring);
+int fsync(int fildes);
+struct prof_param;
+int profil(struct prof_param* param);
 
 #endif	// _UNISTD_H
@@ -1,6 +1,8 @@
 #ifndef _BLK_H
 #define _BLK_H
 
+#include <linux/trace.h>
+
 #define NR_BLK_DEV          7           // 支持的总设备数
 #define NR_REQURST          32          // 请求队列的数目
 
@@ -93,6 +95,7 @@ extern inline void unlock_buffer(struct buffer_head* bh)
 extern inline void end_request(int uptodate)
 {
     DEVICE_OFF(CURRENT->dev);
+    trace_event(TRACE_BLK_END, CURRENT->dev, CURRENT->bh ? CURRENT->bh->b_blocknr : -1, uptodate);
     if (CURRENT->bh) {
         CURRENT->bh->b_uptodate = uptodate;
         unlock_buffer(CURRENT->bh);
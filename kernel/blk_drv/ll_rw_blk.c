@@ -95,6 +95,7 @@ static void make_request(int major, int rw, struct buffer_head* bh)
     // 检测读写标志变量是否合法
     if (rw != READ &&　rw != WRITE)
         panic("Bad block dev command, must be R/W/RA/WA");
+    trace_event(TRACE_BLK_REQ, bh->b_dev, bh->b_blocknr, rw);
 
     lock_buffer(bh);
     /* 如果是写操作，并且buffer块内的数据不是脏的(相对于磁盘来说，意思就是与磁盘的数据是同步的),或
@@ -105,6 +106,12 @@ static void make_request(int major, int rw, struct buffer_head* bh)
         return;
     }
 
+    // 记录到当前进程的块设备读写统计中
+    if (rw == READ)
+        current->blk_reads++;
+    else
+        current->blk_writes++;
+
 repeat:
     /* 设置读写操作的操作范围，查找一个空闲的requst项。具体来说，读操作时可以使用全部的32个请求项中空闲的，
        写操作时只能使用前2/3部分, 也就是21个。 */
@@ -127,8 +134,8 @@ repeat:
     req->dev = bh->b_dev;
     req->cmd = rw;
     req->errors = 0;
-    req->sector = bh->b_blocknr << 1;       // 起始的扇区号
-    req->nr_sectors = 2;                    // 要读写的扇区数
+    req->sector = bh->b_blocknr * (bh->b_size >> 9);    // 起始的扇区号, 块号以缓冲块的大小为单位
+    req->nr_sectors = bh->b_size >> 9;                  // 要读写的扇区数: 1KB的块是2个扇区, 4KB的块是8个
     req->buffer = bh->b_data;               // 数据缓冲区
     req->waiting = NULL;                    // 任务等待操作完成的地方
     req->bh = bh;
@@ -86,13 +86,15 @@ void rd_load(void) {
         return;
     }
     *((struct d_super_block*)&s) = *((struct d_super_block*)bh->b_data);
-    if (s.s_magic != SUPER_MAGIC)
+    if (s.s_magic == SUPER_MAGIC || s.s_magic == SUPER_MAGIC_30)
+        s.s_zones = s.s_nzones;
+    else if (s.s_magic != SUPER_MAGIC_V2 && s.s_magic != SUPER_MAGIC_V2_30)
         return;
 
     /* 首先从超级块中拿到共有多少个逻辑块的个数， 然后逻辑块数再乘以 2^log_zone_size, 得到了对应的数据块个数,
         (linux0.11中一个数据块等于2个扇区, 数据块的长度等于高速缓冲区块的长度), 然后对比一下在内存中初始化的
         虚拟盘空间能否装得下去RAM的映像文件。 */
-    nblocks = s.s_nzones << s.s_log_zone_size;
+    nblocks = s.s_zones << s.s_log_zone_size;
     if (nblocks > (rd_length >> BLOCK_SIZE_BITS)) {
         printk("Ram disk image too big! (%d blocks, %d avalible)\n", nblocks, rd_length >> BLOCK_SIZE_BITS);
         return;
@@ -0,0 +1,176 @@
+/**
+  @file
+  @brief kstat伪字符设备: 把内核中的统计信息以定长记录的形式导出给用户程序读取，作用类似于/proc文件系统。
+  */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/kstat.h>
+#include <linux/trace.h>
+#include <linux/profile.h>
+#include <asm/segment.h>
+#include <asm/system.h>
+
+// 填充第idx条记录的函数, rec指向大小为记录长度的内核缓冲区
+typedef void (*kstat_fill_fn)(int idx, char* rec);
+
+// 单条记录的最大长度，用于在栈上分配临时缓冲区
+#define KSTAT_MAX_REC 128
+
+/**
+  @brief 通用的读取函数：逐条生成记录, 把pos开始的内容复制到用户缓冲区中。
+  @param [in] buf 用户缓冲区
+  @param [in] count 要读取的字节数
+  @param [in] pos 文件位置指针, 读取后会向后移动
+  @param [in] fill 生成记录的函数
+  @param [in] size 每一条记录的字节数
+  @param [in] nr 记录的总条数
+  @return 返回实际读取的字节数, 读到末尾时返回0.
+  */
+static int kstat_read(char* buf, int count, off_t* pos, kstat_fill_fn fill, int size, int nr)
+{
+    char rec[KSTAT_MAX_REC];
+    int idx, off, n, read = 0;
+
+    while (count > 0 && (idx = *pos / size) < nr)
+    {
+        // 先清零, 空的任务槽等只填写部分字段的记录不能把内核栈上的旧内容带给用户。
+        // 生成记录时关中断，保证得到的是一个一致的快照
+        memset(rec, 0, KSTAT_MAX_REC);
+        cli();
+        fill(idx, rec);
+        sti();
+
+        off = *pos % size;
+        n = size - off;
+        if (n > count)
+            n = count;
+        *pos += n;
+        count -= n;
+        read += n;
+        while (n-- > 0)
+            put_fs_byte(rec[off++], buf++);
+    }
+    return read;
+}
+
+/**
+  @brief 生成第idx个任务槽的统计记录。
+  */
+static void fill_task(int idx, char* rec)
+{
+    struct kstat_task* k = (struct kstat_task*)rec;
+    struct task_struct* p = task[idx];
+    unsigned long long now;
+
+    if (!p)
+    {
+        k->pid = -1;
+        return;
+    }
+    k->pid = p->pid;
+    k->father = p->father;
+    k->state = p->state;
+    k->policy = p->policy;
+    k->counter = p->counter;
+    k->utime = p->utime;
+    k->stime = p->stime;
+    k->cycles = p->cycles;
+    // 当前进程正在运行，还要加上本次运行的周期数
+    if (p == current)
+    {
+        read_stamp(now);
+        k->cycles += now - p->switch_stamp;
+    }
+    k->nvcsw = p->nvcsw;
+    k->nivcsw = p->nivcsw;
+    k->min_flt = p->min_flt;
+    k->maj_flt = p->maj_flt;
+    k->blk_reads = p->blk_reads;
+    k->blk_writes = p->blk_writes;
+    k->sleep_time = p->sleep_time;
+    k->fpu_loads = p->fpu_loads;
+}
+
+/**
+  @brief 生成第idx个系统调用号的统计记录。
+  */
+static void fill_syscall(int idx, char* rec)
+{
+    struct kstat_syscall* k = (struct kstat_syscall*)rec;
+
+    *k = syscall_stats[idx];
+    k->nr = idx;
+}
+
+/**
+  @brief 生成跟踪缓冲区中第idx条记录, idx为0的是最旧的记录。 还没有写过的位置返回TRACE_NONE.
+  */
+static void fill_trace(int idx, char* rec)
+{
+    struct trace_entry* k = (struct trace_entry*)rec;
+    unsigned long seq = trace_head - TRACE_SIZE + idx;
+
+    // 开机之后还没有写满一圈时，前面的位置是空的
+    if (trace_head < TRACE_SIZE)
+        seq = idx;
+    *k = trace_buf[seq & (TRACE_SIZE - 1)];
+    if (seq >= trace_head || k->seq != seq)
+    {
+        k->seq = seq;
+        k->event = TRACE_NONE;
+    }
+}
+
+/**
+  @brief 生成内核采样直方图中的第idx条记录。
+  */
+static void fill_prof(int idx, char* rec)
+{
+    struct kstat_prof* k = (struct kstat_prof*)rec;
+
+    k->addr = (unsigned long)idx << PROF_SHIFT;
+    k->hits = prof_buffer[idx];
+}
+
+/**
+  @brief 生成协处理器的统计记录。
+  */
+static void fill_fpu(int idx, char* rec)
+{
+    *(struct kstat_fpu*)rec = fpu_stats;
+}
+
+/**
+  @brief kstat设备的读写函数，由rw_char()调用。 该设备是只读的。
+  @param [in] rw 读还是写
+  @param [in] minor 次设备号, 决定读取哪一种统计信息
+  @param [in] buf 用户缓冲区
+  @param [in] count 要读取的字节数
+  @param [in] pos 文件位置指针
+  @return 返回实际读取的字节数或者错误码。
+  */
+int rw_kstat(int rw, unsigned minor, char* buf, int count, off_t* pos)
+{
+    if (rw != READ)
+        return -EINVAL;
+
+    switch (minor)
+    {
+        case KSTAT_TASKS:
+            return kstat_read(buf, count, pos, fill_task, sizeof(struct kstat_task), NR_TASKS);
+        case KSTAT_SYSCALLS:
+            return kstat_read(buf, count, pos, fill_syscall, sizeof(struct kstat_syscall), NR_SYSCALLS);
+        case KSTAT_TRACE:
+            return kstat_read(buf, count, pos, fill_trace, sizeof(struct trace_entry), TRACE_SIZE);
+        case KSTAT_PROFILE:
+            return kstat_read(buf, count, pos, fill_prof, sizeof(struct kstat_prof), PROF_LEN);
+        case KSTAT_FPU:
+            return kstat_read(buf, count, pos, fill_fpu, sizeof(struct kstat_fpu), 1);
+        default:
+            return -ENODEV;
+    }
+}
@@ -24,6 +24,13 @@ void release(struct task_struct *p)
         if (task[i] == p)
         {
             task[i] = NULL;
+            unhash_pid(p);
+            unlink_pgrp(p);
+            unlink_session(p);
+            REMOVE_LINKS(p);
+            // 任务槽对应的线性地址空间还被clone()出来的线程使用时，先不能放回空闲栈, 见exit_mm()
+            if (!mm_count[i])
+                put_free_taskslot(i);
             free_page((long)p);
             schedule();
             return;
@@ -48,7 +55,7 @@ static inline int send_sig(long sig, struct task_struct* p, int priv)
     if (!p || sig < 1 || sig > 32)
         return -EINVAL;
     if (priv || (current->euid == p->euid) || suser())
-        p->signal |= (1 << (sig - 1));
+        signal_wake_up(p, sig);
     else
         return -EPERM;
     return 0;
@@ -58,20 +65,46 @@ static inline int send_sig(long sig, struct task_struct* p, int priv)
 * @param [in] void 输入为空。
 * @return 返回值为空。
 *
-* 关闭当前进行的session时， 遍历整个任务数组(除FIRST任务之外）, 如果某个进程的session号和当前进程的session号相同，
-* 则给那一个进程设置SIGHUP的信号。
+* 关闭当前进行的session时， 遍历当前会话所在的哈希链表(而不是整个任务数组), 如果某个进程(除任务0之外)的
+* session号和当前进程的session号相同，则给那一个进程设置SIGHUP的信号。
 */
 static void kill_session(void)
 {
-    struct task_struct** p= NR_TASKS + task;
+    struct task_struct* p = sesshash[pid_hashfn(current->session)];
     
-    while (--p > &FIRST_TASK)
+    for (; p; p = p->sess_next)
     {
-        if (*p && (*p)->session == current->session)
-            (*p)->signal |= 1 << (SIGHUP - 1);
+        if (p != task[0] && p->session == current->session)
+            signal_wake_up(p, SIGHUP);
     }
 }
 
+/** @brief 给进程组内的所有进程发送信号。
+* @param [in] pgrp 进程组号
+* @param [in] sig 信号
+* @param [in] priv 权限, 与send_sig()中的相同
+* @return 成功返回0, 否则返回最后一个出错的错误码。 进程组内没有进程时返回-ESRCH.
+*/
+static int kill_pg(int pgrp, int sig, int priv)
+{
+    struct task_struct* p = pgrphash[pid_hashfn(pgrp)];
+    int err, retval = -ESRCH, found = 0;
+
+    for (; p; p = p->pg_next)
+    {
+        if (p == task[0] || p->pgrp != pgrp)
+            continue;
+        if (!found)
+        {
+            found = 1;
+            retval = 0;
+        }
+        if ((err = send_sig(sig, p, priv)))
+            retval = err;
+    }
+    return retval;
+}
+
 /** @brief 为什么这个函数名字是kill呢，它的功能明明是调用函数send_sig()给进程发送信号呢。
 * @param [in] pid 进程的ID号
 * @param [in] sig 信号
@@ -79,31 +112,22 @@ static void kill_session(void)
 int sys_kill(int pid, int sig)
 {
     struct task_struct **p = NR_TASKS + task;
+    struct task_struct *q;
     int err, retval = 0;
     
     if (!pid)
     {
         // 当pid为0时，给当前进程的进程组(该进程组的领头是当前进程)内的所有进程发送消息。
         // 发消息时，privilege参数为1.
-        while (--p > &FIRST_TASK)
-        {
-            if (*p && (*p)->pgrp == current->pid)
-                if (err = send_sig(sig, *p, 1))
-                    retval = err;
-        }
+        retval = kill_pg(current->pid, sig, 1);
     }
     else if (pid > 0)
     {
-       
-        
-        // 当pid > 0 时，只给ID为pid的进程发送信号。
+        // 当pid > 0 时，只给ID为pid的进程发送信号, 通过pid哈希表直接查找。
         // 发消号时，privilege参数为0.
-        while (--p > &FIRST_TASK)
-        {
-            if (*p && (*p)->pid == pid)
-                if (err = send(sig, *p, 0))
-                    retval = err;
-        }
+        if (!(q = find_task_by_pid(pid)))
+            return -ESRCH;
+        retval = send_sig(sig, q, 0);
     }
     else if (pid == -1)
     {
@@ -119,35 +143,24 @@ int sys_kill(int pid, int sig)
     {
         // 当pid为负数并且不等于-1时，给进程组内的进程发送信号。进程组的ID号等于-pid。
         //  发消号时，privilege参数为0.
-        while (--p > &FIRST_TASK)
-        {
-            if (*p && (*p)->pgrp == -pid)
-                if (err = send_sig(sig, *p, 0))
-                    retval = err;
-        }
+        retval = kill_pg(-pid, sig, 0);
     }
     return retval;
 }
 
-/** @brief 给指定的父进程设置一个SIGCHLD的信号。
-* @param [in] pid 指定的父进程pid.
+/** @brief 给当前进程的父进程设置一个SIGCHLD的信号。
 * @return 返回值为空。
 *
-* 在子进程结束时，会调用该函数给父进程发送一个SIGCHLD的信号。
+* 在子进程结束时，会调用该函数给父进程发送一个SIGCHLD的信号。 父进程直接通过p_pptr指针得到，不需要再查找。
 */
-static void tell_father(int pid)
+static void tell_father(void)
 {
-    if (!pid)
+    if (!current->father)
         return;
     
-    int i;
-    for (i = 0; i < NR_TASKS; ++i)
+    if (current->p_pptr)
     {
-        if (!task[i])
-            continue;
-        if (task[i]->pid != pid)
-            continue;
-        task[i]->signal |= (1<<(SIGCHLD - 1));
+        signal_wake_up(current->p_pptr, SIGCHLD);
         return;
     }
     
@@ -156,6 +169,74 @@ static void tell_father(int pid)
     release(current);
 }
 
+/**
+* @brief 释放当前进程的地址空间。 只有最后一个使用者才真正释放页表; 如果这个地址空间所属的任务槽上的进程
+* 已经被释放了(任务槽当时没有放回空闲栈, 见release()), 在这里把任务槽放回去。
+*/
+static void exit_mm(void)
+{
+    int slot = current->mm_slot;
+
+    // vfork()的子进程使用的是父进程的地址空间，需要唤醒父进程
+    mm_release();
+    if (--mm_count[slot])
+        return;
+    free_page_tables(get_base(current->ldt[1]), get_limit(0x0f));
+    free_page_tables(get_base(current->ldt[2]), get_limit(0x17));
+    if (!task[slot])
+        put_free_taskslot(slot);
+}
+
+/**
+* @brief 释放当前进程的打开文件表, 最后一个使用者关闭所有打开的文件。
+*/
+static void exit_files(void)
+{
+    struct files_struct* files = current->files;
+    int i;
+
+    if (--files->count)
+        return;
+    for (i = 0; i < NR_OPEN; ++i)
+    {
+        if (files->fd[i])
+            sys_close(i);
+    }
+    current->files = NULL;
+    if (files != task[0]->files)
+        free_s(files, sizeof(struct files_struct));
+}
+
+/**
+* @brief 释放当前进程的当前目录和根目录。
+*/
+static void exit_fs(void)
+{
+    struct fs_struct* fs = current->fs;
+
+    current->fs = NULL;
+    if (--fs->count)
+        return;
+    iput(fs->pwd);
+    iput(fs->root);
+    if (fs != task[0]->fs)
+        free_s(fs, sizeof(struct fs_struct));
+}
+
+/**
+* @brief 释放当前进程的信号处理函数表。
+*/
+static void exit_sighand(void)
+{
+    struct signal_struct* sig = current->sig;
+
+    current->sig = NULL;
+    if (--sig->count)
+        return;
+    if (sig != task[0]->sig)
+        free_s(sig, sizeof(struct signal_struct));
+}
+
 /**
 * @brief 该函数的作用就是退出当前进程。
 * @param [in] code 进程的退出码。
@@ -173,35 +254,30 @@ static void tell_father(int pid)
 */
 int do_exit(long code)
 {
-    int i;
+    struct task_struct* p;
     
-    free_page_tables(get_base(current->ldt[1]), get_limit(0x0f));
-    free_page_tables(get_base(current->ldt[2]), get_limit(0x17));
+    // 地址空间可能还被vfork()的父进程或者其它线程使用，见exit_mm()
+    exit_mm();
 
-	// 遍历task数组找到当前进程的子进程， 然后把这个子进程的父进程设置为1.
+	// 遍历当前进程的子进程链表， 把每一个子进程的父进程设置为进程1, 并加入到进程1的子进程链表中。
 	// 如果子进程的状态是task_zombie状态，则给进程1发送一个sigchld的信号。
-	for (i = 0; i < NR_TASKS; ++i)
+	while ((p = current->p_cptr))
 	{
-		if (task[i] && task[i]->father == current->pid)
-		{
-			task[i]->father = 1;
-			if (task[i]->state = TASK_ZOMBIE)
-				send_sig(SIGCHLD, task[1], 1);
-		}
+		current->p_cptr = p->p_osptr;
+		p->father = 1;
+		p->p_pptr = task[1];
+		SET_LINKS(p);
+		if (p->state == TASK_ZOMBIE)
+			send_sig(SIGCHLD, task[1], 1);
 	}
 
-	// 关闭进程打开的所有文件
-	for (i = 0; i < NR_OPEN; ++i)
-	{
-		if (current->filp[i])
-			sys_close(i);
-	}
+	// 关闭进程打开的所有文件, 释放当前目录、根目录和信号处理函数表(与其它线程共享时只减少计数)
+	exit_files();
+	exit_fs();
+	exit_sighand();
+	flush_sigqueue(current);
 
-	// 清空与进程相关目录的inode，分别是当前目录、根目录、可执行目录
-	iput(current->pwd);
-	current->pwd = NULL;
-	iput(current->root);
-	current->root = NULL;
+	// 清空可执行文件的inode
 	iput(current->executable);
 	current->executable;
 	
@@ -222,83 +298,103 @@ int do_exit(long code)
 	// 当前进程的struct 结构体依然保留，因为父进程可以还需要它里面的信息。
 	current->state = TASK_ZOMBIE;
 	current->exit_code = code;
-	tell_father(current->father);
+	tell_father();
 	schedule();
 	return -1;
 }
 
 /**
-* @brief waitpid系统调用
-*
+* @brief 检查进程p是否是sys_waitpid()要等待的子进程，如果是，根据它的状态进行处理。
+* @param [in] p 要检查的进程
+* @param [in] pid/stat_addr/options 与sys_waitpid()的参数相同
+* @param [out] flag 如果p是满足条件但还在运行的子进程，置为1
+* @return 如果p已经停止或者僵死，返回它的pid, 否则返回0.
 */
-int sys_waitpid(pid_t pid, unsigned long* stat_addr, int options)
+static int wait_check(struct task_struct* p, pid_t pid, unsigned long* stat_addr, int options, int* flag)
 {
-	int flag, code;
-	struct task_struct **p;
-	verify_area(stat_addr, 4);
-	
-repeat:
-	flag = 0;
-	for (p = &LAST_TASK; p > &FIRST_TASK; --p)
+	int retval, code;
+
+	if (p == current || p->p_pptr != current)
+		return 0;
+
+	// 现在查找到了“父进程是当前进程”的进程，接下来根据不同的pid值，再次筛选满足条件的进程：
+	// 当pid > 0 时，筛选进程ID等于pid的进程
+	// 当pid = 0 时，筛选与当前进程组ID相同的进程;
+	// 当pid = -1时， 任意的子进程都可以;
+	// 当pid < -1时，筛选进程组ID等于-pid的进程；
+	if (pid > 0)
+	{
+		if (p->pid != pid)
+			return 0;
+	}
+	else if (!pid)
+	{
+		if (p->pgrp != current->pgrp)
+			return 0;
+	}
+	else if (pid != -1)
 	{
+		if (p->pgrp != -pid)
+			return 0;
+	}
 
-		if (!*p || *p == current)
-			continue;
-		if ((*p)->father != current->pid)
-			continue;
-		
-		// 现在查找到了“父进程是当前进程”的进程，接下来根据不同的pid值，再次筛选满足条件的进程：
-		// 当pid > 0 时，筛选进程ID等于pid的进程
-		// 当pid = 0 时，筛选与当前进程组ID相同的进程;
-		// 当pid = -1时， 任意的子进程都可以;
-		// 当pid < -1时，筛选进程组ID等于-pid的进程；
-		if (pid > 0)
+	// 根据满足条件的子进程的状态，进行不同的处理：
+	switch (p->state)
+	{
+		case TASK_STOPPED:
 		{
-			if ((*p)->pid != pid)
-				continue;
+			// 如果子进程处于TASK_STOPPED状态时，如果设置了untraced选项，
+			// 则返回,否则的继续查找下一个满足条件的子进程。
+			if (!(options & WUNTRACED))
+				return 0;
+			put_fs_long(0x7f, stat_addr);
+			return p->pid;
 		}
-		else if (!pid)
+		case TASK_ZOMBIE:
 		{
-			if ((*p)->pgrp != current->pgrp)
-				continue;
+			// 如果子进程处于僵死状态，则把子进程的相关用户cpu时间和系统cpu时间加到父进程上，
+			// 并且把子进程的task_strcut占用的内存页释放掉，返回。
+			// 看到了吧，原来僵死的进程是在sys_waitpid中进行处理的。
+			current->cutime += p->utime;
+			current->cstime += p->stime;
+			retval = p->pid;
+			code = p->exit_code;
+			release(p);
+			put_fs_long(code, stat_addr);
+			return retval;
 		}
-		else if (pid != -1)
+		default:
 		{
-			if (*p)->pgrp != -pid)
-				continue;
+			*flag = 1;
+			return 0;
 		}
-		
-		// 根据满足条件的子进程的状态，进行不同的处理：
-		switch((*p)->state)
+	}
+}
+
+/**
+* @brief waitpid系统调用
+*
+* 当pid > 0时通过pid哈希表直接找到要等待的进程，其它情况只需要遍历当前进程的子进程链表。
+*/
+int sys_waitpid(pid_t pid, unsigned long* stat_addr, int options)
+{
+	int flag, retval;
+	struct task_struct *q;
+	verify_area(stat_addr, 4);
+	
+repeat:
+	flag = 0;
+	if (pid > 0)
+	{
+		if ((q = find_task_by_pid(pid)) && (retval = wait_check(q, pid, stat_addr, options, &flag)))
+			return retval;
+	}
+	else
+	{
+		for (q = current->p_cptr; q; q = q->p_osptr)
 		{
-            case TASK_STOPPED:
-            {
-                // 如果子进程处于TASK_STOPPED状态时，如果设置了untraced选项，
-                // 则返回,否则的继续查找下一个满足条件的子进程。
-                // WUNTRACED表示：
-                if (!(option & WUNTRACED))
-                    continue;
-                put_fs_long(0x7f, stat_addr);
-                return (*p)->pid;
-            }
-            case TASK_ZOMBIE:
-            {
-                // 如果子进程处于僵死状态，则把子进程的相关用户cpu时间和系统cpu时间加到父进程上，
-                // 并且把子进程的task_strcut占用的内存页释放掉，返回。
-                // 看到了吧，原来僵死的进程是在sys_waitpid中进行处理的。
-                current->cutime += (*p)->utime;
-                current->cstime += (*p)->stime;
-                flag = (*p)->pid;
-                code = (*p)->exit_code;
-                release(*p);
-                put_fs_long(code, stat_addr);
-                return flag;
-            }
-            default:
-            {
-                flag = 1;
-                continue;
-            }
+			if ((retval = wait_check(q, pid, stat_addr, options, &flag)))
+				return retval;
 		}
 	}
     
@@ -306,7 +402,7 @@ repeat:
     {
         // 当子进程都没有停止时，如果设置了WNOHANG， 则返回，意思就是不需要一直挂起等待子进程结束
         // WNOHANG表示： 
-        if (option & WNOHANG)
+        if (options & WNOHANG)
             return 0;
         
         current->state = TASK_INTERRUPTIBLE;
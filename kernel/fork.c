@@ -5,6 +5,7 @@
 #include <asm/system.h>
 
 extern void write_verify(unsigned long addr);
+extern void ret_from_fork(void);
 long last_pid = 0;
 
 /**
@@ -35,13 +36,16 @@ void verify_area(void* addr, int size)
 * @brief 该函数实现复制当前进程到目的进程。
 * @param [in] nr 进程号
 * @param [in] p 目的进程的task_struct 结构体指针
+* @param [in] clone_flags 创建进程的选项, 有CLONE_VM时不复制地址空间
 * @return 返回 int 类型，成功时返回0，错误时返回错误码。
 *
 * 完成了如下任务：
 * 1. 为新进程设置start_code 项，设置为局部描述符表中的代码段选择子和数据段选择子。
 * 2. 复制了进程的代码段和数据段（其实只是复制了内表而已，实现写时复制功能).
+* 3. CLONE_VM(包括vfork)时子进程的ldt直接使用父进程的段基址, 与父进程共用同一个线性地址空间, 只需要增加
+*    该线性地址空间的使用计数, 这样即使父进程退出了，它的任务槽也不会被再分配出去。
 */
-int copy_mem(int nr, struct task_struct *p)
+int copy_mem(int nr, struct task_struct *p, unsigned long clone_flags)
 {
     unsigned long old_data_base;
     unsigned long old_code_base;
@@ -59,6 +63,13 @@ int copy_mem(int nr, struct task_struct *p)
         painic(" don't support separate I&D");
     if (data_limit < code_limit)
         panic("bad data_limit");
+
+    if (clone_flags & CLONE_VM)
+    {
+        p->mm_slot = current->mm_slot;
+        mm_count[p->mm_slot]++;
+        return 0;
+    }
     
     // 从下面这行代码可以看出来，每一个进程占了64M(0x4000000) 的内存。
     new_data_base = new_code_base = nr * 0x4000000;
@@ -70,23 +81,117 @@ int copy_mem(int nr, struct task_struct *p)
         free_page_tables(new_data_base, data_limit);
         return -ENOMEM;
     }
+    p->mm_slot = nr;
+    mm_count[nr] = 1;
+    return 0;
+}
+
+/**
+* @brief 为新进程复制或者共享打开的文件表。
+* @return 成功返回0, 内存不足时返回-ENOMEM.
+*/
+static int copy_files(unsigned long clone_flags, struct task_struct* p)
+{
+  struct files_struct* files;
+  struct file* f;
+  int i;
+
+  if (clone_flags & CLONE_FILES)
+  {
+    current->files->count++;
+    return 0;
+  }
+  if (!(files = (struct files_struct*)malloc(sizeof(struct files_struct))))
+    return -ENOMEM;
+  *files = *current->files;
+  files->count = 1;
+  // 文件打开次数加1
+  for (i = 0; i < NR_OPEN; ++i)
+  {
+    if ((f = files->fd[i]))
+      f->f_count++;
+  }
+  p->files = files;
+  return 0;
+}
+
+/**
+* @brief 为新进程复制或者共享当前目录/根目录/umask.
+* @return 成功返回0, 内存不足时返回-ENOMEM.
+*/
+static int copy_fs(unsigned long clone_flags, struct task_struct* p)
+{
+  struct fs_struct* fs;
+
+  if (clone_flags & CLONE_FS)
+  {
+    current->fs->count++;
+    return 0;
+  }
+  if (!(fs = (struct fs_struct*)malloc(sizeof(struct fs_struct))))
+    return -ENOMEM;
+  *fs = *current->fs;
+  fs->count = 1;
+  // 进程的pwd/root目录项的引用次数加1.
+  if (fs->pwd)
+    fs->pwd->i_count++;
+  if (fs->root)
+    fs->root->i_count++;
+  p->fs = fs;
+  return 0;
+}
+
+/**
+* @brief 为新进程复制或者共享信号处理函数表。
+* @return 成功返回0, 内存不足时返回-ENOMEM.
+*/
+static int copy_sighand(unsigned long clone_flags, struct task_struct* p)
+{
+  struct signal_struct* sig;
+
+  if (clone_flags & CLONE_SIGHAND)
+  {
+    current->sig->count++;
     return 0;
+  }
+  if (!(sig = (struct signal_struct*)malloc(sizeof(struct signal_struct))))
+    return -ENOMEM;
+  *sig = *current->sig;
+  sig->count = 1;
+  p->sig = sig;
+  return 0;
 }
 
 /**
 * @brief 复制一个进程。
+* @param [in] clone_flags 创建进程的选项(CLONE_xxx), fork()时为0
+* @param [in] newsp 子进程的用户栈指针, 为0时与父进程相同(clone()创建线程时要指定新的栈)
+* @param [in] nr 新进程的任务槽
+* 其它的参数是系统调用时压入栈中的寄存器的值。
+*
+* 如果是vfork(), 父进程在这里睡眠，直到子进程调用exec或者退出(见mm_release()).
 */
-int copy_process(int nr, long ebp, long edi, long esi, long gs, long none,
+int copy_process(unsigned long clone_flags, long newsp, int nr, long ebp, long edi, long esi, long gs, long none,
                  long ebx, long ecx,long edx, long fs, long es, long ds,
                  long eip, long cs, long eflags, long esp, long ss)
 {
   struct task_struct *p;
-  int i;
-  struct file *f;
+  long *stack;
+  int pid;
   
+  // 共享信号处理函数的进程必须在同一个地址空间中, 否则处理函数的地址没有意义
+  if ((clone_flags & CLONE_SIGHAND) && !(clone_flags & CLONE_VM))
+  {
+    put_free_taskslot(nr);
+    return -EINVAL;
+  }
+
   p = (struct task_struct*)get_free_page();
   if (!p)
+  {
+    put_free_taskslot(nr);
     return -EAGAIN;
+  }
   
   task[nr] = p;
   *p = *current;
@@ -96,91 +201,191 @@ int copy_process(int nr, long ebp, long edi, long esi, long gs, long none,
   p->father = current->pid;
   p->counter = p->priority;
   p->signal = 0;
+  p->sigq = NULL;
   p->alarm = 0;
   p->leader = 0;
   p->utime = p->stime = 0;
   p->cutime = p->cstime = 0;
   p->start_time = jiffies;
-  p->tss.back_link = 0;
-  p->tss.esp0 = PAGE_SIZE + (long)p;
-  p->tss.ss0 = 0x10;
-  p->tss.eip = eip;
-  p->tss.eflags = eflags;
-  p->tss.eax = 0;       // 这个就是新进程返回0的原因,因为函数的返回值保存在eax寄存器中
-  p->tss.ecx = ecx;
-  p->tss.edx = edx;
-  p->tss.ebx = ebx;
-  p->tss.esp = esp;
-  p->tss.ebp = ebp;
-  p->tss.esi = esi;
-  p->tss.edi = edi;
-  p->tss.es = es & 0xffff;
-  p->tss.cs = cs & 0xffff;
-  p->tss.ss = ss & 0xffff;
-  p->tss.ds = ds & 0xffff;
-  p->tss.fs = fs & 0xffff;
-  p->tss.gs = gs & 0xffff;
-  p->tss.ldt = _LDT(nr);
-  p->tss.trace_bitmap = 0x80000000;
+  p->preempt_count = 0;
+  p->prof_scale = 0;        // 子进程不继承profil()的设置
+  p->prof_pending = 0;
+  p->journal_depth = 0;
+  p->journal_dev = 0;
+  p->flags = 0;
+  p->vfork_wait = NULL;
+  p->cycles = 0;
+  p->nvcsw = p->nivcsw = 0;
+  p->min_flt = p->maj_flt = 0;
+  p->blk_reads = p->blk_writes = 0;
+  p->sleep_time = 0;
+  p->fpu_loads = 0;
 
-  if (last_task_used_math == current)
-	  __asm__("clts; fnsave %0"::"m"(p->tss.i387));
+  // 在新进程的内核栈中构造出与系统调用时完全相同的栈帧，新进程第一次被调度时从ret_from_fork开始执行，
+  // 它弹出gs/esi/edi/ebp之后跳到ret_from_sys_call, 就像是从fork()系统调用中返回一样。
+  stack = (long*)(PAGE_SIZE + (long)p);
+  *--stack = ss & 0xffff;
+  *--stack = newsp ? newsp : esp;
+  *--stack = eflags;
+  *--stack = cs & 0xffff;
+  *--stack = eip;
+  *--stack = ds & 0xffff;
+  *--stack = es & 0xffff;
+  *--stack = fs & 0xffff;
+  *--stack = edx;
+  *--stack = ecx;
+  *--stack = ebx;
+  *--stack = 0;          // 这个就是新进程返回0的原因,因为函数的返回值保存在eax寄存器中
+  *--stack = gs & 0xffff;
+  *--stack = esi;
+  *--stack = edi;
+  *--stack = ebp;
+  p->thread.esp0 = PAGE_SIZE + (long)p;
+  p->thread.esp = (long)stack;
+  p->thread.eip = (long)ret_from_fork;
 
-  if (copy_mem(nr, p))
+  // 父进程正在使用协处理器时，把它的状态保存到子进程中。 fnsave之后协处理器会被重新初始化，还要恢复给父进程;
+  // fxsave则不会改变协处理器的状态。
+  if (last_task_used_math == current)
   {
-	  task[nr] = NULL;
-	  free_page((long)p);
-	  return -EAGAIN;
+	  clts();
+	  save_fpu(p);
+	  if (!fpu_fxsr)
+		  restore_fpu(p);
   }
 
-  // 文件打开次数加1
-  for (i = 0; i < NR_OPEN; ++i)
-  {
-	  if (f=p->filp[i])
-		  f->f_count++;
-  }
+  if (copy_files(clone_flags, p))
+	  goto bad_fork_free;
+  if (copy_fs(clone_flags, p))
+	  goto bad_fork_cleanup_files;
+  if (copy_sighand(clone_flags, p))
+	  goto bad_fork_cleanup_fs;
+  if (copy_mem(nr, p, clone_flags))
+	  goto bad_fork_cleanup_sighand;
 
-  // 进程的pwd/root/executable目录项的引用次数加1.
-  if (current->pwd)
-	  current->pwd->i_count++;
-  if (current->root)
-	  current->root->i_count++;
+  // 进程的executable的引用次数加1.
   if (current->executable)
 	  current->executable->i_count++;
 
-  // 设置tss和ldt的描述符项
-  set_tss_desc(gdt+(nr << 1) + FIRST_TSS_ENTRY, &(p->tss));
-  set_ldt_desc(gdt+(nr << 1) + FIRST_TSS_ENTRY, &(p->ldt));
+  hash_pid(p);
+  link_pgrp(p);
+  link_session(p);
+  p->p_pptr = current;
+  p->p_cptr = NULL;
+  SET_LINKS(p);
+  pid = p->pid;
+  if (clone_flags & CLONE_VFORK)
+    p->flags |= PF_VFORK;
   p->state = TASK_RUNNING;
 
-  return last_pid;
+  // 子进程在使用父进程的地址空间(包括用户栈), 父进程不能运行
+  while (p->flags & PF_VFORK)
+    sleep_on(&p->vfork_wait);
+
+  return pid;
+
+  // 出错时按照相反的顺序释放已经复制的资源。 这时候文件表等还没有被子进程使用，直接减少计数即可。
+bad_fork_cleanup_sighand:
+  if (!(clone_flags & CLONE_SIGHAND))
+	  free_s(p->sig, sizeof(struct signal_struct));
+  else
+	  current->sig->count--;
+bad_fork_cleanup_fs:
+  if (!(clone_flags & CLONE_FS))
+  {
+	  iput(p->fs->pwd);
+	  iput(p->fs->root);
+	  free_s(p->fs, sizeof(struct fs_struct));
+  }
+  else
+	  current->fs->count--;
+bad_fork_cleanup_files:
+  if (!(clone_flags & CLONE_FILES))
+  {
+	  for (pid = 0; pid < NR_OPEN; ++pid)
+	  {
+		  if (p->files->fd[pid])
+			  p->files->fd[pid]->f_count--;
+	  }
+	  free_s(p->files, sizeof(struct files_struct));
+  }
+  else
+	  current->files->count--;
+bad_fork_free:
+  task[nr] = NULL;
+  put_free_taskslot(nr);
+  free_page((long)p);
+  return -EAGAIN;
+}
+
+/**
+* @brief 当前进程不再使用vfork()时从父进程借来的地址空间了, 在子进程exec或者退出时调用。
+* 清除PF_VFORK标志，并唤醒在copy_process()中等待的父进程。
+*/
+void mm_release(void)
+{
+  if (!(current->flags & PF_VFORK))
+    return;
+  current->flags &= ~PF_VFORK;
+  wake_up(&current->vfork_wait);
+}
+
+/**
+* @brief exec时释放当前进程原来的地址空间, 代替原来直接对当前段基址调用free_page_tables().
+*
+* 地址空间还被别的进程(vfork()的父进程或者clone(CLONE_VM)创建的线程)使用时不能释放, 而是要把ldt的段基址
+* 改为自己的任务槽对应的64M线性地址空间(此时还是空的), 然后唤醒vfork()的父进程。 注意：必须在把参数和环境
+* 变量从旧的地址空间中复制出来之后才能调用该函数，调用之后fs指向的已经是新的(空的)数据段了。
+* @return 成功返回0; 自己任务槽的地址空间还被其它线程使用时, 没有空的地址空间可以换, 返回-EBUSY.
+*/
+int exec_mmap(void)
+{
+  unsigned long base;
+  int nr;
+
+  if (mm_count[current->mm_slot] == 1)
+  {
+    free_page_tables(get_base(current->ldt[1]), get_limit(0x0f));
+    free_page_tables(get_base(current->ldt[2]), get_limit(0x17));
+    mm_release();
+    return 0;
+  }
+
+  for (nr = 0; nr < NR_TASKS && task[nr] != current; ++nr)
+    ;
+  if (nr == current->mm_slot)
+    return -EBUSY;
+  mm_count[current->mm_slot]--;
+  current->mm_slot = nr;
+  mm_count[nr] = 1;
+  base = nr * 0x4000000;
+  current->start_code = base;
+  set_base(current->ldt[1], base);
+  set_base(current->ldt[2], base);
+  // 段描述符修改之后，重新加载ldtr和fs, 使新的段基址生效
+  lldt();
+  __asm__("mov %%ax, %%fs"::"a" (0x17));
+  mm_release();
+  return 0;
 }
 
 /**
 * @brief 下面的函数实现：1. 查找能使用的pid号；2. 查找可以使用的进程在进程数组中的任务号。
 *
-* 我发现，linus很喜欢使用goto啊。
+* 以前是每增加一次last_pid就遍历一遍整个task数组检查是否冲突，冲突时goto repeat重新开始，然后再遍历一遍
+* 查找空的任务槽。 现在任务槽从空闲栈中取，pid冲突通过pid哈希表检查, 都是O(1)的。
+* 注意：取出的任务槽如果在copy_process()中创建进程失败，要放回空闲栈中。
 */
 int find_empty_process(void)
 {
-	int i;
+	int nr;
 
-repeat:
-	if ((++last_pid) < 0)
-		last_pid = 1;
-	for (i = 0; i < NR_TASKS; ++i)
-	{
-		// 如果发现进程数组中已经有进程使用了last_pid号，
-		// 则跳转到repeat处，把last_pid加一， 再一次去验证
-		// 是否已经存在进程使用了last_pid号。
-		if (task[i] && task[i]->pid == last_pid)
-			goto repeat;
-	}
-
-	for (i = 1; i < NR_TASKS; ++i)
+	if ((nr = get_free_taskslot()) < 0)
+		return -EAGAIN;
+	do
 	{
-		if (!task[i])
-			return i;
-	}
-	return -EAGAIN;
+		if ((++last_pid) < 0)
+			last_pid = 1;
+	} while (find_task_by_pid(last_pid));
+	return nr;
 }
@@ -0,0 +1,132 @@
+/**
+* @file futex.c
+* @brief futex系统调用: 以用户空间的地址为键的睡眠和唤醒。
+*
+* 等待者挂在按照地址哈希的等待表中，等待项futex_q就放在等待者自己的内核栈上, 不需要分配内存。
+* 键是uaddr在线性地址空间中的地址(数据段基址 + uaddr), clone(CLONE_VM)创建的线程共享同一个
+* 线性地址空间，所以同一个变量得到的键是相同的。
+*/
+
+#include <errno.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/futex.h>
+#include <asm/segment.h>
+#include <asm/system.h>
+
+#define FUTEX_HASH_SZ 32
+#define futex_hashfn(key) (((key) >> 2) & (FUTEX_HASH_SZ - 1))
+
+struct futex_q
+{
+	unsigned long key;
+	struct task_struct* task;       // 被唤醒之后置为NULL
+	struct futex_q* next;
+};
+
+static struct futex_q* futex_queues[FUTEX_HASH_SZ] = {NULL, };
+
+/**
+* @brief 把等待项从哈希链表中取下来。
+* @return 如果等待项还在链表中返回1, 已经被FUTEX_WAKE取下返回0.
+*/
+static int futex_unqueue(struct futex_q* q)
+{
+	struct futex_q** pp = &futex_queues[futex_hashfn(q->key)];
+
+	for (; *pp; pp = &(*pp)->next)
+	{
+		if (*pp == q)
+		{
+			*pp = q->next;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+* @brief 在key上等待。
+*
+* 先把自己挂到等待表中，再读取*uaddr与val比较: get_fs_long()可能因为缺页而睡眠, 如果先读取再挂入
+* 等待表，期间别的线程修改了值并调用FUTEX_WAKE, 这次唤醒就丢失了。
+*/
+static int futex_wait(unsigned long key, int* uaddr, int val)
+{
+	struct futex_q q;
+	struct futex_q** head = &futex_queues[futex_hashfn(key)];
+
+	q.key = key;
+	q.task = current;
+	q.next = *head;
+	*head = &q;
+
+	if ((int)get_fs_long((unsigned long*)uaddr) != val)
+	{
+		futex_unqueue(&q);
+		return -EAGAIN;
+	}
+
+	// 被FUTEX_WAKE唤醒时q.task已经被清空了，其它的唤醒(信号)要继续判断
+	while (q.task)
+	{
+		if (current->signal & ~current->blocked)
+		{
+			futex_unqueue(&q);
+			return -EINTR;
+		}
+		current->state = TASK_INTERRUPTIBLE;
+		schedule();
+	}
+	return 0;
+}
+
+/**
+* @brief 唤醒最多nr个在key上等待的进程。
+* @return 返回唤醒的进程个数。
+*/
+static int futex_wake(unsigned long key, int nr)
+{
+	struct futex_q** pp = &futex_queues[futex_hashfn(key)];
+	struct futex_q* q;
+	int woken = 0;
+
+	while ((q = *pp) && woken < nr)
+	{
+		if (q->key != key)
+		{
+			pp = &q->next;
+			continue;
+		}
+		*pp = q->next;
+		wake_up(&q->task);
+		q->task = NULL;
+		woken++;
+	}
+	return woken;
+}
+
+/**
+* @brief futex系统调用。
+* @param [in] uaddr 用户空间中的一个int, 必须4字节对齐
+* @param [in] op FUTEX_WAIT或者FUTEX_WAKE
+* @param [in] val FUTEX_WAIT时是期望的*uaddr的值，FUTEX_WAKE时是最多唤醒的进程个数
+* @return 见futex_wait()和futex_wake(), 参数错误时返回-EINVAL.
+*/
+int sys_futex(int* uaddr, int op, int val)
+{
+	unsigned long key = (unsigned long)uaddr;
+
+	if (key & 3)
+		return -EINVAL;
+	key += get_base(current->ldt[2]);
+	switch (op)
+	{
+	case FUTEX_WAIT:
+		return futex_wait(key, uaddr, val);
+	case FUTEX_WAKE:
+		return futex_wake(key, val);
+	default:
+		return -EINVAL;
+	}
+}
@@ -0,0 +1,105 @@
+/**
+* @file profile.c
+* @brief 基于时钟中断的采样分析, 见linux/profile.h.
+*/
+
+#include <errno.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/profile.h>
+#include <asm/segment.h>
+
+unsigned long prof_buffer[PROF_LEN];       // 内核代码的采样直方图
+
+/**
+* @brief 用户缓冲区中的地址p现在能不能在中断中直接写: 页目录项和页表项都存在并且可写。 写时复制的页面
+* 是只读的, 386在内核态写时不检查写保护, 直接写会改掉与其它进程共享的页面。
+*/
+static int prof_writable(unsigned short* p)
+{
+	unsigned long addr = get_base(current->ldt[2]) + (unsigned long)p;
+	unsigned long dir = *(unsigned long*)((addr >> 20) & 0xffc);
+
+	if ((dir & 3) != 3)
+		return 0;
+	return (*(unsigned long*)((dir & 0xfffff000) + ((addr >> 10) & 0xffc)) & 3) == 3;
+}
+
+/**
+* @brief 在时钟中断中调用, 记录一次采样。
+* @param [in] cpl 被中断时的特权级
+* @param [in] eip 被中断时的eip
+*
+* 内核的代码段基址为0, eip就是内核代码的地址。 用户态时eip是代码段内的偏移，用户缓冲区在profil()中
+* 已经用verify_area()分配好了内存页，一般可以直接通过fs写入(时钟中断中fs为0x17, 即当前进程的数据段)。
+* 但fork()之后页面又变成了写时复制的, 也可能被换出, 这时不能在中断中处理缺页, 先记在prof_pending中,
+* 返回用户态之前由profile_flush()写入。
+*/
+void profile_tick(long cpl, unsigned long eip)
+{
+	unsigned long off;
+	unsigned short* p;
+
+	if (!cpl)
+	{
+		if ((eip >> PROF_SHIFT) < PROF_LEN)
+			prof_buffer[eip >> PROF_SHIFT]++;
+		return;
+	}
+	if (!current->prof_scale || eip < current->prof_off)
+		return;
+	off = ((unsigned long long)(eip - current->prof_off) * current->prof_scale) >> 16;
+	if (off + 1 >= current->prof_size)
+		return;
+	p = (unsigned short*)((unsigned long)current->prof_buf + (off & ~1));
+	if (!current->prof_pending && prof_writable(p))
+	{
+		put_fs_word(get_fs_word(p) + 1, (short*)p);
+		return;
+	}
+	// 只记一个计数器, 还没有写入时又落在另一个计数器上就丢弃前面的(很少见)
+	if (current->prof_pending && current->prof_pend_buf != p)
+		current->prof_pending = 0;
+	current->prof_pend_buf = p;
+	current->prof_pending++;
+}
+
+/**
+* @brief 把中断中没有写入的采样写到用户缓冲区中, 由ret_from_sys_call在返回用户态之前调用。 这时可以
+* 睡眠，verify_area()先解除写时复制。
+*/
+void profile_flush(void)
+{
+	unsigned short* p = current->prof_pend_buf;
+	unsigned long n = current->prof_pending;
+
+	current->prof_pending = 0;
+	if (!current->prof_scale)
+		return;
+	verify_area(p, 2);
+	put_fs_word(get_fs_word(p) + n, (short*)p);
+}
+
+/**
+* @brief profil()系统调用, 设置当前进程用户态的采样参数。
+* @param [in] param 用户空间中的采样参数, 见struct prof_param
+* @return 成功返回0, 参数不合法时返回-EINVAL.
+*/
+int sys_prof(struct prof_param* param)
+{
+	unsigned short* buf = (unsigned short*)get_fs_long((unsigned long*)&param->buf);
+	unsigned long size = get_fs_long(&param->size);
+	unsigned long scale = get_fs_long(&param->scale);
+
+	if (scale && (!buf || !size))
+		return -EINVAL;
+	// 先把缓冲区的内存页都分配好(并解除写时复制), 这样在时钟中断中写入时一般不会再缺页
+	if (scale)
+		verify_area(buf, size);
+	current->prof_pending = 0;
+	current->prof_buf = buf;
+	current->prof_size = size;
+	current->prof_off = get_fs_long(&param->offset);
+	current->prof_scale = scale;
+	return 0;
+}
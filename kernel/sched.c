@@ -1,7 +1,11 @@
+#include <errno.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <linux/sys.h>
 #include <linux/fdreg.h>
+#include <linux/kstat.h>
+#include <linux/trace.h>
+#include <linux/profile.h>
 #include <asm/system.h>
 #include <asm/io.h>
 #include <asm/segment.h>
@@ -52,12 +56,30 @@ union task_union
 	char stack[PAGE_SIZE];
 };
 
+// 任务0的文件表、文件系统信息和信号处理函数表
+static struct files_struct init_files = INIT_FILES;
+static struct fs_struct init_fs = INIT_FS;
+static struct signal_struct init_signals = INIT_SIGNALS;
+
 static union stask_union init_task = {INIT_TASK};
 volatile long jiffies = 0;
 long startup_time = 0;               // 开机时间，从1970年1月1日起经过的秒数
+int need_resched = 0;                // 需要重新调度的标志, 在ret_from_sys_call中检测
 struct task_struct* current = &(init_task.task);
 struct task_struct* last_task_used_math = NULL;
+int fpu_fxsr = 0;
+int fpu_sse = 0;
+int has_tsc = 0;                     // CPU有时间戳计数器(rdtsc指令), 在sched_init()中检测
+struct kstat_fpu fpu_stats;                    // 协处理器的统计, 通过kstat设备的次设备号4读取
+static struct i387_fxsave_struct init_fpu_state;   // fpu_init()中保存的协处理器初始状态
 struct task_struct* task[NR_TASKS] = {&(init_task.task), };
+struct tss_struct init_tss = INIT_TSS;  // 全局唯一的TSS, 每次进程切换时更新其中的esp0
+int mm_count[NR_TASKS] = {1, };         // 任务槽对应的线性地址空间的使用计数, 不为0时该任务槽不能再分配出去
+struct task_struct* pidhash[PIDHASH_SZ];
+struct task_struct* pgrphash[PIDHASH_SZ];
+struct task_struct* sesshash[PIDHASH_SZ];
+static int free_taskslot[NR_TASKS];     // 空闲任务槽的栈, 在sched_init()中初始化
+static int nr_free_taskslot = 0;        // 栈中空闲任务槽的个数
 long user_task[PAGE_SIZE >> 2];
 struct
 {
@@ -65,6 +87,92 @@ struct
 	short b;
 } stack_start = {&user_task[PAGE_SIZE >> 2], 0x10};    // 设置栈的上面定义的user_task数组的尾部。
 
+/** @brief 把进程加入到pid哈希表中，在创建进程时调用。 */
+void hash_pid(struct task_struct* p)
+{
+	struct task_struct** htable = &pidhash[pid_hashfn(p->pid)];
+
+	if ((p->pidhash_next = *htable))
+		(*htable)->pidhash_pprev = &p->pidhash_next;
+	*htable = p;
+	p->pidhash_pprev = htable;
+}
+
+/** @brief 把进程从pid哈希表中删除，在释放进程时调用。 */
+void unhash_pid(struct task_struct* p)
+{
+	if (p->pidhash_next)
+		p->pidhash_next->pidhash_pprev = p->pidhash_pprev;
+	*p->pidhash_pprev = p->pidhash_next;
+}
+
+/** @brief 根据pid查找进程。
+* @param [in] pid 进程号
+* @return 找到时返回进程的task_struct指针，否则返回NULL. 注意僵死进程也会被找到。
+*/
+struct task_struct* find_task_by_pid(int pid)
+{
+	struct task_struct* p = pidhash[pid_hashfn(pid)];
+
+	while (p && p->pid != pid)
+		p = p->pidhash_next;
+	return p;
+}
+
+/** @brief 把进程加入到它的进程组(p->pgrp)所在的哈希链表中。 */
+void link_pgrp(struct task_struct* p)
+{
+	struct task_struct** htable = &pgrphash[pid_hashfn(p->pgrp)];
+
+	if ((p->pg_next = *htable))
+		(*htable)->pg_pprev = &p->pg_next;
+	*htable = p;
+	p->pg_pprev = htable;
+}
+
+/** @brief 把进程从它的进程组所在的哈希链表中删除, 修改pgrp之前要先调用它。 */
+void unlink_pgrp(struct task_struct* p)
+{
+	if (p->pg_next)
+		p->pg_next->pg_pprev = p->pg_pprev;
+	*p->pg_pprev = p->pg_next;
+}
+
+/** @brief 把进程加入到它的会话(p->session)所在的哈希链表中。 */
+void link_session(struct task_struct* p)
+{
+	struct task_struct** htable = &sesshash[pid_hashfn(p->session)];
+
+	if ((p->sess_next = *htable))
+		(*htable)->sess_pprev = &p->sess_next;
+	*htable = p;
+	p->sess_pprev = htable;
+}
+
+/** @brief 把进程从它的会话所在的哈希链表中删除, 修改session之前要先调用它。 */
+void unlink_session(struct task_struct* p)
+{
+	if (p->sess_next)
+		p->sess_next->sess_pprev = p->sess_pprev;
+	*p->sess_pprev = p->sess_next;
+}
+
+/** @brief 从空闲任务槽的栈中取出一个任务槽。
+* @return 返回任务槽在task数组中的索引，没有空闲的任务槽时返回-1.
+*/
+int get_free_taskslot(void)
+{
+	if (!nr_free_taskslot)
+		return -1;
+	return free_taskslot[--nr_free_taskslot];
+}
+
+/** @brief 把任务槽放回到空闲任务槽的栈中, 在进程被释放或者创建进程失败时调用。 */
+void put_free_taskslot(int nr)
+{
+	free_taskslot[nr_free_taskslot++] = nr;
+}
+
 /** @brief 该函数主要完成数学协处理器的上下文的切换 */
 void math_state_restore()
 {
@@ -74,47 +182,228 @@ void math_state_restore()
 	__asm__("fwait");
 
 	if (last_task_used_math)
-	{
-		__asm__("fnsave %0"
-				::"m" (last_task_used_math->tss.i387));
-	}
+		save_fpu(last_task_used_math);
 
 	last_task_used_math = current;
+	current->fpu_loads++;
+	fpu_stats.loads++;
 	if (current->used_math)
+		restore_fpu(current);
+	else
 	{
-		__asm__("frstore %0"
-				::"m" (current->tss.i387));
+		// 第一次使用协处理器, 使用开机时保存的初始状态, 这样XMM寄存器中不会留有其它进程的数据
+		if (fpu_fxsr)
+			__asm__("fxrstor %0"::"m" (init_fpu_state));
+		else
+			__asm__("fninit"::);
+		current->used_math = 1;
+		fpu_stats.inits++;
 	}
+}
+
+/** @brief 保存进程tsk的协处理器状态。 注意：fnsave之后协处理器被重新初始化，fxsave则不会。 */
+void save_fpu(struct task_struct* tsk)
+{
+	if (fpu_fxsr)
+		__asm__("fxsave %0":"=m" (tsk->thread.i387.fxsave));
+	else
+		__asm__("fnsave %0":"=m" (tsk->thread.i387.fsave));
+	fpu_stats.saves++;
+}
+
+/** @brief 把进程tsk保存的状态恢复到协处理器中。 */
+void restore_fpu(struct task_struct* tsk)
+{
+	if (fpu_fxsr)
+		__asm__("fxrstor %0"::"m" (tsk->thread.i387.fxsave));
 	else
+		__asm__("frstor %0"::"m" (tsk->thread.i387.fsave));
+}
+
+/** @brief 取CPUID功能号1返回的EDX(CPU的功能标志). 386和早期的486没有cpuid指令, 这时返回0.
+*/
+static unsigned long cpu_features(void)
+{
+	unsigned long f1, f2, edx;
+
+	// 能够修改EFLAGS中的ID位(第21位)说明CPU支持cpuid指令
+	__asm__("pushfl\n\t"
+		"popl %0\n\t"
+		"movl %0, %1\n\t"
+		"xorl $0x200000, %0\n\t"
+		"pushl %0\n\t"
+		"popfl\n\t"
+		"pushfl\n\t"
+		"popl %0\n\t"
+		"pushl %1\n\t"
+		"popfl"
+		:"=&r" (f1), "=&r" (f2));
+	if (!((f1 ^ f2) & 0x200000))
+		return 0;
+	__asm__("cpuid":"=d" (edx):"a" (1):"bx", "cx");
+	return edx;
+}
+
+/** @brief 检测CPU是否支持fxsave和SSE, 如果支持，在CR4中打开OSFXSR(以及OSXMMEXCPT), 这样用户态
+* 就可以使用SSE指令了。 然后保存协处理器的初始状态, 作为每一个进程第一次使用协处理器时的状态。
+*/
+static void fpu_init(unsigned long edx)
+{
+	unsigned long mxcsr = 0x1f80;       // 屏蔽所有的SIMD浮点异常
+
+	if (!(edx & (1 << 24)))             // FXSR
+		return;
+
+	fpu_fxsr = 1;
+	fpu_stats.fxsr = 1;
+	__asm__("movl %%cr4, %%eax\n\t"
+		"orl $0x200, %%eax\n\t"         // OSFXSR
+		"movl %%eax, %%cr4"
+		:::"ax");
+	if (edx & (1 << 25))                // SSE
 	{
-		__asm__("fninit"::);
-		current->used_math = 1;
+		fpu_sse = 1;
+		fpu_stats.sse = 1;
+		__asm__("movl %%cr4, %%eax\n\t"
+			"orl $0x400, %%eax\n\t"     // OSXMMEXCPT
+			"movl %%eax, %%cr4"
+			:::"ax");
 	}
+	clts();
+	__asm__("fninit"::);
+	if (fpu_sse)
+		__asm__("ldmxcsr %0"::"m" (mxcsr));
+	__asm__("fxsave %0":"=m" (init_fpu_state));
+	stts();
 }
 
-/** @brief 进程调度函数。 */
-void schedule(void)
+/** @brief 进程切换时的统计：累计当前进程的运行周期数，记录主动/被动切换的次数。
+* @param [in] next 接下来要运行的进程在task数组中的索引
+*
+* 如果当前进程切换出去时仍然是TASK_RUNNING状态，说明它是被抢占的(被动切换)，否则是主动睡眠的。
+*/
+static inline void account_switch(int next)
 {
-	int i, next, c;
-	struct task_struct** p;
+	unsigned long long now;
 
-	for (p = &LAST_TASK; p > &FIRST_TASK; --p)
+	if (task[next] == current)
+		return;
+	trace_event(TRACE_SWITCH, task[next]->pid, current->state, 0);
+	read_stamp(now);
+	current->cycles += now - current->switch_stamp;
+	task[next]->switch_stamp = now;
+	if (current->state == TASK_RUNNING)
+		current->nivcsw++;
+	else
+		current->nvcsw++;
+}
+
+struct kstat_syscall syscall_stats[NR_SYSCALLS];    // 每一个系统调用的统计, 通过kstat设备的次设备号1读取
+
+/** @brief 系统调用返回时的统计, 在_system_call中调用系统调用函数之后调用。
+* 调用次数和耗时按照current->sc_nr累计，耗时按照log2放入直方图中。
+* @param [in] ret 系统调用的返回值(_system_call中压入栈的eax)
+*/
+void syscall_account(long ret)
+{
+	struct kstat_syscall* s = syscall_stats + current->sc_nr;
+	unsigned long long now, delta;
+	unsigned long lo;
+	int bucket;
+
+	read_stamp(now);
+	delta = now - current->sc_stamp;
+	s->count++;
+	s->cycles += delta;
+
+	if (delta >> 32)
+		bucket = KSTAT_HIST_BUCKETS - 1;
+	else if (!(lo = (unsigned long)delta))
+		bucket = 0;
+	else
 	{
-		if (*p)
+		__asm__("bsrl %1, %0" : "=r" (bucket) : "r" (lo));
+		bucket -= KSTAT_HIST_SHIFT;
+		if (bucket < 0)
+			bucket = 0;
+		else if (bucket >= KSTAT_HIST_BUCKETS)
+			bucket = KSTAT_HIST_BUCKETS - 1;
+	}
+	s->hist[bucket]++;
+	trace_event(TRACE_SYSCALL, current->sc_nr, ret, (long)delta);
+}
+
+/** @brief 从可运行的实时进程中挑选出rt_priority最大的那一个。
+* @return 返回挑选出的进程在task数组中的索引，如果没有可运行的实时进程，返回-1.
+*
+* 查找是从当前进程的下一个进程开始循环进行的，当前进程最后一个被检查：
+* 1. 如果当前进程是SCHED_FIFO进程，或者是时间片还没有用完的SCHED_RR进程，则它先成为候选者，
+*    只有优先级严格大于它的实时进程才能抢占它。
+* 2. 如果当前进程是时间片已经用完的SCHED_RR进程，则重新装满它的时间片，并且同优先级的其它
+*    实时进程排在它的前面, 这样就实现了同优先级进程之间的轮转。
+*/
+static int pick_rt_task(void)
+{
+	int i, n, cur, next, c;
+	struct task_struct* p;
+
+	for (cur = 0; cur < NR_TASKS; ++cur)
+	{
+		if (task[cur] == current)
+			break;
+	}
+
+	next = -1;
+	c = 0;
+	if (current->policy != SCHED_OTHER && current->state == TASK_RUNNING)
+	{
+		if (current->policy == SCHED_RR && !current->counter)
+			current->counter = current->priority;
+		else
 		{
-			// 检测一下定时器到时的进程, 如果已经到时间，给设置一个信号。
-			if ((*p)->alarm && (*p)->alarm < jiffies)
-			{
-				(*p)->signal |= _S(nr);
-				(*p)->alarm = 0;
-			}
+			next = cur;
+			c = current->rt_priority;
+		}
+	}
 
-			// 焕醒一些获得信号的进程, 即把该进程由task_interruptible状态修改为task_running状态。
-			if (((*p)->signal & ~(_BLOCKABLE & (*p)->blocked))
-				&& (*p)->state == TASK_INTERRUPTIBLE)
-				(*p)->state = TASK_RUNNING;
+	for (n = 1; n <= NR_TASKS; ++n)
+	{
+		i = (cur + n) % NR_TASKS;
+		if (!(p = task[i]) || i == next)
+			continue;
+		if (p->policy == SCHED_OTHER || p->state != TASK_RUNNING)
+			continue;
+		if (p->rt_priority > c)
+		{
+			c = p->rt_priority;
+			next = i;
 		}
 	}
+	return next;
+}
+
+/** @brief 进程调度函数。
+*
+* 首先从可运行的实时进程中选择，只有没有可运行的实时进程时，才使用原来基于counter的方法
+* 从普通进程中选择。
+*/
+void schedule(void)
+{
+	int i, next, c;
+	struct task_struct** p;
+
+	// 以前每一次调度都要扫描所有的进程，检查alarm是否到时以及唤醒收到信号的进程。 现在alarm在do_timer()中
+	// 检查, 收到信号的进程由signal_wake_up()直接唤醒。 这里只需要处理当前进程在睡眠之前已经有未屏蔽的信号的情况。
+	if (current->state == TASK_INTERRUPTIBLE && (current->signal & ~(_BLOCKABLE & current->blocked)))
+		current->state = TASK_RUNNING;
+
+	need_resched = 0;
+	if ((next = pick_rt_task()) >= 0)
+	{
+		account_switch(next);
+		switch_to(next);
+		return;
+	}
 
 	while (1)
 	{
@@ -139,13 +428,14 @@ void schedule(void)
 
 		// 如果所有的task_running状态的进程的counter都为0了，更新每一个进程的counter值
 		// 注意：从代码中可以看出，它更新的是每一个进程的counter值，而不仅仅是task_running的进程。
-		// 为什么要这么做呢？
+		// 为什么要这么做呢？ 实时进程的counter只作为SCHED_RR的时间片使用，不在这里更新。
 		for (p = &LAST_TASK; p > &FIRST_TASK; --p)
 		{
-			if (*p)
+			if (*p && (*p)->policy == SCHED_OTHER)
 				(*p)->counter = ((*p)->counter >> 1) + (*p)->priority;
 		}
 	}
+	account_switch(next);
 	switch_to(next);
 }
 
@@ -169,6 +459,7 @@ int sys_pause(void)
 void sleep_on(struct task_struct **p)
 {
 	struct task_struct *tmp;
+	long start;
 	if (!p)
 		return;
 
@@ -178,7 +469,10 @@ void sleep_on(struct task_struct **p)
 	tmp = *p;
 	*p = current;
 	current->state = TASK_UNINTERRUPTIBLE;
+	trace_event(TRACE_SLEEP, (long)p, 0, 0);
+	start = jiffies;
 	schedule();
+	current->sleep_time += jiffies - start;
 	if (tmp)
 		tmp->state = TASK_RUNNING;
 }
@@ -190,6 +484,7 @@ void sleep_on(struct task_struct **p)
 void interruptible_sleep_on(struct task_struct **p)
 {
 	struct task_struct *tmp;
+	long start;
 	if (!p)
 		return;
 
@@ -198,9 +493,12 @@ void interruptible_sleep_on(struct task_struct **p)
 
 	tmp = *p;
 	*p = current;
+	trace_event(TRACE_SLEEP, (long)p, 1, 0);
 repeat:
 	current->state = TASK_INTERRUPTIBLE;
+	start = jiffies;
 	schedule();
+	current->sleep_time += jiffies - start;
 	if (*p && *p!= current)
 	{
 		(**p).state = TASK_RUNNING;
@@ -211,15 +509,60 @@ repeat:
 		tmp->state = 0;
 }
 
+/** @brief 检测被唤醒的进程是否应该抢占当前进程，如果是，则设置need_resched标志，
+* 这样在下一次从内核返回用户态时(ret_from_sys_call)就会重新调度。
+* @param [in] p 被唤醒的进程
+*/
+static inline void check_preempt(struct task_struct* p)
+{
+	// 普通进程之间比较剩余的时间片, 睡眠了一段时间的交互式进程的counter一般比正在运行的计算型进程大。
+	if (p->policy == SCHED_OTHER)
+	{
+		if (current->policy == SCHED_OTHER && p->counter > current->counter)
+			need_resched = 1;
+		return;
+	}
+	if (current->policy == SCHED_OTHER || p->rt_priority > current->rt_priority)
+		need_resched = 1;
+}
+
 /** @brief 有点不太明白，对不对？ */
 void wake_up(struct task_struct **p)
 {
-	if (p && **p)
+	if (p && *p)
 	{
+		trace_event(TRACE_WAKEUP, (*p)->pid, 0, 0);
 		(**p).state = TASK_RUNNING;
+		check_preempt(*p);
+	}
+}
+
+/** @brief 给进程p设置信号sig, 如果p在可中断睡眠中并且该信号没有被屏蔽, 立即唤醒它。
+* 所有设置信号的地方都应该调用该函数, schedule()中不再扫描所有的进程来唤醒收到信号的进程。
+* 可以在中断中调用(例如do_timer()中的alarm).
+*/
+void signal_wake_up(struct task_struct* p, int sig)
+{
+	p->signal |= _S(sig);
+	if (p->state == TASK_INTERRUPTIBLE && (p->signal & ~(_BLOCKABLE & p->blocked)))
+	{
+		p->state = TASK_RUNNING;
+		check_preempt(p);
 	}
 }
 
+/** @brief 内核中的可抢占点。
+*
+* 内核代码本身是不可抢占的，以前只有在ret_from_sys_call返回用户态时才会重新调度。 在内核中很长的循环里
+* (例如sys_sync()遍历所有的缓冲块)调用该函数，如果中断中唤醒了需要运行的进程(设置了need_resched),
+* 并且当前进程没有持有锁, 就在这里让出CPU.
+*/
+void cond_resched(void)
+{
+	if (need_resched && !current->preempt_count && current != task[0])
+		schedule();
+}
+
 #define TIME_REQUESTS 64        // 最多可以有64个定时器。
 // 定时器链表
 static struct timer_list
@@ -229,6 +572,28 @@ static struct timer_list
 	struct timer_list* next;
 } timer_list[TIME_REQUESTS], *next_timer = NULL;
 
+static long next_alarm = 0;     // 所有进程中最早到期的alarm时间, 为0时表示没有设置alarm
+
+/** @brief 给alarm到时的进程发送SIGALRM信号，并重新计算next_alarm. 只有next_alarm到期时才在do_timer()中调用。 */
+static void check_alarms(void)
+{
+	struct task_struct** p;
+
+	next_alarm = 0;
+	for (p = &LAST_TASK; p > &FIRST_TASK; --p)
+	{
+		if (!*p || !(*p)->alarm)
+			continue;
+		if ((*p)->alarm <= jiffies)
+		{
+			(*p)->alarm = 0;
+			signal_wake_up(*p, SIGALRM);
+		}
+		else if (!next_alarm || (*p)->alarm < next_alarm)
+			next_alarm = (*p)->alarm;
+	}
+}
+
 /** @brief 添加定时器。
 *
 * @param [in] jiffies 指定的定时值, 应该是相对值
@@ -273,8 +638,9 @@ void add_timer(long jiffies, void(*fn)(void))
 /** @brief 时钟中断处理程序
 *
 * @param [in] cpl 当前的特权级
+* @param [in] eip 被时钟中断打断的指令地址, 用于采样分析(见kernel/profile.c)
 */
-void do_timer(long cpl)
+void do_timer(long cpl, unsigned long eip)
 {
 	// 与扬声器发声有关
 	extern int beepcount;
@@ -288,6 +654,15 @@ void do_timer(long cpl)
 		current->utime++;
 	else
 		current->stime++;
+	profile_tick(cpl, eip);
+
+	// 递减当前进程的时间片, SCHED_FIFO进程没有时间片的限制。 时间片用完时并不直接调用schedule(),
+	// 而是设置need_resched, 在ret_from_sys_call返回用户态之前进行调度。
+	if (current->policy != SCHED_FIFO && current->counter > 0)
+	{
+		if (!--current->counter)
+			need_resched = 1;
+	}
 
 	// 处理定时器
 	if (next_timer)
@@ -302,6 +677,9 @@ void do_timer(long cpl)
 			fn();
 		}
 	}
+
+	if (next_alarm && next_alarm <= jiffies)
+		check_alarms();
 }
 
 /** @brief 系统调用功能： 设置报警定时的时间值。如果已经设置过，则返回旧值, 否则返回0
@@ -312,6 +690,9 @@ int sys_alarm(long seconds)
 	if (old)
 		old = (old - jiffies) / HZ;
 	current->alarm = (seconds > 0) ? (jiffies + HZ * seconds) : 0;
+	// 取消alarm时不需要更新next_alarm, 到期时check_alarms()会重新计算
+	if (current->alarm && (!next_alarm || current->alarm < next_alarm))
+		next_alarm = current->alarm;
 	return old;
 }
 
@@ -355,16 +736,75 @@ int sys_nice(long increment)
 	return 0;
 }
 
+/** @brief 根据pid查找进程, pid为0时表示当前进程。 */
+static struct task_struct* find_sched_task(int pid)
+{
+	if (!pid)
+		return current;
+	return find_task_by_pid(pid);
+}
+
+/** @brief 系统调用：设置指定进程的调度策略和实时优先级。
+* @param [in] pid 进程号, 为0时表示当前进程
+* @param [in] policy 调度策略: SCHED_OTHER/SCHED_FIFO/SCHED_RR
+* @param [in] param 用户空间中的sched_param结构指针, 里面存放了实时优先级
+* @return 成功时返回0，失败时返回错误码。
+*
+* 只有超级用户才能把进程设置为实时进程，普通用户只能把自己的进程设置为SCHED_OTHER.
+*/
+int sys_sched_setscheduler(int pid, int policy, struct sched_param* param)
+{
+	struct task_struct* p;
+	int prio;
+
+	if (policy != SCHED_OTHER && policy != SCHED_FIFO && policy != SCHED_RR)
+		return -EINVAL;
+	if (!param)
+		return -EINVAL;
+	prio = get_fs_long((unsigned long*)&param->sched_priority);
+	if (policy == SCHED_OTHER ? (prio != 0) : (prio < 1 || prio > MAX_RT_PRIO))
+		return -EINVAL;
+	if (!(p = find_sched_task(pid)))
+		return -ESRCH;
+	if (policy != SCHED_OTHER && !suser())
+		return -EPERM;
+	if (current->euid != p->euid && !suser())
+		return -EPERM;
+
+	p->policy = policy;
+	p->rt_priority = prio;
+	if (policy == SCHED_RR && !p->counter)
+		p->counter = p->priority;
+	need_resched = 1;
+	return 0;
+}
+
+/** @brief 系统调用：获取指定进程的调度策略。 */
+int sys_sched_getscheduler(int pid)
+{
+	struct task_struct* p;
+
+	if (!(p = find_sched_task(pid)))
+		return -ESRCH;
+	return p->policy;
+}
+
 void sched_init(void)
 {
+	unsigned long features;
 	int i;
 	struct desc_struct *p;
 
 	if (sizeof(struct sigaction) != 16)
 		panic("Struct sigaction MUST be 16 bytes");
-	set_tss_desc(gdt + FIRST_TSS_ENTRY, &(init_task.task.tss));
+	features = cpu_features();
+	has_tsc = (features >> 4) & 1;      // TSC, 没有时各种时间戳用jiffies代替(见read_stamp())
+	fpu_init(features);
+	// 整个系统只使用一个TSS描述符和一个LDT描述符, 进程切换时只修改LDT描述符的基地址。
+	set_tss_desc(gdt + FIRST_TSS_ENTRY, &init_tss);
 	set_ldt_desc(gdt + FIRST_LDT_ENTRY, &(init_task.task.ldt));
 
+	// GDT中原来为每一个任务预留的TSS/LDT描述符项不再使用了，清零。
 	p = gdt + 2 + FIRST_TSS_ENTRY;
 	for (i = 1; i < NR_TASKS; ++i)
 	{
@@ -374,9 +814,16 @@ void sched_init(void)
 		p->a = p->b = 0;
 		p++;
 	}
+
+	// 初始化空闲任务槽的栈, 倒序压入，这样最先分配出去的是任务槽1.
+	for (i = NR_TASKS - 1; i > 0; --i)
+		put_free_taskslot(i);
+	hash_pid(&init_task.task);
+	link_pgrp(&init_task.task);
+	link_session(&init_task.task);
 	__asm__("pushfl; andl $0xffffbfff, (%esp); popfl");
-	ltr(0);
-	lldt(0);
+	ltr();
+	lldt();
 
 	outb_p(0x36, 0x43);
 	outb_p(LATCH & 0xff, 0x40);
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <asm/segment.h>
@@ -64,8 +65,8 @@ int sys_signal(int signum, long handler, long restorer)
 	tmp.sa_restorer = (void (*)(int))restorer;
 
 	// 通过下面的代码可以看出，在一个任务中，对于每一个信号(共32个信号)都有一个sigaction数据结构
-	handler = (long)current->sigaction[signum - 1].sa_handler;
-	current->sigaction[signum - 1] = tmp;
+	handler = (long)current->sig->action[signum - 1].sa_handler;
+	current->sig->action[signum - 1] = tmp;
 	return handler;
 }
 
@@ -76,18 +77,100 @@ int sys_sigaction(int signum, const struct sigaction* action, struct sigaction*
 	struct sigaction tmp;
 	if (signum < 1 || signum > 32 || signum == SIGKILL)
 		return -1;
-	tmp = current->sigaction[signum - 1];
-	get_new((char*)action, (char*)(signum - 1 + current->sigaction));      // 这个地方为什么要这么做呢？为什么不能直接使用赋值语句呢？
+	tmp = current->sig->action[signum - 1];
+	get_new((char*)action, (char*)(signum - 1 + current->sig->action));      // 这个地方为什么要这么做呢？为什么不能直接使用赋值语句呢？
 	if (oldaction)
 		save_old((char*)&tmp, (char*)oldaction);    // 为什么要这么做呢？为什么不能直接使用赋值语句呢？
 
-	if (current->sigaction[signum - 1].sa_flags & SA_NOMASK)
-		current->sigaction[signum - 1].sa_mask = 0;
+	if (current->sig->action[signum - 1].sa_flags & SA_NOMASK)
+		current->sig->action[signum - 1].sa_mask = 0;
 	else
-		current->sigaction[signum - 1].sa_mask |= (1 << (signum - 1));
+		current->sig->action[signum - 1].sa_mask |= (1 << (signum - 1));
 	return 0;
 }
 
+#define NR_SIGQUEUE 64          // 系统中最多可以同时排队的实时信号个数
+static struct sigqueue sigqueue_pool[NR_SIGQUEUE];
+
+/** @brief sigqueue()系统调用, 给进程pid发送一个排队的实时信号。
+* @param [in] pid 目标进程
+* @param [in] sig 信号, 必须是SIGRTMIN~SIGRTMAX之间的实时信号
+* @param [in] value 随信号一起递送的值
+* @return 成功返回0; 排队的信号太多时返回-EAGAIN.
+*/
+int sys_sigqueue(int pid, int sig, long value)
+{
+	struct task_struct* p;
+	struct sigqueue *q, **pp;
+
+	if (sig < SIGRTMIN || sig > SIGRTMAX)
+		return -EINVAL;
+	if (!(p = find_task_by_pid(pid)) || p->state == TASK_ZOMBIE)
+		return -ESRCH;
+	if (current->euid != p->euid && !suser())
+		return -EPERM;
+
+	for (q = sigqueue_pool; q < sigqueue_pool + NR_SIGQUEUE; ++q)
+	{
+		if (!q->signo)
+			break;
+	}
+	if (q >= sigqueue_pool + NR_SIGQUEUE)
+		return -EAGAIN;
+	q->signo = sig;
+	q->value = value;
+	q->pid = current->pid;
+	q->next = NULL;
+	// 挂在队列的尾部，保证按照发送的顺序递送
+	for (pp = &p->sigq; *pp; pp = &(*pp)->next)
+		;
+	*pp = q;
+	signal_wake_up(p, sig);
+	return 0;
+}
+
+/** @brief 从当前进程的队列中取出第一个编号为signr的实时信号, 返回它的值。
+* 如果队列中还有相同编号的信号，重新设置信号位，这样下一次返回用户态时会再递送一次。
+* 通过kill()发送的实时信号不排队，值为0.
+*/
+static long dequeue_rt_signal(long signr)
+{
+	struct sigqueue *q, **pp;
+	long value = 0;
+
+	for (pp = &current->sigq; (q = *pp); pp = &q->next)
+	{
+		if (q->signo == signr)
+		{
+			*pp = q->next;
+			value = q->value;
+			q->signo = 0;
+			break;
+		}
+	}
+	for (q = *pp; q; q = q->next)
+	{
+		if (q->signo == signr)
+		{
+			current->signal |= 1 << (signr - 1);
+			break;
+		}
+	}
+	return value;
+}
+
+/** @brief 进程退出时释放还没有递送的排队信号。 */
+void flush_sigqueue(struct task_struct* p)
+{
+	struct sigqueue* q;
+
+	while ((q = p->sigq))
+	{
+		p->sigq = q->next;
+		q->signo = 0;
+	}
+}
+
 /** @brief 该函数在系统调用中断处理函数中使用到。它修改了内核栈中的返回地址的值，使它指向了信号处理函数。
 * 当程序从内核空间返回到用户空间时，需要从内核栈切换到用户栈，所以呢，在执行信号处理函数时，程序工作在用户态下,
 * 它此时使用的是原本属于用户进程的程序的栈。 在信号处理函数执行过程中，可能会破坏原返回地址处程序的寄存器的内容，
@@ -99,8 +182,13 @@ void do_signal(long signr, long eax, long ebx, long ecx, long edx, long fs, long
 {
 	unsigned long sa_handler;
 	long old_eip = eip;
-	struct sigaction* sa = current->sigaction + signr - 1;
-	int longs;
+	struct sigaction* sa = current->sig->action + signr - 1;
+	int longs, flags;
+	long value = 0;
+
+	// 排队的实时信号即使被忽略也要出队
+	if (signr >= SIGRTMIN)
+		value = dequeue_rt_signal(signr);
 
 	sa_handler = (unsigned long)sa->sa_handler;
 	if (sa_handler == SIG_DEL)        // 如果信号处理程序为忽略信号处理程序，则返回就可以了， SIG_DEL在signal.h文件中定义。
@@ -113,6 +201,8 @@ void do_signal(long signr, long eax, long ebx, long ecx, long edx, long fs, long
 			do_exit(1 << (signr - 1));    // 此时，为什么要终止当前进程呢？可能是因为这个信号我处理不了，并且我也不能忽略的原因？？？
 	}
 
+	// SA_ONESHOT会清掉sa_flags, 决定是否传递排队信息要用清除之前的值
+	flags = sa->sa_flags;
 	if (sa->sa_flags & SA_ONESHOT)
 		sa->sa_flags = NULL;
 
@@ -121,6 +211,8 @@ void do_signal(long signr, long eax, long ebx, long ecx, long edx, long fs, long
 	                            // 为什么要要修改局部变量的值呢？  其实吧，它就是要修改内核栈中的值,是栈上的值哦。。。
 
 	longs = (sa->sa_flags & SA_NOMASK) ? 7 : 8;
+	if (flags & SA_SIGINFO)
+		longs++;
 	*(&esp) -= longs;
 
 	verify_area(esp, longs * 4);
@@ -128,6 +220,8 @@ void do_signal(long signr, long eax, long ebx, long ecx, long edx, long fs, long
 	tmp_esp = esp;
 	put_fs_long((long)sa->sa_restorer, tmp_esp++);
 	put_fs_long(signr, tmp_esp++);
+	if (flags & SA_SIGINFO)
+		put_fs_long(value, tmp_esp++);
 	if (!(sa->sa_flags & SA_NOMASK))
 		put_fs_long(current->blocked, tmp_esp++);
 	put_fs_long(eax, tmp_esp++);
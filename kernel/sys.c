@@ -140,3 +140,58 @@ int sys_times(struct tms *tbuf)
 	}
 	return jiffies;
 }
+
+/**
+  @brief 设置进程的进程组号。
+  @param [in] pid 进程号, 为0时表示当前进程
+  @param [in] pgid 新的进程组号, 为0时使用pid作为进程组号
+  @return 成功返回0, 失败返回错误码。
+
+  会话首领不能改变进程组，也不能把进程移动到其它会话中。 修改pgrp时要同时把进程从原来进程组的
+  哈希链表移到新的链表中。
+*/
+int sys_setpgid(int pid, int pgid)
+{
+	struct task_struct* p;
+
+	if (!pid)
+		pid = current->pid;
+	if (!pgid)
+		pgid = pid;
+	if (!(p = find_task_by_pid(pid)))
+		return -ESRCH;
+	if (p->leader)
+		return -EPERM;
+	if (p->session != current->session)
+		return -EPERM;
+	unlink_pgrp(p);
+	p->pgrp = pgid;
+	link_pgrp(p);
+	return 0;
+}
+
+/**
+  @brief 获取当前进程的进程组号。
+*/
+int sys_getpgrp(void)
+{
+	return current->pgrp;
+}
+
+/**
+  @brief 创建一个新的会话，当前进程成为会话首领和新进程组的组长，并且没有控制终端。
+  @return 返回新的会话号(也就是当前进程的pid), 已经是会话首领的普通用户进程返回-EPERM.
+*/
+int sys_setsid(void)
+{
+	if (current->leader && !suser())
+		return -EPERM;
+	current->leader = 1;
+	unlink_pgrp(current);
+	unlink_session(current);
+	current->session = current->pgrp = current->pid;
+	link_pgrp(current);
+	link_session(current);
+	current->tty = -1;
+	return current->pgrp;
+}
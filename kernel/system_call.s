@@ -22,8 +22,11 @@ state = 0
 counter = 4
 priority = 8
 signal = 12
-sigaaction = 16
-blocked = 33 * 16
+sig = 16                   # 信号处理函数表的指针(struct signal_struct*)
+blocked = 20
+sc_nr = 28                 # 正在执行的系统调用号
+sc_stamp = 32              # 进入系统调用时的时间戳(64位)
+prof_pending = 40          # 时钟中断中没有能写入的用户态采样数
 
 /* signaction 结构体中一些变量的偏移量 */
 sa_handler = 0
@@ -32,11 +35,15 @@ sa_flags = 8
 sa_restorer = 12
 
 /* 总的系统调用数目 */
-nr_system_calls = 72
+nr_system_calls = 80
 
-.globl _system_call, _sys_fork, _timer_interrupt, _sys_execve
+/* 创建进程的选项, 与sched.h中的定义相同 */
+CLONE_VM = 0x00000100
+CLONE_VFORK = 0x00004000
+
+.globl _system_call, _sys_fork, _sys_vfork, _sys_clone, _timer_interrupt, _sys_execve
 .globl _hd_interrupt, _floppy_interrupt, _parallel_interrupt
-.globl _device_not_available, _coprocessor_error
+.globl _device_not_available, _coprocessor_error, _ret_from_fork
 
 .align 2
 bad_sys_call:            
@@ -62,16 +69,29 @@ _system_call:
     movl $0x17, %edx
     mov %dx, %fs
 
+    # 记录系统调用号和进入时的时间戳, 返回时由_syscall_account统计调用次数和耗时。
+    # 参数已经压入栈中了, ebx/edx可以随便使用。
+    movl _current, %ebx
+    movl %eax, sc_nr(%ebx)
+    cmpl $0, _has_tsc          # 386/486没有rdtsc指令, 用jiffies代替(见sched.h中的read_stamp)
+    je 1f
+    rdtsc
+    jmp 2f
+1:  movl _jiffies, %eax
+    xorl %edx, %edx
+2:  movl %eax, sc_stamp(%ebx)
+    movl %edx, sc_stamp+4(%ebx)
+    movl sc_nr(%ebx), %eax
+
     call _sys_call_table(, %eax, 4)    # 这里使用到了at&t汇编指令的寻址方式
-    pushl %eax                         # eax寄存器存放了系统调用的返回地址。
-    
-    movl _current， %eax
-    cmpl $0, state(%eax)
-    jne reschedule
-    cmpl $0, counter(%eax)
-    je reschedule
-    
-res_from_sys_call:
+    pushl %eax                         # eax寄存器存放了系统调用的返回值, 这是返回用户态时弹出的eax
+    pushl %eax                         # 再压一份作为_syscall_account的参数: C函数可以修改自己的参数,
+    call _syscall_account              # 不能让它改掉保存的返回值
+    addl $4, %esp
+
+    # 以前这里还要检查当前进程的state和counter. 现在时间片用完(do_timer)和唤醒了更应该运行的进程(check_preempt)
+    # 时都会设置need_resched, 睡眠的系统调用自己会调用schedule(), 所以只需要在ret_from_sys_call中检查need_resched.
+ret_from_sys_call:
     movl _current, %eax
     cmpl _task, %eax            # 判断当前任务是否为0任务
     je 3f
@@ -79,7 +99,13 @@ res_from_sys_call:
     jne 3f
     cmpw $0x17, OLDSS(%esp)
     jne 3f
-    
+    cmpl $0, _need_resched     # 返回用户态之前，如果设置了need_resched(时间片用完或者有更高优先级的实时进程被唤醒)，则重新调度
+    jne reschedule
+    cmpl $0, prof_pending(%eax)    # 时钟中断中没有能写入用户缓冲区的采样, 现在可以处理缺页了
+    je 1f
+    call _profile_flush
+    movl _current, %eax
+1:
     movl signal(%eax), %ebx
     movl blocked(%eax), %ecx
     notl %ecx
@@ -94,7 +120,7 @@ res_from_sys_call:
     call _do_signal
     
     popl %eax
-    popl %eax
+3:  popl %eax
     popl %ebx
     popl %ecx
     popl %edx
@@ -168,10 +194,11 @@ _timer_interrupt:
     outb %al, $0x20
     
     movl CS(%esp), %eax
-    addl $3, %eax
+    andl $3, %eax              # 被中断时的特权级
+    pushl EIP(%esp)            # 被中断时的eip, 用于采样分析
     pushl %eax
     call _do_timer
-    addl $4, %esp
+    addl $8, %esp
     jmp ret_from_sys_call
     
 .align 2
@@ -191,9 +218,54 @@ _sys_fork:
     pushl %edi
     pushl %ebp
     pushl %eax
+    pushl $0                   # newsp
+    pushl $0                   # clone_flags
     call _copy_process
-    addl $20, %esp
-    ret
+    addl $28, %esp
+1:  ret
+
+# vfork与fork相同, 只是clone_flags为CLONE_VM|CLONE_VFORK: 子进程共享父进程的地址空间，不复制页表。
+.align 2
+_sys_vfork:
+    call _find_empty_process
+    js 1f
+    push %gs
+    pushl %esi
+    pushl %edi
+    pushl %ebp
+    pushl %eax
+    pushl $0
+    pushl $CLONE_VM | CLONE_VFORK
+    call _copy_process
+    addl $28, %esp
+1:  ret
+
+# clone(flags, child_stack): ebx是共享哪些资源(CLONE_xxx), ecx是子进程的用户栈指针(为0时与父进程相同)。
+# ecx在调用find_empty_process时可能被修改，所以都从_system_call压入的栈帧中取。
+.align 2
+_sys_clone:
+    call _find_empty_process
+    js 1f
+    push %gs
+    pushl %esi
+    pushl %edi
+    pushl %ebp
+    pushl %eax
+    pushl 28(%esp)             # newsp, 即栈帧中的ecx
+    pushl 28(%esp)             # clone_flags, 即栈帧中的ebx
+    call _copy_process
+    addl $28, %esp
+1:  ret
+
+# 新进程第一次被调度运行时从这里开始执行(copy_process()中设置的thread.eip), 栈中的内容是copy_process()构造的：
+# 先是ebp/edi/esi/gs, 然后是与系统调用时相同的栈帧(其中eax为0)。
+.align 2
+_ret_from_fork:
+    popl %ebp
+    popl %edi
+    popl %esi
+    pop %gs
+    jmp ret_from_sys_call
     
 _hd_interrupt:
     pushl %eax
@@ -0,0 +1,42 @@
+/**
+* @file trace.c
+* @brief 内核事件跟踪的环形缓冲区, 见linux/trace.h.
+*
+* 写入时不加锁: 只在取得一个位置时短暂地关中断(386没有xaddl指令)，然后再填写该位置的记录。 中断中的
+* 跟踪点会取得下一个位置，不会与被打断的写入冲突。 序号seq最后写入，读取时seq与位置不符说明记录还没有写完
+* 或者已经被覆盖。
+*/
+
+#include <linux/sched.h>
+#include <linux/trace.h>
+#include <asm/system.h>
+
+struct trace_entry trace_buf[TRACE_SIZE];
+unsigned long trace_head = 0;           // 下一条记录的序号
+
+/**
+* @brief 记录一个事件。
+* @param [in] event 事件类型, TRACE_xxx
+* @param [in] a/b/c 事件的参数, 含义见linux/trace.h
+*/
+void trace_event(int event, long a, long b, long c)
+{
+	unsigned long seq;
+	struct trace_entry* e;
+
+	__asm__ __volatile__("pushfl\n\t"
+		"cli\n\t"
+		"movl %1, %0\n\t"
+		"incl %1\n\t"
+		"popfl"
+		: "=&r" (seq), "=m" (trace_head)
+		: "m" (trace_head));
+	e = trace_buf + (seq & (TRACE_SIZE - 1));
+	read_stamp(e->stamp);
+	e->event = event;
+	e->pid = current->pid;
+	e->a = a;
+	e->b = b;
+	e->c = c;
+	e->seq = seq;
+}
@@ -92,7 +92,9 @@ static void die(char* str, long esp_ptr, long nr)
 			printk("\n");
 		}
 
-		str(i);                // 该函数是一个宏定义，  在sched.h中定义
+		// 不再使用硬件任务切换，不能通过任务寄存器求出任务号了，在task数组中查找当前进程的索引。
+		for (i = 0; i < NR_TASKS && task[i] != current; ++i)
+			;
 		printk("Pid: %d, Process nr: %d\n\r", current->pid, 0xffff & i);
 		for (i = 0; i < 10, ++i)
 			printk("%02x", 0xff & get_seg_byte(esp[1], i + (char*)esp[0]));
@@ -11,6 +11,7 @@
 #include <linux/sched.h>
 #include <linux/head.h>
 #include <linux/kernel.h>
+#include <linux/trace.h>
 
 volatile void do_exit(long code);
 static inline volatile void oom(void)
@@ -143,6 +144,14 @@ int free_page_tables(unsigned long from, unsigned long size)
 		// 从页目录项中拿到页表地址(页表地址的低12位为0）
 		pg_table = (unsigned long*) (0xfffff000 & *dir);
 
+		// 页表还被其它进程共享着(见copy_page_tables()), 页表中的页面属于共享者，只减少页表的引用计数即可。
+		if ((unsigned long)pg_table >= LOW_MEM && mem_map[MAP_NR((unsigned long)pg_table)] > 1)
+		{
+			free_page((unsigned long)pg_table);
+			*dir = 0;
+			continue;
+		}
+
         // 遍历页表内的每一个页对应的物理地址，进行free_page操作。
 		for (nr = 0; nr < 1024; ++nr)
 		{
@@ -155,6 +164,14 @@ int free_page_tables(unsigned long from, unsigned long size)
         // 把页表对应的页也释放掉。
 		free_page(0xffff000 & *dir);
 		*dir = 0;
+
+		// 每释放完一个页表(1024个页)检查一次是否需要让出CPU, 让出之前先刷新页变换高速缓存,
+		// 因为释放的页面可能马上就会被其它进程使用。
+		if (need_resched)
+		{
+			invalidate();
+			cond_resched();
+		}
 	}
 
     // 修改了页目录与页表，因此刷新页目录与页表相关的高速缓存。
@@ -172,6 +189,11 @@ int free_page_tables(unsigned long from, unsigned long size)
   为了实现写时复制的功能，当拷贝内存页时，只拷贝相应的页表项，不会进行物理内存的分配动作。
   为新的地址申请一个新的内存页用当作页表并把新页表的地址加到页目录中，然后再源地址的页表
   内容设置为只读后，再拷贝一份放到新建的页表中。
+
+  现在连页表也是延迟复制的：父子进程的页目录项指向同一个页表，两个页目录项都设置为只读，并且增加
+  页表所在页的mem_map计数。 fork之后马上exec的进程根本不需要复制页表。 只有某一方第一次写这4M的范围
+  (或者要修改页表)时，才在unshare_page_table()中真正复制页表。 任务0的页表在LOW_MEM以下，不能共享,
+  仍然立即复制。
 */
 int copy_page_tables(unsigned long from, unsigned long to, long size)
 {
@@ -198,6 +220,14 @@ int copy_page_tables(unsigned long from, unsigned long to, long size)
 			panic("copy_page_tables: already exist");
 
 		from_page_table = (unsigned long*)(*from_dir & 0xfffff000);
+		if ((unsigned long)from_page_table >= LOW_MEM)
+		{
+			*from_dir &= ~2;
+			*to_dir = *from_dir;
+			++mem_map[MAP_NR((unsigned long)from_page_table)];
+			continue;
+		}
+
 		if (!(to_page_table = (unsigned long*)get_free_page()))
 			return -1;
 
@@ -226,6 +256,51 @@ int copy_page_tables(unsigned long from, unsigned long to, long size)
 	return 0;
 }
 
+/**
+  @brief 解除页表的共享: 为页目录项dir复制一个私有的页表。
+  @param [in] dir 页目录项的地址(也是它的物理地址), 它指向的页表是只读共享的。
+
+  复制时把新旧两个页表中的页表项都设置为只读，并且增加每一个页面的mem_map计数，这样之后对这些页面的
+  写操作就交给普通的写时复制(un_wp_page)处理了。 如果其它共享者已经解除了共享(页表的计数为1),
+  只需要把页目录项重新设置为可写。
+*/
+static void unshare_page_table(unsigned long* dir)
+{
+	unsigned long old_table;
+	unsigned long new_table;
+	unsigned long page;
+	unsigned long* from;
+	unsigned long* to;
+	int nr;
+
+	old_table = *dir & 0xfffff000;
+	if (old_table < LOW_MEM || mem_map[MAP_NR(old_table)] == 1)
+	{
+		*dir |= 2;
+		invalidate();
+		return;
+	}
+
+	if (!(new_table = get_free_page()))
+		oom();
+	from = (unsigned long*)old_table;
+	to = (unsigned long*)new_table;
+	for (nr = 0; nr < 1024; ++nr, ++from, ++to)
+	{
+		page = *from;
+		if (!(1 & page))
+			continue;
+		page &= ~2;
+		*from = page;
+		*to = page;
+		if (page >= LOW_MEM)
+			++mem_map[MAP_NR(page)];
+	}
+	--mem_map[MAP_NR(old_table)];
+	*dir = new_table | 7;
+	invalidate();
+}
+
 /** 
   @brief 功能：把给定的一个内存页分配到给定的线性地址上.
 * @param [in] page 内存页的物理地址
@@ -249,7 +324,11 @@ unsigned long put_page(unsigned long page, unsigned long address)
 
     // 如果对应的页目录项存在时，直接拿里面的物理地址就可以；如果不存在的话，就申请一个新的页用于页表。
 	if (*page_table & 1)
+	{
+		if (!(*page_table & 2))       // 页表是共享的，先复制一份私有的
+			unshare_page_table(page_table);
 		page_table = (unsigned long*)(*page_table & 0xfffff000);	// 页表的物理地址
+	}
 	else
 	{
 		if (!(temp = get_free_page()))
@@ -315,6 +394,18 @@ void do_wp_page(unsigned long error_code, unsigned long address)
 		do_exit(SIGSEGV);
 #endif 
 
+	unsigned long* dir = (unsigned long*)((address >> 20) & 0xffc);
+
+	current->min_flt++;
+	trace_event(TRACE_WP_PAGE, address, error_code, 0);
+
+	// 页目录项是只读的，说明页表还是共享的。 先解除页表的共享，然后返回重新执行写操作, 如果页表项也是只读的，
+	// 会再一次产生写保护异常。
+	if (!(*dir & 2))
+	{
+		unshare_page_table(dir);
+		return;
+	}
 	un_wp_page((unsigned long*)
 			(((address >> 10) & 0xffc) +                     // 页表内的偏移地址 + 页表地址 = 页表项地址
 			 (0xfffff000 & *((unsigned long*)                // 页表的物理地址
@@ -332,6 +423,13 @@ void write_verify(unsigned long address)
 	unsigned long page = *((unsigned long*)((address >> 20) & 0xffc));     // address对应的页目录项的页表
 	if (!(page & 1))        // 为什么不存在页表时，直接返回呢？难道不应该新建页表? 什么情况下一个地址没有页表呢？
 		return;
+
+	// 内核态写用户空间时不会检查读写位，所以要在这里主动解除页表的共享。
+	if (!(page & 2))
+	{
+		unshare_page_table((unsigned long*)((address >> 20) & 0xffc));
+		page = *((unsigned long*)((address >> 20) & 0xffc));
+	}
 	
     // 经过下面两条代码之后，page为address对应的页表项的地址
 	page &= 0xffff000;
@@ -404,6 +502,12 @@ static int try_to_share(unsigned long address, struct task_struct* p)
 		else
 			oom();
 	}
+	else if (!(to & 2))
+	{
+		// 当前进程的页表是共享的，要修改它之前先复制一份
+		unshare_page_table((unsigned long*)to_page);
+		to = *(unsigned long*)to_page;
+	}
 
 	to &= 0xffff000;
 	to_page = to + ((address >> 10) & 0xffc);     // 目的地址对应的页表项的地址
@@ -468,8 +572,10 @@ void do_no_page(unsigned long error_code, unsigned long address)
 	unsigned long tmp;
 	unsigned long page;
 	int block;
+	int size;
 	int i;
 
+	trace_event(TRACE_NO_PAGE, address, error_code, 0);
 	address &= 0xffff000;   // 求address地址对应的那一页的起始地址
 	tmp = address - current->start_code;  // 求出来相对就进程start_code的偏移地址
 
@@ -477,13 +583,20 @@ void do_no_page(unsigned long error_code, unsigned long address)
     // 当地址大于了数据空间长度，说明进程在申请新的内存。
 	if (!current->executable || tmp >= current->end_data)
 	{
+		current->min_flt++;
 		get_empty_page(address);
 		return;
 	}
 
     // 先偿试一下能否共享其它进程的物理内存页，如果成功就返回了。
 	if (share_page(tmp))
+	{
+		current->min_flt++;
 		return;
+	}
+
+    // 需要从可执行文件中读入页面，记为一次major fault.
+	current->maj_flt++;
 
     // 新申请一个可使用的空闲的物理内存页。
 	if (!page = get_free_page())
@@ -491,7 +604,9 @@ void do_no_page(unsigned long error_code, unsigned long address)
 
     // 获取地址对应的的可执行文件上的起始的逻辑块号.
     // 因为吧这个地址没有起过end_data，说明这个地址一定是把可执行文件加载到内存之后的部分
-	block = 1 + tmp / BLOCK_SIZE;
+    // 文件的第一个1KB是a.out头, 所以页面在文件中的偏移是tmp + BLOCK_SIZE; 逻辑块大于1KB时它不和块对齐。
+	size = current->executable->i_blocksize;
+	block = (tmp + BLOCK_SIZE) / size;
 
     // 该for循环是把上面获取到的文件内的逻辑块的索引值转换为硬盘中的逻辑块号。
 	for (i = 0; i < 4; ++block, ++i)
@@ -500,7 +615,7 @@ void do_no_page(unsigned long error_code, unsigned long address)
 	}
 
     // 读到指定的一页内容到page位置处.
-	bread_page(page, current->executable->i_dev, nr);
+	bread_page(page, current->executable->i_dev, nr, size, (tmp + BLOCK_SIZE) % size);
 
     // 把大于end_data的内存置为零。
 	i = tmp + 4096 - current->end_data;